@@ -0,0 +1,572 @@
+/*
+Compile the records written by midicsv back into a MIDI file.
+
+Resources:
+http://www.music.mcgill.ca/~ich/classes/mumt306/StandardMIDIfileformat.html
+https://www.fourmilab.ch/webtools/midicsv/
+
+The whole CSV is loaded once and tokenized in place, every field is a view into it.
+Events go straight to a `midi_writer`, strings are unescaped into the space it
+reserves for them, so no record is copied on the way.
+
+Usage:
+make converter
+./bin/csvmidi music.csv music.mid
+*/
+
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "midi_parser.h"
+#include "midi_writer.h"
+
+
+struct reader
+{
+    const char *position;
+    const char *end;
+    size_t line;
+};
+
+enum Record
+{
+    RecordHeader,
+    RecordStartTrack,
+    RecordEndTrack,
+    RecordEndOfFile,
+    RecordNoteOn,
+    RecordNoteOff,
+    RecordPolyAftertouch,
+    RecordControl,
+    RecordProgram,
+    RecordChannelAftertouch,
+    RecordPitchBend,
+    RecordSystemExclusive,
+    RecordSystemExclusivePacket,
+    RecordSequenceNumber,
+    RecordText,
+    RecordCopyright,
+    RecordTitle,
+    RecordInstrumentName,
+    RecordLyric,
+    RecordMarker,
+    RecordCuePoint,
+    RecordChannelPrefix,
+    RecordTempo,
+    RecordSMPTEOffset,
+    RecordTimeSignature,
+    RecordKeySignature,
+    RecordSequencerSpecific,
+    RecordUnknownMeta,
+    RecordCount
+};
+
+// Most frequent records first, they are matched in this order.
+static const struct
+{
+    const char *name;
+    size_t size;
+    enum Record record;
+} records[] = {
+    #define NAME(name, record) { name, sizeof(name) - 1, record }
+    NAME("Note_on_c", RecordNoteOn),
+    NAME("Note_off_c", RecordNoteOff),
+    NAME("Control_c", RecordControl),
+    NAME("Pitch_bend_c", RecordPitchBend),
+    NAME("Program_c", RecordProgram),
+    NAME("Channel_aftertouch_c", RecordChannelAftertouch),
+    NAME("Poly_aftertouch_c", RecordPolyAftertouch),
+    NAME("Tempo", RecordTempo),
+    NAME("Start_track", RecordStartTrack),
+    NAME("End_track", RecordEndTrack),
+    NAME("Header", RecordHeader),
+    NAME("End_of_file", RecordEndOfFile),
+    NAME("Time_signature", RecordTimeSignature),
+    NAME("Key_signature", RecordKeySignature),
+    NAME("Title_t", RecordTitle),
+    NAME("Text_t", RecordText),
+    NAME("Copyright_t", RecordCopyright),
+    NAME("Instrument_name_t", RecordInstrumentName),
+    NAME("Lyric_t", RecordLyric),
+    NAME("Marker_t", RecordMarker),
+    NAME("Cue_point_t", RecordCuePoint),
+    NAME("Sequence_number", RecordSequenceNumber),
+    NAME("Channel_prefix", RecordChannelPrefix),
+    NAME("SMPTE_offset", RecordSMPTEOffset),
+    NAME("Sequencer_specific", RecordSequencerSpecific),
+    NAME("System_exclusive", RecordSystemExclusive),
+    NAME("System_exclusive_packet", RecordSystemExclusivePacket),
+    NAME("Unknown_meta_event", RecordUnknownMeta)
+    #undef NAME
+};
+
+
+static void reader_error(const struct reader *self, const char *message)
+{
+    fprintf(stderr, "csvmidi: line %zu: %s\n", self->line, message);
+}
+
+/// Step over the `,` and blanks in front of the next field, 0 if the record has no more fields.
+static int reader_field(struct reader *self)
+{
+    const char *position = self->position;
+
+    while (position < self->end && (*position == ' ' || *position == '\t'))
+        ++position;
+
+    if (position == self->end || *position != ',')
+        return 0;
+
+    ++position;
+    while (position < self->end && (*position == ' ' || *position == '\t'))
+        ++position;
+
+    self->position = position;
+    return 1;
+}
+
+static int reader_integer(struct reader *self, long *value)
+{
+    const char *position = self->position;
+    int negative = 0;
+    long n = 0;
+
+    if (position < self->end && *position == '-') {
+        negative = 1;
+        ++position;
+    }
+
+    if (position == self->end || *position < '0' || *position > '9')
+        return 0;
+
+    // Values past `LONG_MAX` are not integers to the caller, rather than wrapping around.
+    while (position < self->end && *position >= '0' && *position <= '9') {
+        int digit = *position++ - '0';
+
+        if (n > (LONG_MAX - digit) / 10)
+            return 0;
+        n = n * 10 + digit;
+    }
+
+    *value = negative ? -n : n;
+    self->position = position;
+    return 1;
+}
+
+/// Three octal digits of a `\ooo` escape, the first one at most 3 to fit in a byte.
+static int is_octal(const char *digits)
+{
+    return digits[0] >= '0' && digits[0] <= '3'
+        && digits[1] >= '0' && digits[1] <= '7'
+        && digits[2] >= '0' && digits[2] <= '7';
+}
+
+/// Read the next field as an integer in [`minimum`, `maximum`].
+static int reader_next(struct reader *self, long *value, long minimum, long maximum)
+{
+    if (!reader_field(self) || !reader_integer(self, value)) {
+        reader_error(self, "expected an integer field");
+        return 0;
+    }
+
+    if (*value < minimum || *value > maximum) {
+        reader_error(self, "field out of range");
+        return 0;
+    }
+
+    return 1;
+}
+
+/// Read the record name in place.
+static int reader_name(struct reader *self, enum Record *record)
+{
+    const char *start = self->position, *position = start;
+
+    while (position < self->end && *position != ',' && *position != ' ' && *position != '\n' && *position != '\r')
+        ++position;
+
+    size_t size = position - start;
+    self->position = position;
+
+    for (size_t i = 0; i < sizeof(records) / sizeof(*records); ++i) {
+        if (records[i].size == size && !memcmp(records[i].name, start, size)) {
+            *record = records[i].record;
+            return 1;
+        }
+    }
+
+    reader_error(self, "unknown record");
+    return 0;
+}
+
+/**
+Find the extent of the quoted string at the reader and its unescaped size.
+`"` is doubled inside strings, `\\` stands for a backslash and `\ooo` for any byte in octal.
+*/
+static int reader_string(struct reader *self, const char **start, size_t *raw_size, size_t *size)
+{
+    const char *position = self->position;
+    size_t n = 0;
+
+    if (position == self->end || *position != '"') {
+        reader_error(self, "expected a quoted string");
+        return 0;
+    }
+
+    *start = ++position;
+
+    for (;;) {
+        const char *quote = memchr(position, '"', self->end - position);
+        const char *escape = memchr(position, '\\', (quote ? quote : self->end) - position);
+
+        if (!quote) {
+            reader_error(self, "unterminated string");
+            return 0;
+        }
+
+        if (escape) {
+            n += escape - position;
+            if (escape + 1 < quote && escape[1] == '\\') {
+                position = escape + 2;
+            } else if (escape + 3 < quote && is_octal(escape + 1)) {
+                position = escape + 4;
+            } else {
+                reader_error(self, "invalid escape");
+                return 0;
+            }
+            ++n;
+            continue;
+        }
+
+        n += quote - position;
+
+        // Doubled quote, part of the string.
+        if (quote + 1 < self->end && quote[1] == '"') {
+            ++n;
+            position = quote + 2;
+            continue;
+        }
+
+        *raw_size = quote - *start;
+        *size = n;
+        self->position = quote + 1;
+        return 1;
+    }
+}
+
+/// Copy `raw_size` escaped bytes to `buffer`, unescaping them on the way.
+static void unescape(uint8_t *buffer, const char *data, size_t raw_size, size_t size)
+{
+    const char *end = data + raw_size;
+
+    if (raw_size == size) {
+        memcpy(buffer, data, size);
+        return;
+    }
+
+    while (data < end) {
+        if (*data == '"') {
+            *buffer++ = '"';
+            data += 2;
+        } else if (*data == '\\' && data[1] == '\\') {
+            *buffer++ = '\\';
+            data += 2;
+        } else if (*data == '\\') {
+            *buffer++ = (data[1] - '0') << 6 | (data[2] - '0') << 3 | (data[3] - '0');
+            data += 4;
+        } else {
+            *buffer++ = *data++;
+        }
+    }
+}
+
+/// Add an event whose payload is the quoted string field at the reader.
+static int write_string(struct midi_writer *writer, struct reader *reader, uint16_t track, uint32_t tick, uint8_t status, uint8_t type)
+{
+    const char *start;
+    size_t raw_size, size;
+    uint8_t *buffer;
+
+    if (!reader_field(reader) || !reader_string(reader, &start, &raw_size, &size))
+        return 0;
+
+    if (!(buffer = midi_writer_payload(writer, track, tick, status, type, NULL, size)))
+        return 0;
+
+    unescape(buffer, start, raw_size, size);
+    return 1;
+}
+
+
+static int compile_record(struct reader *reader, struct midi_writer *writer, int *has_header)
+{
+    static const uint8_t channel_status[RecordCount] = {
+        [RecordNoteOn] = EventNoteOn,
+        [RecordNoteOff] = EventNoteOff,
+        [RecordPolyAftertouch] = EventKeyPressure,
+        [RecordControl] = EventControllerChange,
+        [RecordProgram] = EventProgramChange,
+        [RecordChannelAftertouch] = EventChannelPressure
+    };
+    static const uint8_t meta_type[RecordCount] = {
+        [RecordText] = MetaText,
+        [RecordCopyright] = MetaCopyright,
+        [RecordTitle] = MetaTrackName,
+        [RecordInstrumentName] = MetaInstrumentName,
+        [RecordLyric] = MetaLyrics,
+        [RecordMarker] = MetaMarker,
+        [RecordCuePoint] = MetaCuePoint,
+        [RecordSequencerSpecific] = MetaSequencerSpecific
+    };
+
+    long number, timestamp, value[5];
+    enum Record record;
+    uint16_t track;
+    uint32_t tick;
+    uint8_t data[5];
+    int written;
+
+    if (!reader_integer(reader, &number) || !reader_field(reader) || !reader_integer(reader, &timestamp)) {
+        reader_error(reader, "expected a track and a timestamp");
+        return 0;
+    }
+
+    if (!reader_field(reader) || !reader_name(reader, &record))
+        return 0;
+
+    if (record == RecordHeader) {
+        if (*has_header) {
+            reader_error(reader, "duplicate header");
+            return 0;
+        }
+
+        for (int i = 0; i < 3; ++i)
+            if (!reader_next(reader, &value[i], 0, UINT16_MAX))
+                return 0;
+
+        *has_header = 1;
+        return midi_writer_new(writer, value[0], value[1], value[2]) != NULL;
+    }
+
+    if (record == RecordEndOfFile)
+        return 1;
+
+    if (!*has_header) {
+        reader_error(reader, "record before the header");
+        return 0;
+    }
+
+    if (number < 1 || number > writer->header.track_count) {
+        reader_error(reader, "track out of range");
+        return 0;
+    }
+
+    if (timestamp < 0 || timestamp > UINT32_MAX) {
+        reader_error(reader, "timestamp out of range");
+        return 0;
+    }
+
+    track = number - 1;
+    tick = timestamp;
+
+    switch (record) {
+    case RecordStartTrack:
+        return 1;
+
+    case RecordNoteOn:
+    case RecordNoteOff:
+    case RecordPolyAftertouch:
+    case RecordControl:
+        if (!reader_next(reader, &value[0], 0, 15) || !reader_next(reader, &value[1], 0, 127) || !reader_next(reader, &value[2], 0, 127))
+            return 0;
+        written = midi_writer_event(writer, track, tick, channel_status[record] | value[0], value[1], value[2]) != NULL;
+        break;
+
+    case RecordProgram:
+    case RecordChannelAftertouch:
+        if (!reader_next(reader, &value[0], 0, 15) || !reader_next(reader, &value[1], 0, 127))
+            return 0;
+        written = midi_writer_event(writer, track, tick, channel_status[record] | value[0], value[1], 0) != NULL;
+        break;
+
+    case RecordPitchBend:
+        if (!reader_next(reader, &value[0], 0, 15) || !reader_next(reader, &value[1], 0, 0x3FFF))
+            return 0;
+        written = midi_writer_event(writer, track, tick, EventPitchBend | value[0], value[1] & 0x7F, value[1] >> 7) != NULL;
+        break;
+
+    case RecordSystemExclusive:
+    case RecordSystemExclusivePacket:
+        // The length field is implied by the string.
+        if (!reader_next(reader, &value[0], 0, UINT32_MAX))
+            return 0;
+        written = write_string(writer, reader, track, tick, record == RecordSystemExclusive ? 0xF0 : 0xF7, 0);
+        break;
+
+    case RecordEndTrack:
+        written = midi_writer_meta(writer, track, tick, MetaEndOfTrack, NULL, 0) != NULL;
+        break;
+
+    case RecordSequenceNumber:
+        if (!reader_next(reader, &value[0], 0, UINT16_MAX))
+            return 0;
+        data[0] = value[0] >> 8;
+        data[1] = value[0];
+        written = midi_writer_meta(writer, track, tick, MetaSequence, data, 2) != NULL;
+        break;
+
+    case RecordChannelPrefix:
+        if (!reader_next(reader, &value[0], 0, 255))
+            return 0;
+        data[0] = value[0];
+        written = midi_writer_meta(writer, track, tick, MetaChannelPrefix, data, 1) != NULL;
+        break;
+
+    case RecordTempo:
+        if (!reader_next(reader, &value[0], 0, 0xFFFFFF))
+            return 0;
+        data[0] = value[0] >> 16;
+        data[1] = value[0] >> 8;
+        data[2] = value[0];
+        written = midi_writer_meta(writer, track, tick, MetaSetTempo, data, 3) != NULL;
+        break;
+
+    case RecordSMPTEOffset:
+    case RecordTimeSignature: {
+        size_t size = record == RecordSMPTEOffset ? 5 : 4;
+
+        for (size_t i = 0; i < size; ++i) {
+            if (!reader_next(reader, &value[i], 0, 255))
+                return 0;
+            data[i] = value[i];
+        }
+        written = midi_writer_meta(writer, track, tick, record == RecordSMPTEOffset ? MetaSMPTEOffset : MetaTimeSignature, data, size) != NULL;
+        break;
+    }
+
+    case RecordKeySignature: {
+        const char *start;
+        size_t raw_size, size;
+
+        if (!reader_next(reader, &value[0], -128, 127) || !reader_field(reader) || !reader_string(reader, &start, &raw_size, &size))
+            return 0;
+        data[0] = value[0];
+        data[1] = raw_size == 5 && !memcmp(start, "minor", 5);
+        written = midi_writer_meta(writer, track, tick, MetaKeySignature, data, 2) != NULL;
+        break;
+    }
+
+    case RecordSequencerSpecific:
+        if (!reader_next(reader, &value[0], 0, UINT32_MAX))
+            return 0;
+        // fallthrough
+    case RecordText:
+    case RecordCopyright:
+    case RecordTitle:
+    case RecordInstrumentName:
+    case RecordLyric:
+    case RecordMarker:
+    case RecordCuePoint:
+        written = write_string(writer, reader, track, tick, 0xFF, meta_type[record]);
+        break;
+
+    case RecordUnknownMeta:
+        if (!reader_next(reader, &value[0], 0, 127) || !reader_next(reader, &value[1], 0, UINT32_MAX))
+            return 0;
+        written = write_string(writer, reader, track, tick, 0xFF, value[0]);
+        break;
+
+    default:
+        return 1;
+    }
+
+    if (!written)
+        reader_error(reader, midi_status == MIDI_InvalidEvent ? "event out of order or after End_track" : "could not add the event");
+    return written;
+}
+
+int csv_to_midi(FILE *csv, FILE *midi)
+{
+    struct reader reader;
+    struct midi_writer writer;
+    const char *line_end;
+    size_t size;
+    uint8_t *data;
+    int status = 1, has_header = 0;
+
+    if (!(data = midi_load(csv, &size))) {
+        fprintf(stderr, "csvmidi: could not read the CSV file\n");
+        return 1;
+    }
+
+    reader.end = (const char *) data + size;
+    reader.line = 0;
+
+    for (const char *line = (const char *) data; line < reader.end; line = line_end + 1) {
+        ++reader.line;
+
+        if (!(line_end = memchr(line, '\n', reader.end - line)))
+            line_end = reader.end;
+
+        reader.position = line;
+        while (reader.position < line_end && (*reader.position == ' ' || *reader.position == '\t' || *reader.position == '\r'))
+            ++reader.position;
+
+        // Blank lines and comments.
+        if (reader.position == line_end || *reader.position == '#' || *reader.position == ';')
+            continue;
+
+        // Strings never span lines, bound the record to its own.
+        reader.end = line_end;
+        status = compile_record(&reader, &writer, &has_header);
+        reader.end = (const char *) data + size;
+
+        if (!status)
+            break;
+    }
+
+    if (status && !has_header) {
+        fprintf(stderr, "csvmidi: no header record\n");
+        status = 0;
+    }
+
+    if (status && !midi_writer_finalize(&writer, midi)) {
+        fprintf(stderr, "csvmidi: could not write the MIDI file\n");
+        status = 0;
+    }
+
+    if (has_header)
+        midi_writer_free(&writer);
+
+    free(data);
+    return !status;
+}
+
+int main(int argc, char **argv)
+{
+    FILE
+    *csv = stdin,
+    *midi = stdout;
+
+    switch (argc) {
+    case 3:
+        midi = fopen(argv[2], "wb");
+    case 2:
+        csv = fopen(argv[1], "rb");
+    }
+
+    if (!csv || !midi) {
+        perror("csvmidi");
+        return 1;
+    }
+
+    int status = csv_to_midi(csv, midi);
+
+    fclose(csv);
+    fclose(midi);
+    return status;
+}
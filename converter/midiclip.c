@@ -0,0 +1,99 @@
+/*
+Cut a time range out of a MIDI file into a new one, see `midi_extract.h`.
+The tempo, time signature, key signature, programs, controllers and pitch bends in
+effect at the start of the range are set again at the start of the clip.
+
+The input may be a `.midx` sidecar written by midiindex: the range is then found by
+binary search on its time column and nothing past the range is touched.
+
+Options:
+-s seconds  start of the range, 0 by default
+-e seconds  end of the range, the end of the file by default
+
+Usage:
+make converter
+./bin/midiclip -s 30 -e 60 music.mid preview.mid
+*/
+
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "midi_parser.h"
+#include "midi_index.h"
+#include "midi_writer.h"
+#include "midi_extract.h"
+
+
+int main(int argc, char **argv)
+{
+    uint64_t start_us = 0, end_us = UINT64_MAX;
+    int option;
+
+    while ((option = getopt(argc, argv, "s:e:")) != -1) {
+        switch (option) {
+        case 's':
+            start_us = (uint64_t) (strtod(optarg, NULL) * 1E6);
+            break;
+        case 'e':
+            end_us = (uint64_t) (strtod(optarg, NULL) * 1E6);
+            break;
+        default:
+            fprintf(stderr, "usage: midiclip [-s seconds] [-e seconds] music.mid|music.midx [clip.mid]\n");
+            return 1;
+        }
+    }
+
+    argc -= optind - 1;
+    argv += optind - 1;
+
+    if (argc < 2 || start_us >= end_us) {
+        fprintf(stderr, "usage: midiclip [-s seconds] [-e seconds] music.mid|music.midx [clip.mid]\n");
+        return 1;
+    }
+
+    FILE
+    *midi = fopen(argv[1], "rb"),
+    *clip = argc > 2 ? fopen(argv[2], "wb") : stdout;
+
+    if (!midi || !clip) {
+        perror("midiclip");
+        return 1;
+    }
+
+    static struct midi_extract extract;
+    struct midi_index index;
+    struct midi_writer writer = { { 0 } };
+    char magic[4] = { 0 };
+    size_t size;
+    uint8_t *data = NULL;
+    int status;
+
+    midi_extract_new(&extract, start_us, end_us);
+    fread(magic, 1, sizeof(magic), midi);
+
+    if (!memcmp(magic, MIDI_INDEX_MAGIC, 4)) {
+        if ((status = midi_index_open(&index, argv[1]) ? MIDI_Success : midi_status) == MIDI_Success) {
+            status = midi_extract_index(&extract, &index, &writer);
+            midi_index_close(&index);
+        }
+    } else {
+        rewind(midi);
+        status = (data = midi_load(midi, &size)) ? midi_extract_file(&extract, data, size, &writer) : MIDI_OutOfMemory;
+    }
+
+    if (status == MIDI_Success && !midi_writer_finalize(&writer, clip))
+        status = midi_status;
+
+    if (status != MIDI_Success)
+        fprintf(stderr, "midiclip: could not cut the MIDI file, error %d\n", status);
+
+    midi_writer_free(&writer);
+    free(data);
+    fclose(midi);
+    fclose(clip);
+    return status != MIDI_Success;
+}
@@ -8,8 +8,14 @@ http://www.gweep.net/~prefect/eng/reference/protocol/midispec.html
 https://www.eecs.umich.edu/courses/eecs373/Lec/StudentF18/MIDI%20Presentation.pdf
 
 Usage:
-gcc main.c -o main -Wall
-./main music.mid music.csv
+make converter
+./bin/midicsv music.mid music.csv
+
+With `-m`, the tracks are merged in playing order and every record gets the absolute
+time of the event in micro seconds as a third column, following the whole tempo map.
+The tracks of a format 2 file are independent sequences, they come one after the other,
+each timed from 0 with its own tempo map.
+./bin/midicsv -m music.mid music.csv
 */
 
 
@@ -17,443 +23,378 @@ gcc main.c -o main -Wall
 #include <stdint.h>
 #include <string.h>
 
+#include "midi_parser.h"
+#include "output.h"
 
-enum EventType
-{
-    EventNoteOff = 0x80,
-    EventNoteOn = 0x90,
-    EventKeyPressure = 0xA0,
-    EventControllerChange = 0xB0,
-    EventProgramChange = 0xC0,
-    EventChannelPressure = 0xD0,
-    EventPitchBend = 0xE0,
-    EventSystemExclusive = 0xF0
-};
 
-enum MetaEventType
+struct csv
 {
-    MetaSequence = 0x00,
-    MetaText = 0x01,
-    MetaCopyright = 0x02,
-    MetaTrackName = 0x03,
-    MetaInstrumentName = 0x04,
-    MetaLyrics = 0x05,
-    MetaMarker = 0x06,
-    MetaCuePoint = 0x07,
-    MetaChannelPrefix = 0x20,
-    MetaEndOfTrack = 0x2F,
-    MetaSetTempo = 0x51,
-    MetaSMPTEOffset = 0x54,
-    MetaTimeSignature = 0x58,
-    MetaKeySignature = 0x59,
-    MetaSequencerSpecific = 0x7F
+    struct output output;
+
+    // `track, ` written in front of every record of the track.
+    char prefix[OUTPUT_FIELD_SIZE];
+    size_t prefix_size;
+
+    uint32_t tempo;
+
+    // Merged output, with the time of the current record in micro seconds.
+    uint8_t merged;
+    uint64_t us;
 };
 
-enum Error
+
+void fprintn(struct output *dest, const uint8_t *data, size_t n)
 {
-    InvalidHeaderChunk,
-    InvalidTrackChunk,
-    PotentialBufferOverflow
-};
+    output_char(dest, '"');
+    output_escaped(dest, data, n);
+    output_char(dest, '"');
+}
 
-/*
-struct MidiNote
+
+/// Start a record with the cached `track, ` prefix, the timestamp, the time when merged and `name`.
+static inline void record(struct csv *self, uint32_t timestamp, const char *name, size_t name_size)
 {
-    uint8_t key;
-    uint8_t velocity;
-    uint32_t time;
-    uint32_t duration;
-};
+    struct output *csv = &self->output;
+    char *buffer = output_reserve(csv, self->prefix_size + 2 * OUTPUT_FIELD_SIZE + name_size);
+    char *begin = buffer;
+    char digits[OUTPUT_FIELD_SIZE];
+    char *start = output_format_u64(digits + sizeof(digits), timestamp);
+    size_t size = digits + sizeof(digits) - start;
+
+    memcpy(buffer, self->prefix, self->prefix_size);
+    buffer += self->prefix_size;
+    memcpy(buffer, start, size);
+    buffer += size;
+    memcpy(buffer, ", ", 2);
+    buffer += 2;
+
+    if (self->merged) {
+        start = output_format_u64(digits + sizeof(digits), self->us);
+        size = digits + sizeof(digits) - start;
+        memcpy(buffer, start, size);
+        buffer += size;
+        memcpy(buffer, ", ", 2);
+        buffer += 2;
+    }
+
+    memcpy(buffer, name, name_size);
+    csv->size += buffer + name_size - begin;
+}
 
-struct MidiEvent
+/// Append `, value` to the current record.
+static inline void field(struct output *csv, uint64_t value)
 {
-    enum EventType event;
-    uint8_t key;
-    uint8_t velocity;
-    uint8_t delta_tick;
-};
-*/
+    output_literal(csv, ", ");
+    output_u64(csv, value);
+}
+
+#define RECORD(name) record(self, message->timestamp, name, sizeof(name) - 1)
 
 
-uint32_t swap32(uint32_t n)
+static int csv_header(void *context, const struct midi_header *header)
 {
-    return (n << 24 & 0xFF000000) | (n << 8 & 0x00FF0000) | (n >> 8 & 0x0000FF00) | (n >> 24 & 0x000000FF);
+    struct csv *self = (struct csv *) context;
+    struct output *csv = &self->output;
+
+    if (header->format == 0 && header->track_count != 1)
+        return MIDI_InvalidHeaderChunk;
+
+    if (self->merged)
+        output_literal(csv, "0, 0, 0, Header, ");
+    else
+        output_literal(csv, "0, 0, Header, ");
+    output_u64(csv, header->format);
+    field(csv, header->track_count);
+    field(csv, header->time_division);
+    output_char(csv, '\n');
+
+    return 0;
 }
 
-uint16_t swap16(uint16_t n)
+/// Cache the `track, ` prefix of the records of `track`.
+static void csv_prefix(struct csv *self, uint16_t track)
 {
-    return (n << 8 & 0xFF00) | (n >> 8 & 0x00FF);
+    char *end = self->prefix + sizeof(self->prefix) - 2;
+    char *start = output_format_u64(end, track + 1);
+
+    memcpy(end, ", ", 2);
+    self->prefix_size = self->prefix + sizeof(self->prefix) - start;
+    memmove(self->prefix, start, self->prefix_size);
 }
 
-uint32_t read_value(FILE *src)
+static int csv_track(void *context, uint16_t track)
 {
-    uint8_t buffer = 0x80;
-    uint32_t value = 0;
-    while (buffer & 0x80) {
-        buffer = fgetc(src);
-        value = value << 7 | (buffer & 0x7F);
-    }
+    struct csv *self = (struct csv *) context;
 
-    return value;
+    csv_prefix(self, track);
+    record(self, 0, "Start_track\n", 12);
+    return 0;
 }
 
+/// Record of a meta event whose payload is shorter than its type requires.
+static void csv_unknown_meta(struct csv *self, const struct midi_message *message)
+{
+    struct output *csv = &self->output;
+
+    RECORD("Unknown_meta_event, ");
+    output_u64(csv, message->meta_type);
+    field(csv, message->size);
+    output_literal(csv, ", ");
+    fprintn(csv, message->data, message->size);
+    output_char(csv, '\n');
+}
 
-void fprintn(FILE *dest, FILE *src, size_t n)
+static void csv_meta(struct csv *self, const struct midi_message *message)
 {
-    uint8_t c;
-    fputc('"', dest);
-
-    while (n--) {
-        c = fgetc(src);
-        // `c` is printable or it doesn't belong to ASCII.
-        switch ((c >= ' ') << 1 | (c == '"')) {
-        case 3:
-            // Quote characters embedded within strings are represented by `two` consecutive quotes.
-            fputc(c, dest);
-        case 2:
-            fputc(c, dest);
-            break;
-        default:
-            // 3 digits octal representation of non-printable characters prefixed with `\`.
-            fprintf(dest, "\\%03o", c);
-        }
+    struct output *csv = &self->output;
+    const uint8_t *data = message->data;
+    static const uint8_t minimum_size[128] = {
+        [MetaSequence] = 2,
+        [MetaChannelPrefix] = 1,
+        [MetaSetTempo] = 3,
+        [MetaSMPTEOffset] = 5,
+        [MetaTimeSignature] = 4,
+        [MetaKeySignature] = 2
+    };
+
+    if (message->meta_type < 128 && message->size < minimum_size[message->meta_type]) {
+        csv_unknown_meta(self, message);
+        return;
     }
 
-    fputc('"', dest);
-}
+    switch (message->meta_type) {
+    case MetaSequence:
+        RECORD("Sequence_number, ");
+        output_u64(csv, data[0] << 8 | data[1]);
+        output_char(csv, '\n');
+        break;
+
+    case MetaText:
+        RECORD("Text_t, ");
+        break;
+    case MetaCopyright:
+        RECORD("Copyright_t, ");
+        break;
+    case MetaTrackName:
+        RECORD("Title_t, ");
+        break;
+    case MetaInstrumentName:
+        RECORD("Instrument_name_t, ");
+        break;
+    case MetaLyrics:
+        RECORD("Lyric_t, ");
+        break;
+    case MetaMarker:
+        RECORD("Marker_t, ");
+        break;
+    case MetaCuePoint:
+        RECORD("Cue_point_t, ");
+        break;
+
+    case MetaChannelPrefix:
+        RECORD("Channel_prefix, ");
+        output_u64(csv, data[0]);
+        output_char(csv, '\n');
+        break;
+
+    case MetaEndOfTrack:
+        RECORD("End_track\n");
+        break;
+
+    case MetaSetTempo:
+        // No of microseconds per MIDI quarter-note.
+        self->tempo = data[0] << 16 | data[1] << 8 | data[2];
+        RECORD("Tempo, ");
+        output_u64(csv, self->tempo);
+        output_char(csv, '\n');
+        break;
+
+    case MetaSMPTEOffset:
+        // Specifies the SMPTE time code at which it should start playing.
+        RECORD("SMPTE_offset, ");
+        output_u64(csv, data[0]);
+        for (size_t i = 1; i < 5; ++i)
+            field(csv, data[i]);
+        output_char(csv, '\n');
+        break;
+
+    case MetaTimeSignature:
+        RECORD("Time_signature, ");
+        output_u64(csv, data[0]);
+        field(csv, data[1]);
+        field(csv, data[2]);
+        field(csv, data[3]);
+        output_char(csv, '\n');
+        break;
+
+    case MetaKeySignature:
+        // 0 for the key of C, a positive value for each sharp above C,
+        // or a negative value for each flat below C, thus in the inclusive range −7 to 7.
+        RECORD("Key_signature, ");
+        output_i64(csv, (int8_t) data[0]);
+        // 1 if the key is minor else 0.
+        if (data[1])
+            output_literal(csv, ", \"minor\"\n");
+        else
+            output_literal(csv, ", \"major\"\n");
+        break;
+
+    case MetaSequencerSpecific:
+        // Used to store vendor-proprietary data in a MIDI file.
+        RECORD("Sequencer_specific, ");
+        output_u64(csv, message->size);
+        output_literal(csv, ", ");
+        fprintn(csv, data, message->size);
+        output_char(csv, '\n');
+        break;
+
+    default:
+        csv_unknown_meta(self, message);
+    }
 
+    // Text events share their payload format.
+    if (message->meta_type >= MetaText && message->meta_type <= MetaCuePoint) {
+        fprintn(csv, data, message->size);
+        output_char(csv, '\n');
+    }
+}
 
-struct HeaderChunk
+static int csv_message(void *context, const struct midi_message *message)
 {
-    char chunk_id[4];
-    uint32_t length;
-    uint16_t format;
-    uint16_t track_chunks;
-    uint16_t time_division;
-};
+    struct csv *self = (struct csv *) context;
+    struct output *csv = &self->output;
+    const uint8_t *data = message->data;
+    uint8_t channel = message->status & 0x0F;
+
+    switch (message->status & 0xF0) {
+    case EventNoteOn:
+        RECORD("Note_on_c, ");
+        break;
+    case EventNoteOff:
+        RECORD("Note_off_c, ");
+        break;
+    case EventKeyPressure:
+        RECORD("Poly_aftertouch_c, ");
+        break;
+    case EventControllerChange:
+        RECORD("Control_c, ");
+        break;
+    case EventProgramChange:
+        RECORD("Program_c, ");
+        break;
+    case EventChannelPressure:
+        // `monophonic` or `channel` aftertouch applies to the Channel as a whole,
+        // not individual note numbers on that channel.
+        RECORD("Channel_aftertouch_c, ");
+        break;
+    case EventPitchBend:
+        RECORD("Pitch_bend_c, ");
+        output_u64(csv, channel);
+        field(csv, (data[1] & 0x7F) << 7 | (data[0] & 0x7F));
+        output_char(csv, '\n');
+        return 0;
+
+    case EventSystemExclusive:
+        switch (message->status) {
+        case 0xF0: // System Exclusive Message Begin
+        case 0xF7: // System Exclusive Message End
+            if (message->status == 0xF0)
+                RECORD("System_exclusive, ");
+            else
+                RECORD("System_exclusive_packet, ");
+            output_u64(csv, message->size);
+            output_literal(csv, ", ");
+            fprintn(csv, data, message->size);
+            output_char(csv, '\n');
+            break;
+        case 0xFF:
+            csv_meta(self, message);
+        }
+        return 0;
+    }
 
-struct HeaderChunk create_header_chunk(FILE *src)
-{
-    struct HeaderChunk hc;
-    fread(&hc.chunk_id, 1, 4, src);
-    fread(&hc.length, 4, 1, src);
-    fread(&hc.format, 2, 1, src);
-    fread(&hc.track_chunks, 2, 1, src);
-    fread(&hc.time_division, 2, 1, src);
-
-    hc.length = swap32(hc.length);
-    hc.format = swap16(hc.format);
-    hc.track_chunks = swap16(hc.track_chunks);
-    hc.time_division = swap16(hc.time_division);
-
-    return hc;
+    // Channel messages: channel followed by their 1 or 2 data bytes.
+    output_u64(csv, channel);
+    field(csv, data[0]);
+    if (message->size == 2)
+        field(csv, data[1]);
+    output_char(csv, '\n');
+
+    return 0;
 }
 
-uint8_t midi_to_csv(FILE *midi, FILE *csv)
+/// Records of every track in playing order, ties going to the lowest track as in `midi_parser_next`.
+static int csv_merged(struct csv *self, const uint8_t *data, size_t size)
 {
-    // TODO: Can't handle small invalid input from stdin.
-
-    size_t timestamp = 0;
-
-    uint32_t
-    delta_time,
-    chunk_length,
-    event_length,
-    tempo = 0,
-    BPM = 0;
-
-    // Could have used a simple buffer instead of so many variables, but it was too unintuitive...
-    uint8_t
-    previous_status,
-    status,
-    channel,
-    end_of_track,
-    pitch,
-    velocity,
-    key,
-    pressure,
-    controller,
-    value,
-    preset,
-    bend_LSB,
-    bend_MSB,
-    type;
-
-    char buffer[64];
-    FILE *error_stream = stderr;
+    struct midi_merge merge;
+    struct midi_message message;
+    uint32_t track = UINT32_MAX;
+    int status;
 
-    char chunk_id[4];
+    if (!midi_merge_new(&merge, data, size))
+        return midi_status;
 
-    struct HeaderChunk header = create_header_chunk(midi);
+    if ((status = csv_header(self, &merge.header))) {
+        midi_merge_free(&merge);
+        return status;
+    }
 
-    if (strncmp(header.chunk_id, "MThd", 4) || (header.format == 0 && header.track_chunks != 1)) {
-        return InvalidHeaderChunk;
+    while (midi_merge_next(&merge, &message)) {
+        if (message.track != track)
+            csv_prefix(self, track = message.track);
+        self->us = merge.us;
+        csv_message(self, &message);
     }
 
-    fprintf(
-        csv, "0, 0, Header, %hu, %hu, %hu\n",
-        header.format, header.track_chunks, header.time_division
-    );
+    midi_merge_free(&merge);
+    return midi_status;
+}
 
-    for (size_t ntrack = 1; ntrack <= header.track_chunks; ++ntrack) {
-        end_of_track = 0;
-        timestamp = 0;
+int midi_to_csv(FILE *midi, FILE *file, int merged)
+{
+    static struct csv self;
+    FILE *error_stream = stderr;
+    size_t size;
+    uint8_t *data;
+    int status;
+
+    struct midi_visitor visitor = {
+        .context = &self,
+        .header = csv_header,
+        .track = csv_track,
+        .message = csv_message
+    };
+
+    if (!(data = midi_load(midi, &size))) {
+        fprintf(error_stream, "Could not read the MIDI file\n");
+        return MIDI_InvalidHeaderChunk;
+    }
 
-        fread(chunk_id, 1, 4, midi);
+    output_new(&self.output, file);
+    self.tempo = 0;
+    self.merged = merged;
+    self.us = 0;
 
-        // Track chunk length in bytes. Skip this number of bytes to get to next track.
-        fread(&chunk_length, 4, 1, midi);
-        chunk_length = swap32(chunk_length);
-        fprintf(error_stream, "%u %u\n", ntrack, chunk_length);
+    if (merged)
+        status = csv_merged(&self, data, size);
+    else
+        status = midi_visit(data, size, &visitor);
 
-        if (strncmp(chunk_id, "MTrk", 4)) {
-            return InvalidTrackChunk;
-        }
+    if (status == MIDI_Success && merged)
+        output_literal(&self.output, "0, 0, 0, End_of_file\n");
+    else if (status == MIDI_Success)
+        output_literal(&self.output, "0, 0, End_of_file\n");
+    else
+        fprintf(error_stream, "Invalid MIDI file, error %d\n", status);
 
-        fprintf(csv, "%lu, %lu, Start_track\n", ntrack, timestamp);
-
-        while (!feof(midi) && !end_of_track) {
-            // All MIDI events contain a timecode, and a status byte.
-
-            // Delta time in "ticks" from the previous event.
-            // Could be 0 if two events happen simultaneously.
-            delta_time = read_value(midi);
-            timestamp += delta_time;
-
-            // Read first byte of message, this could be the status byte, or it could not...
-            status = fgetc(midi);
-
-            // Handle MIDI Running Status
-            if (status < 0x80) {
-                status = previous_status;
-                fseek(midi, -1, SEEK_CUR);
-            }
-
-            previous_status = status;
-            channel = status & 0x0F;
-
-            // Non-meta events
-            switch (status & 0xF0) {
-            case EventNoteOn:
-                pitch = fgetc(midi),
-                velocity = fgetc(midi);
-                fprintf(
-                    csv, "%lu, %lu, Note_on_c, %hhu, %hhu, %hhu\n",
-                    ntrack, timestamp, channel, pitch, velocity
-                );
-                break;
-
-            case EventNoteOff:
-                pitch = fgetc(midi);
-                velocity = fgetc(midi);
-                fprintf(
-                    csv, "%lu, %lu, %s, %hhu, %hhu, %hhu\n",
-                    ntrack, timestamp, (velocity) ? "Note_off_c" : "Note_on_c", channel, pitch, velocity
-                );
-
-            case EventKeyPressure:
-                key = fgetc(midi);
-                pressure = fgetc(midi);
-                fprintf(
-                    csv, "%lu, %lu, Poly_aftertouch_c, %hhu, %hhu, %hhu\n",
-                    ntrack, timestamp, channel, key, pressure
-                );
-                break;
-
-            case EventControllerChange:
-                controller = fgetc(midi);
-                value = fgetc(midi);
-                fprintf(
-                    csv, "%lu, %lu, Control_c, %hhu, %hhu, %hhu\n",
-                    ntrack, timestamp, channel, controller, value
-                );
-                break;
-
-            case EventProgramChange:
-                preset = fgetc(midi);
-                fprintf(
-                    csv, "%lu, %lu, Program_c, %hhu, %hhu\n",
-                    ntrack, timestamp, channel, preset
-                );
-                break;
-
-            case EventChannelPressure:
-                // `monophonic` or `channel` aftertouch applies to the Channel as a whole,
-                // not individual note numbers on that channel.
-                pressure = fgetc(midi);
-                fprintf(
-                    csv, "%lu, %lu, Channel_aftertouch_c, %hhu, %hhu\n",
-                    ntrack, timestamp, channel, pressure
-                );
-                break;
-
-            case EventPitchBend:
-                bend_LSB = fgetc(midi);
-                bend_MSB = fgetc(midi);
-                fprintf(
-                    csv, "%lu, %lu, Pitch_bend_c, %hhu, %hhu\n",
-                    ntrack, timestamp, channel, (bend_MSB & 0x7F) << 7 | (bend_LSB & 0x7F)
-                );
-                break;
-
-            case EventSystemExclusive:
-                // Storing vendor-specific information to be transmitted to that vendor's products.
-                // SystemExclusive events and meta events cancel any running status which was in effect.
-                // Meta events are processed after this switch statement for clarity.
-                previous_status = 0;
-                switch (status) {
-                    case 0xF0: // System Exclusive Message Begin
-                    case 0xF7: // System Exclusive Message End
-                        event_length = read_value(midi);
-                        fprintf(
-                            csv, "%lu, %lu, %s, %u, ", ntrack, timestamp,
-                            (status == 0xF0) ? "System_exclusive" : "System_exclusive_packet", event_length
-                        );
-                        fprintn(csv, midi, event_length);
-                        fputc('\n', csv);
-                }
-                break;
-
-            default:
-                fprintf(error_stream, "Unrecognised Status Byte: `%hhu`\n", status);
-                break;
-            }
-
-            if (status != 0xFF) continue;
-
-            // Meta events
-            type = fgetc(midi);
-
-            // Should be careful to protect against buffer overflows
-            // and truncation of these records for large `event_length` values.
-            event_length = read_value(midi);
-
-            switch (type) {
-            case MetaSequence:
-                // `timestamp` should be 0 here.
-                fprintf(csv, "%lu, 0, Sequence_number, %hu\n", ntrack, fgetc(midi) << 8 | fgetc(midi));
-                fprintn(csv, midi, event_length);
-                fputc('\n', csv);
-                break;
-
-            case MetaText:
-                fprintf(csv, "%lu, %lu, Text_t, ", ntrack, timestamp);
-                fprintn(csv, midi, event_length);
-                fputc('\n', csv);
-                break;
-
-            case MetaCopyright:
-                fprintf(csv, "%lu, %lu, Copyright_t, ", ntrack, timestamp);
-                fprintn(csv, midi, event_length);
-                fputc('\n', csv);
-                break;
-
-            case MetaTrackName:
-                // TODO: Can save this info for verbosity sake.
-                fprintf(csv, "%lu, %lu, Title_t, ", ntrack, timestamp);
-                fprintn(csv, midi, event_length);
-                fputc('\n', csv);
-                break;
-
-            case MetaInstrumentName:
-                // TODO: Can save this info for verbosity sake.
-                fprintf(csv, "%lu, %lu, Instrument_name_t, ", ntrack, timestamp);
-                fprintn(csv, midi, event_length);
-                fputc('\n', csv);
-                break;
-
-            case MetaLyrics:
-                fprintf(csv, "%lu, %lu, Lyric_t, ", ntrack, timestamp);
-                fprintn(csv, midi, event_length);
-                fputc('\n', csv);
-                break;
-
-            case MetaMarker:
-                fprintf(csv, "%lu, %lu, Marker_t, ", ntrack, timestamp);
-                fprintn(csv, midi, event_length);
-                fputc('\n', csv);
-                break;
-
-            case MetaCuePoint:
-                fprintf(csv, "%lu, %lu, Cue_point_t, ", ntrack, timestamp);
-                fprintn(csv, midi, event_length);
-                fputc('\n', csv);
-                break;
-
-            case MetaChannelPrefix:
-                buffer[0] = fgetc(midi);
-                fprintf(csv, "%lu, %lu, Channel_prefix, %hhu\n", ntrack, timestamp, buffer[0]);
-                break;
-
-            case MetaEndOfTrack:
-                end_of_track = 1;
-                fprintf(csv, "%lu, %lu, End_track\n", ntrack, timestamp);
-                break;
-
-            case MetaSetTempo:
-                // No of microseconds per MIDI quarter-note.
-                // if (!tempo) // Following OLC's code.
-                {
-                    tempo = fgetc(midi) << 16 | fgetc(midi) << 8 | fgetc(midi);
-                    // Quarter-notes or beats per minute
-                    BPM = 60000000 / tempo;
-                }
-                fprintf(csv, "%lu, %lu, Tempo, %u\n", ntrack, timestamp, tempo);
-                break;
-
-            case MetaSMPTEOffset:
-                // `timestamp` should be 0 here.
-                // Specifies the SMPTE time code at which it should start playing.
-                fprintf(
-                    csv,
-                    "%lu, 0, SMPTE_offset, %hhu, %hhu, %hhu, %hhu, %hhu",
-                    ntrack, fgetc(midi), fgetc(midi), fgetc(midi), fgetc(midi), fgetc(midi));
-                break;
-
-            case MetaTimeSignature:
-                buffer[0] = fgetc(midi);
-                buffer[1] = fgetc(midi);
-                buffer[2] = fgetc(midi);
-                buffer[3] = fgetc(midi);
-                fprintf(
-                    csv, "%lu, %lu, Time_signature, %hhu, %hhu, %hhu, %hhu\n",
-                    ntrack, timestamp, buffer[0], buffer[1], buffer[2], buffer[3]
-                );
-                break;
-
-            case MetaKeySignature:
-                // 0 for the key of C, a positive value for each sharp above C,
-                // or a negative value for each flat below C, thus in the inclusive range −7 to 7.
-                buffer[0] = fgetc(midi);
-                // 1 if the key is minor else 0.
-                buffer[1] = fgetc(midi);
-                fprintf(
-                    csv, "%lu, %lu, Key_signature, %hhd, \"%s\"\n",
-                    ntrack, timestamp, buffer[0], (buffer[1]) ? "minor" : "major"
-                );
-                break;
-
-            case MetaSequencerSpecific:
-                // Used to store vendor-proprietary data in a MIDI file.
-                fprintf(csv, "%lu, %lu, Sequencer_specific, %u, ", ntrack, timestamp, event_length);
-                fprintn(csv, midi, event_length);
-                fputc('\n', csv);
-                break;
-
-            default:
-                fprintf(
-                    csv, "%lu, %lu, Unknown_meta_event, %hhu, %u, ",
-                    ntrack, timestamp, type, event_length
-                );
-                fprintn(csv, midi, event_length);
-                fputc('\n', csv);
-            }
-        }
-    }
+    output_flush(&self.output);
+    free(data);
 
-    fprintf(csv, "0, 0, End_of_file\n");
-    fprintf(error_stream, "BPM: %u\n", BPM);
-    return 0;
+    // Quarter-notes or beats per minute
+    if (self.tempo)
+        fprintf(error_stream, "BPM: %u\n", 60000000 / self.tempo);
+
+    return status;
 }
 
 int main(int argc, char **argv)
@@ -462,6 +403,12 @@ int main(int argc, char **argv)
     *midi = stdin,
     *csv = stdout;
 
+    int merged = argc > 1 && !strcmp(argv[1], "-m");
+    if (merged) {
+        --argc;
+        ++argv;
+    }
+
     switch (argc) {
     case 3:
         csv = fopen(argv[2], "wb");
@@ -469,9 +416,14 @@ int main(int argc, char **argv)
         midi = fopen(argv[1], "rb");
     }
 
-    midi_to_csv(midi, csv);
+    if (!midi || !csv) {
+        perror("midicsv");
+        return 1;
+    }
+
+    int status = midi_to_csv(midi, csv, merged);
 
     fclose(midi);
     fclose(csv);
-    return 0;
+    return status != MIDI_Success;
 }
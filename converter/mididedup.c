@@ -0,0 +1,222 @@
+/*
+Find copies of the same music in a corpus, see `midi_fingerprint.h`.
+Every MIDI file found under the given files and directories is fingerprinted once,
+then files are bucketed by fingerprint instead of being compared pair by pair.
+
+Each bucket of two files or more is printed as its fingerprint followed by its files,
+one per line and indented, buckets separated by an empty line.
+
+Options:
+-t          transposed copies count as copies
+-a          print every bucket, single files as well
+-j threads  number of threads, 1 by default
+
+Usage:
+make converter
+./bin/mididedup -j 4 corpus/
+*/
+
+
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ftw.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "midi_parser.h"
+#include "midi_fingerprint.h"
+
+
+struct entry
+{
+    uint64_t hash;
+    char *path;
+    int status;
+};
+
+struct worker
+{
+    pthread_t thread;
+    struct entry *entries;
+    size_t count, first, step;
+    uint8_t flags;
+};
+
+// Files found by `collect`, `nftw` takes no context.
+static struct entry *entries;
+static size_t entry_count, entry_capacity;
+
+
+static int is_midi(const char *path)
+{
+    static const char *extensions[] = { ".mid", ".midi", ".rmi", ".smf", ".kar" };
+    const char *dot = strrchr(path, '.');
+
+    for (size_t i = 0; dot && i < sizeof(extensions) / sizeof(*extensions); ++i)
+        if (!strcasecmp(dot, extensions[i]))
+            return 1;
+
+    return 0;
+}
+
+static int collect(const char *path, const struct stat *status, int type, struct FTW *ftw)
+{
+    // Files named on the command line are taken whatever their name.
+    if (type != FTW_F || (ftw->level && !is_midi(path)))
+        return 0;
+
+    if (entry_count == entry_capacity) {
+        entry_capacity = entry_capacity ? entry_capacity * 2 : 1024;
+        if (!(entries = realloc(entries, entry_capacity * sizeof(struct entry))))
+            return 1;
+    }
+
+    if (!(entries[entry_count].path = strdup(path)))
+        return 1;
+    ++entry_count;
+
+    return 0;
+}
+
+static int file_fingerprint(const char *path, uint8_t flags, uint64_t *hash)
+{
+    size_t size;
+    uint8_t *data;
+    int status;
+    FILE *midi = fopen(path, "rb");
+
+    if (!midi)
+        return MIDI_InvalidHeaderChunk;
+
+    data = midi_load(midi, &size);
+    fclose(midi);
+
+    if (!data)
+        return MIDI_OutOfMemory;
+
+    status = midi_fingerprint_file(data, size, flags, hash);
+    free(data);
+    return status;
+}
+
+static void *work(void *context)
+{
+    struct worker *self = (struct worker *) context;
+
+    for (size_t i = self->first; i < self->count; i += self->step)
+        self->entries[i].status = file_fingerprint(self->entries[i].path, self->flags, &self->entries[i].hash);
+
+    return NULL;
+}
+
+static int compare(const void *a, const void *b)
+{
+    const struct entry *x = (const struct entry *) a, *y = (const struct entry *) b;
+
+    if (x->hash != y->hash)
+        return x->hash < y->hash ? -1 : 1;
+    return strcmp(x->path, y->path);
+}
+
+int main(int argc, char **argv)
+{
+    size_t thread_count = 1;
+    uint8_t flags = 0, all = 0;
+    int option;
+
+    while ((option = getopt(argc, argv, "taj:")) != -1) {
+        switch (option) {
+        case 't':
+            flags |= FingerprintTranspose;
+            break;
+        case 'a':
+            all = 1;
+            break;
+        case 'j':
+            thread_count = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            fprintf(stderr, "usage: mididedup [-ta] [-j threads] corpus...\n");
+            return 1;
+        }
+    }
+
+    if (!thread_count)
+        thread_count = 1;
+
+    for (int i = optind; i < argc; ++i) {
+        if (nftw(argv[i], collect, 64, FTW_PHYS)) {
+            perror("mididedup");
+            return 1;
+        }
+    }
+
+    struct worker *workers = calloc(thread_count, sizeof(struct worker));
+
+    if (!workers) {
+        perror("mididedup");
+        return 1;
+    }
+
+    for (size_t i = 0; i < thread_count; ++i) {
+        struct worker *worker = workers + i;
+
+        worker->entries = entries;
+        worker->count = entry_count;
+        worker->first = i;
+        worker->step = thread_count;
+        worker->flags = flags;
+
+        if (pthread_create(&worker->thread, NULL, work, worker)) {
+            perror("mididedup");
+            return 1;
+        }
+    }
+
+    for (size_t i = 0; i < thread_count; ++i)
+        pthread_join(workers[i].thread, NULL);
+
+    // Failed files go aside, the others are sorted so that each bucket is a run.
+    size_t count = 0, buckets = 0, copies = 0;
+
+    for (size_t i = 0; i < entry_count; ++i) {
+        if (entries[i].status != MIDI_Success) {
+            fprintf(stderr, "mididedup: %s: error %d\n", entries[i].path, entries[i].status);
+            free(entries[i].path);
+        } else {
+            entries[count++] = entries[i];
+        }
+    }
+
+    qsort(entries, count, sizeof(struct entry), compare);
+
+    for (size_t first = 0, end; first < count; first = end) {
+        for (end = first + 1; end < count && entries[end].hash == entries[first].hash; ++end);
+
+        if (end - first > 1) {
+            ++buckets;
+            copies += end - first - 1;
+        }
+
+        if (end - first > 1 || all) {
+            printf("%016" PRIx64 "\n", entries[first].hash);
+            for (size_t i = first; i < end; ++i)
+                printf("\t%s\n", entries[i].path);
+            putchar('\n');
+        }
+    }
+
+    fprintf(stderr, "%zu files, %zu copies in %zu buckets\n", count, copies, buckets);
+
+    for (size_t i = 0; i < count; ++i)
+        free(entries[i].path);
+    free(entries);
+    free(workers);
+    return 0;
+}
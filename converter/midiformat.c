@@ -0,0 +1,165 @@
+/*
+Convert a MIDI file between format 0 and format 1 in one pass.
+
+A format 1 file is merged into the single track of a format 0 file, in playing order.
+A format 0 file is split into a format 1 file with a first track holding the meta
+and system exclusive events, followed by one track per channel in use.
+Track buffers are bounded: past the limit their events move to a temporary file,
+and chunk lengths are written once every event is in.
+
+Options:
+-0          convert to format 0, the default for format 1 files
+-1          convert to format 1, the default for format 0 files
+-m bytes    memory per track before it spills to a temporary file, 1 MiB by default, 0 for no limit
+
+Usage:
+make converter
+./bin/midiformat -0 music.mid merged.mid
+*/
+
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "midi_parser.h"
+#include "midi_writer.h"
+
+
+#define SPLIT_TRACKS (1 + 16)
+
+
+/**
+Write the messages of `merge` to `writer`, to the track `track_of` picks.
+End of track events are left out, every track ends when the latest of them did.
+*/
+static int convert(struct midi_merge *merge, struct midi_writer *writer, uint16_t (*track_of)(const struct midi_message *message))
+{
+    struct midi_message message;
+    uint32_t end = 0;
+
+    while (midi_merge_next(merge, &message)) {
+        if (message.status == 0xFF && message.meta_type == MetaEndOfTrack) {
+            end = MIDI_MAX(end, message.timestamp);
+            continue;
+        }
+
+        message.track = track_of(&message);
+        if (!midi_writer_message(writer, &message))
+            return midi_status;
+    }
+
+    if (midi_status != MIDI_Success)
+        return midi_status;
+
+    for (uint16_t track = 0; track < writer->header.track_count; ++track) {
+        const struct midi_writer_track *writer_track = writer->tracks + track;
+
+        if ((writer_track->size || !track) && !midi_writer_meta(writer, track, MIDI_MAX(end, writer_track->tick), MetaEndOfTrack, NULL, 0))
+            return midi_status;
+    }
+
+    return MIDI_Success;
+}
+
+static uint16_t merged_track(const struct midi_message *message)
+{
+    return 0;
+}
+
+/// The first track for meta and system exclusive events, then a track per channel.
+static uint16_t channel_track(const struct midi_message *message)
+{
+    return message->status < 0xF0 ? 1 + (message->status & 0x0F) : 0;
+}
+
+/// Drop the channel tracks left empty by the split.
+static void drop_empty_tracks(struct midi_writer *writer)
+{
+    uint16_t count = 1;
+
+    for (uint16_t track = 1; track < writer->header.track_count; ++track)
+        if (writer->tracks[track].size)
+            writer->tracks[count++] = writer->tracks[track];
+
+    writer->header.track_count = count;
+}
+
+int main(int argc, char **argv)
+{
+    int format = -1, option;
+    size_t spill_size = 1 << 20;
+
+    while ((option = getopt(argc, argv, "01m:")) != -1) {
+        switch (option) {
+        case '0':
+        case '1':
+            format = option - '0';
+            break;
+        case 'm':
+            spill_size = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            fprintf(stderr, "usage: midiformat [-0|-1] [-m bytes] [music.mid [converted.mid]]\n");
+            return 1;
+        }
+    }
+
+    argc -= optind - 1;
+    argv += optind - 1;
+
+    FILE
+    *midi = stdin,
+    *output = stdout;
+
+    switch (argc) {
+    case 3:
+        output = fopen(argv[2], "wb");
+    case 2:
+        midi = fopen(argv[1], "rb");
+    }
+
+    if (!midi || !output) {
+        perror("midiformat");
+        return 1;
+    }
+
+    struct midi_merge merge;
+    struct midi_writer writer = { { 0 } };
+    size_t size;
+    uint8_t *data;
+    int status = MIDI_OutOfMemory;
+
+    if ((data = midi_load(midi, &size)) && midi_merge_new(&merge, data, size)) {
+        if (format < 0)
+            format = merge.header.format == 0;
+
+        if (merge.header.format == 2) {
+            status = MIDI_Unimplemented;
+        } else if (midi_writer_new(&writer, format, format ? SPLIT_TRACKS : 1, merge.header.time_division)) {
+            writer.spill_size = spill_size;
+            status = convert(&merge, &writer, format ? channel_track : merged_track);
+
+            if (format)
+                drop_empty_tracks(&writer);
+            if (status == MIDI_Success && !midi_writer_finalize(&writer, output))
+                status = midi_status;
+        } else {
+            status = midi_status;
+        }
+
+        midi_merge_free(&merge);
+    } else if (data) {
+        status = midi_status;
+    }
+
+    if (status != MIDI_Success)
+        fprintf(stderr, "midiformat: could not convert the MIDI file, error %d\n", status);
+
+    midi_writer_free(&writer);
+    free(data);
+    fclose(midi);
+    fclose(output);
+    return status != MIDI_Success;
+}
@@ -0,0 +1,52 @@
+/*
+Write the `.midx` columnar sidecar of a MIDI file, see `midi_index.h`.
+The file is merged and resolved to absolute time once here, later analyses map
+the sidecar and scan its columns instead of decoding the MIDI file again.
+
+Usage:
+make converter
+./bin/midiindex music.mid music.midx
+*/
+
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdlib.h>
+
+#include "midi_parser.h"
+#include "midi_index.h"
+
+
+int main(int argc, char **argv)
+{
+    FILE
+    *midi = stdin,
+    *index = stdout;
+
+    switch (argc) {
+    case 3:
+        index = fopen(argv[2], "wb");
+    case 2:
+        midi = fopen(argv[1], "rb");
+    }
+
+    if (!midi || !index) {
+        perror("midiindex");
+        return 1;
+    }
+
+    size_t size;
+    uint8_t *data = midi_load(midi, &size);
+    uint64_t count = data ? midi_index_write(data, size, index) : 0;
+
+    if (midi_status != MIDI_Success || !data)
+        fprintf(stderr, "midiindex: could not index the MIDI file, error %d\n", midi_status);
+    else
+        fprintf(stderr, "%" PRIu64 " events\n", count);
+
+    free(data);
+    fclose(midi);
+    fclose(index);
+    return midi_status != MIDI_Success || !data;
+}
@@ -8,8 +8,12 @@ http://www.gweep.net/~prefect/eng/reference/protocol/midispec.html
 https://www.eecs.umich.edu/courses/eecs373/Lec/StudentF18/MIDI%20Presentation.pdf
 
 Usage:
-gcc main.c -o main -Wall
-./main music.mid music.json
+make converter
+./bin/midijson music.mid music.json
+
+With `-n`, write newline delimited JSON instead: one event per line in playing order
+across all tracks, each with its track, absolute tick and absolute micro seconds.
+./bin/midijson -n music.mid music.ndjson
 */
 
 
@@ -17,297 +21,212 @@ gcc main.c -o main -Wall
 #include <stdint.h>
 #include <string.h>
 
+#include "midi_parser.h"
+#include "output.h"
 
-enum EventType
-{
-    EventNoteOff = 0x80,
-    EventNoteOn = 0x90,
-    EventKeyPressure = 0xA0,
-    EventControllerChange = 0xB0,
-    EventProgramChange = 0xC0,
-    EventChannelPressure = 0xD0,
-    EventPitchBend = 0xE0,
-    EventSystemExclusive = 0xF0
-};
 
-enum MetaEventType
+struct json
 {
-    MetaSequence = 0x00,
-    MetaText = 0x01,
-    MetaCopyright = 0x02,
-    MetaTrackName = 0x03,
-    MetaInstrumentName = 0x04,
-    MetaLyrics = 0x05,
-    MetaMarker = 0x06,
-    MetaCuePoint = 0x07,
-    MetaChannelPrefix = 0x20,
-    MetaEndOfTrack = 0x2F,
-    MetaSetTempo = 0x51,
-    MetaSMPTEOffset = 0x54,
-    MetaTimeSignature = 0x58,
-    MetaKeySignature = 0x59,
-    MetaSequencerSpecific = 0x7F
-};
+    struct output output;
 
-enum Error
-{
-    InvalidHeaderChunk,
-    InvalidTrackChunk,
-    PotentialBufferOverflow
+    uint8_t first_event;
+    // A track object was opened, it is closed by the next one or at the end.
+    uint8_t track_open;
+    uint32_t tempo;
 };
 
-/*
-struct MidiNote
+
+void fprintn(struct output *dest, const uint8_t *data, size_t n)
 {
-    uint8_t key;
-    uint8_t velocity;
-    uint32_t time;
-    uint32_t duration;
-};
+    output_char(dest, '"');
+    output_json_escaped(dest, data, n);
+    output_char(dest, '"');
+}
 
-struct MidiEvent
+/// `[data[0],data[1],...]`
+static void json_bytes(struct output *json, const uint8_t *data, size_t n)
 {
-    enum EventType event;
-    uint8_t key;
-    uint8_t velocity;
-    uint8_t delta_tick;
-};
-*/
+    output_char(json, '[');
+    for (size_t i = 0; i < n; ++i) {
+        if (i)
+            output_char(json, ',');
+        output_u64(json, data[i]);
+    }
+    output_char(json, ']');
+}
 
 
-uint32_t swap32(uint32_t n)
+static int json_header(void *context, const struct midi_header *header)
 {
-    return (n << 24 & 0xFF000000) | (n << 8 & 0x00FF0000) | (n >> 8 & 0x0000FF00) | (n >> 24 & 0x000000FF);
+    struct output *json = &((struct json *) context)->output;
+
+    if (header->format == 0 && header->track_count != 1)
+        return MIDI_InvalidHeaderChunk;
+
+    output_literal(json, "{\"format\":");
+    output_u64(json, header->format);
+    output_literal(json, ",\"time_division\":");
+    output_u64(json, header->time_division);
+    output_literal(json, ",\"track_count\":");
+    output_u64(json, header->track_count);
+    output_literal(json, ",\"tracks\":[");
+
+    return 0;
 }
 
-uint16_t swap16(uint16_t n)
+static int json_track(void *context, uint16_t track)
 {
-    return (n << 8 & 0xFF00) | (n >> 8 & 0x00FF);
+    struct json *self = (struct json *) context;
+
+    // Close the previous track.
+    if (track)
+        output_literal(&self->output, "]},");
+    output_literal(&self->output, "{\"events\":[");
+
+    self->first_event = 1;
+    self->track_open = 1;
+    return 0;
 }
 
-uint32_t read_value(FILE *src)
+/// Write the fields of `message` from its type on and close the object.
+static void json_event(struct json *self, const struct midi_message *message)
 {
-    uint8_t buffer = 0x80;
-    uint32_t value = 0;
-    while (buffer & 0x80) {
-        buffer = fgetc(src);
-        value = value << 7 | (buffer & 0x7F);
+    struct output *json = &self->output;
+    uint8_t status = message->status;
+
+    output_literal(json, ",\"type\":");
+    output_u64(json, (status & 0xF0) == 0xF0 ? status : status & 0xF0);
+
+    if (status != 0xFF) {
+        output_literal(json, ",\"channel\":");
+        output_u64(json, status & 0x0F);
+        output_literal(json, ",\"length\":");
+        output_u64(json, message->size);
+        output_literal(json, ",\"data\":");
+
+        if ((status & 0xF0) == EventSystemExclusive)
+            fprintn(json, message->data, message->size);
+        else
+            json_bytes(json, message->data, message->size);
+
+        output_char(json, '}');
+        return;
     }
 
-    return value;
-}
+    output_literal(json, ",\"metatype\":");
+    output_u64(json, message->meta_type);
+    output_literal(json, ",\"length\":");
+    output_u64(json, message->size);
+    output_literal(json, ",\"data\":");
+
+    switch (message->meta_type) {
+    case MetaText:
+    case MetaCopyright:
+    case MetaTrackName:
+    case MetaInstrumentName:
+    case MetaLyrics:
+    case MetaMarker:
+    case MetaCuePoint:
+    case MetaSequencerSpecific:
+        fprintn(json, message->data, message->size);
+        break;
+
+    case MetaSetTempo:
+        if (message->size >= 3)
+            self->tempo = message->data[0] << 16 | message->data[1] << 8 | message->data[2];
+        // fallthrough
+    default:
+        json_bytes(json, message->data, message->size);
+    }
 
+    output_char(json, '}');
+}
 
-void fprintn(FILE *dest, FILE *src, size_t n)
+static int json_message(void *context, const struct midi_message *message)
 {
-    uint8_t c;
-    fputc('"', dest);
-
-    while (n--) {
-        c = fgetc(src);
-        // `c` is printable or it doesn't belong to ASCII.
-        switch ((c >= ' ') << 1 | (c == '"')) {
-        case 3:
-            // Quote characters embedded within strings are represented by `two` consecutive quotes.
-            fputc(c, dest);
-        case 2:
-            fputc(c, dest);
-            break;
-        default:
-            // 3 digits octal representation of non-printable characters prefixed with `\`.
-            fprintf(dest, "\\%03o", c);
-        }
-    }
+    struct json *self = (struct json *) context;
+    struct output *json = &self->output;
 
-    fputc('"', dest);
-}
+    if (!self->first_event)
+        output_char(json, ',');
+    self->first_event = 0;
 
+    output_literal(json, "{\"timestamp\":");
+    output_u64(json, message->timestamp);
+    output_literal(json, ",\"delta_time\":");
+    output_u64(json, message->dtime);
+    json_event(self, message);
 
-struct HeaderChunk
-{
-    char chunk_id[4];
-    uint32_t length;
-    uint16_t format;
-    uint16_t track_chunks;
-    uint16_t time_division;
-};
+    return 0;
+}
 
-struct HeaderChunk create_header_chunk(FILE *src)
+/// One line per event in the order they are played.
+static int ndjson(struct json *self, const uint8_t *data, size_t size)
 {
-    struct HeaderChunk hc;
-    fread(&hc.chunk_id, 1, 4, src);
-    fread(&hc.length, 4, 1, src);
-    fread(&hc.format, 2, 1, src);
-    fread(&hc.track_chunks, 2, 1, src);
-    fread(&hc.time_division, 2, 1, src);
-
-    hc.length = swap32(hc.length);
-    hc.format = swap16(hc.format);
-    hc.track_chunks = swap16(hc.track_chunks);
-    hc.time_division = swap16(hc.time_division);
-
-    return hc;
+    struct output *json = &self->output;
+    struct midi_merge merge;
+    struct midi_message message;
+
+    if (!midi_merge_new(&merge, data, size))
+        return midi_status;
+
+    while (midi_merge_next(&merge, &message)) {
+        output_literal(json, "{\"track\":");
+        output_u64(json, message.track);
+        output_literal(json, ",\"tick\":");
+        output_u64(json, message.timestamp);
+        output_literal(json, ",\"us\":");
+        output_u64(json, merge.us);
+        json_event(self, &message);
+        output_char(json, '\n');
+    }
+
+    midi_merge_free(&merge);
+    return midi_status;
 }
 
-uint8_t midi_to_json(FILE *midi, FILE *json)
+int midi_to_json(FILE *midi, FILE *file, int lines)
 {
-    uint32_t timestamp = 0;
-
-    uint32_t
-    delta_time,
-    chunk_length,
-    event_length,
-    tempo = 0,
-    BPM = 0;
-
-    uint8_t
-    previous_status,
-    status,
-    channel,
-    end_of_track,
-    type,
-    first_track = 1,
-    first_event,
-    first_data;
-
-    char
-    buffer[64],
-    chunk_id[4];
-
+    static struct json self;
     FILE *error_stream = stderr;
+    size_t size;
+    uint8_t *data;
+    int status;
+
+    struct midi_visitor visitor = {
+        .context = &self,
+        .header = json_header,
+        .track = json_track,
+        .message = json_message
+    };
+
+    if (!(data = midi_load(midi, &size))) {
+        fprintf(error_stream, "Could not read the MIDI file\n");
+        return MIDI_InvalidHeaderChunk;
+    }
 
-    struct HeaderChunk header = create_header_chunk(midi);
+    output_new(&self.output, file);
+    self.tempo = 0;
+    self.track_open = 0;
 
-    if (strncmp(header.chunk_id, "MThd", 4) || (header.format == 0 && header.track_chunks != 1)) {
-        return InvalidHeaderChunk;
-    }
+    if (lines)
+        status = ndjson(&self, data, size);
+    else if ((status = midi_visit(data, size, &visitor)) == MIDI_Success && self.track_open)
+        output_literal(&self.output, "]}]}");
+    else if (status == MIDI_Success)
+        output_literal(&self.output, "]}");
 
-    fprintf(
-        json, "{\"format\":%hu,\"time_division\":%hu,\"track_count\":%hu,\"tracks\":[",
-        header.format, header.time_division, header.track_chunks
-    );
-
-    for (uint32_t ntrack = 1; ntrack <= header.track_chunks; ++ntrack) {
-        end_of_track = 0;
-        timestamp = 0;
-
-        // Track chunk length in bytes. Skip this number of bytes to get to next track.
-        fread(chunk_id, 1, 4, midi);
-        fread(&chunk_length, 4, 1, midi);
-        chunk_length = swap32(chunk_length);
-
-        if (strncmp(chunk_id, "MTrk", 4)) {
-            return InvalidTrackChunk;
-        }
-
-        if (!first_track)
-            fputc(',', json);
-        fprintf(json, "{\"events\":[");
-        
-        first_track = 0;
-        first_event = 1;
-
-        while (!feof(midi) && !end_of_track) {
-            delta_time = read_value(midi);
-            timestamp += delta_time;
-            status = fgetc(midi);
-
-            if (status < 0x80) {
-                status = previous_status;
-                fseek(midi, -1, SEEK_CUR);
-            }
-
-            previous_status = status;
-            channel = status & 0x0F;
-
-            if (!first_event)
-                fputc(',', json);
-            fprintf(
-                json, "{\"timestamp\":%u,\"delta_time\":%u,\"type\":%hhu,",
-                timestamp, delta_time, (status & 0xF0 ^ 0xF0) ? status & 0xF0 : status
-            );
-
-            event_length = 1;
-            first_event = 0;
-            first_data = 1;
-
-            switch (status & 0xF0) {
-            case EventNoteOn:
-            case EventNoteOff:
-            case EventKeyPressure:
-            case EventControllerChange:
-            case EventPitchBend:
-                event_length = 2;
-            case EventProgramChange:
-            case EventChannelPressure:
-                fprintf(json, "\"channel\":%hhu,\"length\":%u,\"data\":", channel, event_length);
-                fputc('[', json);
-                while (event_length--) {
-                    if (!first_data)
-                        fputc(',', json);
-                    fprintf(json, "%hhu", fgetc(midi));
-                    first_data = 0;
-                }
-                fputc(']', json);
-                break;
-
-            case EventSystemExclusive:
-                previous_status = 0;
-                switch (status) {
-                case 0xF0: // System Exclusive Message Begin
-                case 0xF7: // System Exclusive Message End
-                    event_length = read_value(midi);
-                    fprintf(json, "\"channel\":%hhu,\"length\":%u,\"data\":", channel, event_length);
-                    fprintn(json, midi, event_length);
-                    break;
-
-                case 0xFF:
-                    type = fgetc(midi);
-                    event_length = read_value(midi);
-                    fprintf(json, "\"metatype\":%hhu,\"length\":%u,\"data\":", type, event_length);
-
-                    switch (type) {
-                    case MetaText:
-                    case MetaCopyright:
-                    case MetaTrackName:
-                    case MetaInstrumentName:
-                    case MetaLyrics:
-                    case MetaMarker:
-                    case MetaCuePoint:
-                    case MetaSequencerSpecific:
-                        fprintn(json, midi, event_length);
-                        break;
-
-                    case MetaEndOfTrack:
-                        end_of_track = 1;
-                    case MetaSequence:
-                    case MetaChannelPrefix:
-                    case MetaSetTempo:
-                    case MetaSMPTEOffset:
-                    case MetaTimeSignature:
-                    case MetaKeySignature:
-                    default:
-                        fputc('[', json);
-                        while (event_length--) {
-                            fprintf(json, "%s%hhu", (first_data) ? "" : ",", fgetc(midi));
-                            first_data = 0;
-                        }
-                        fputc(']', json);
-                    }
-                }
-                break;
-
-            default:
-                fprintf(error_stream, "Unrecognised Status Byte: `%hhu`\n", status);
-            }
-            fputc('}', json);
-        }
-        fputs("]}", json);
-    }
-    fputs("]}", json);
+    if (status != MIDI_Success)
+        fprintf(error_stream, "Invalid MIDI file, error %d\n", status);
 
-    fprintf(error_stream, "BPM: %u\n", BPM);
-    return 0;
+    output_flush(&self.output);
+    free(data);
+
+    // Quarter-notes or beats per minute
+    if (self.tempo)
+        fprintf(error_stream, "BPM: %u\n", 60000000 / self.tempo);
+
+    return status;
 }
 
 int main(int argc, char **argv)
@@ -316,6 +235,12 @@ int main(int argc, char **argv)
     *midi = stdin,
     *json = stdout;
 
+    int lines = argc > 1 && !strcmp(argv[1], "-n");
+    if (lines) {
+        --argc;
+        ++argv;
+    }
+
     switch (argc) {
     case 3:
         json = fopen(argv[2], "wb");
@@ -323,9 +248,14 @@ int main(int argc, char **argv)
         midi = fopen(argv[1], "rb");
     }
 
-    midi_to_json(midi, json);
+    if (!midi || !json) {
+        perror("midijson");
+        return 1;
+    }
+
+    int status = midi_to_json(midi, json, lines);
 
     fclose(midi);
     fclose(json);
-    return 0;
-}
\ No newline at end of file
+    return status != MIDI_Success;
+}
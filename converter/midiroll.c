@@ -0,0 +1,145 @@
+/*
+Render a MIDI file as a piano roll, see `midi_roll.h`.
+
+Rows of 16 channels by 128 pitches are written back to back as raw bytes,
+one byte of velocity per cell, or one bit per cell with `-b`.
+With `-k`, rows are printed as text instead, one 88 key keyboard per row
+as `show_keyboard` in tests/test.c does, all channels together.
+
+Options:
+-b          bit packed rows
+-k          keyboard text
+-t          step in ticks rather than micro seconds
+-s step     time step of a row, 10000 by default
+-r rows     rows rendered per block, 1024 by default
+
+Usage:
+make converter
+./bin/midiroll -s 5000 music.mid music.roll
+*/
+
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "midi_parser.h"
+#include "midi_roll.h"
+
+
+struct sink
+{
+    FILE *file;
+    size_t row_size;
+    enum MIDI_RollFormat format;
+    uint8_t keyboard;
+    uint64_t rows;
+};
+
+
+/// Whether `pitch` sounds on any channel of `row`.
+static int sounding(const struct sink *self, const uint8_t *row, size_t pitch)
+{
+    for (size_t channel = 0; channel < MIDI_ROLL_CHANNELS; ++channel) {
+        size_t cell = channel * MIDI_ROLL_PITCHES + pitch;
+        if (self->format == RollBits ? row[cell >> 3] >> (cell & 7) & 1 : row[cell])
+            return 1;
+    }
+
+    return 0;
+}
+
+static int emit(void *context, uint64_t first_row, const uint8_t *rows, uint32_t count)
+{
+    struct sink *self = (struct sink *) context;
+    char line[88 + 1];
+
+    self->rows += count;
+
+    if (!self->keyboard)
+        return fwrite(rows, self->row_size, count, self->file) != count;
+
+    for (uint32_t i = 0; i < count; ++i, rows += self->row_size) {
+        for (size_t pitch = 21; pitch <= 108; ++pitch)
+            line[pitch - 21] = sounding(self, rows, pitch) ? 'H' : '.';
+        line[88] = '\n';
+        fwrite(line, 1, sizeof(line), self->file);
+    }
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    enum MIDI_RollFormat format = RollBytes;
+    enum MIDI_RollTime time = RollMicroseconds;
+    uint32_t step = 10000, block_rows = 1024;
+    uint8_t keyboard = 0;
+    int option;
+
+    while ((option = getopt(argc, argv, "bkts:r:")) != -1) {
+        switch (option) {
+        case 'b':
+            format = RollBits;
+            break;
+        case 'k':
+            keyboard = 1;
+            break;
+        case 't':
+            time = RollTicks;
+            break;
+        case 's':
+            step = strtoul(optarg, NULL, 10);
+            break;
+        case 'r':
+            block_rows = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            fprintf(stderr, "usage: midiroll [-bkt] [-s step] [-r rows] [music.mid [music.roll]]\n");
+            return 1;
+        }
+    }
+
+    argc -= optind - 1;
+    argv += optind - 1;
+
+    FILE
+    *midi = stdin,
+    *roll = stdout;
+
+    switch (argc) {
+    case 3:
+        roll = fopen(argv[2], "wb");
+    case 2:
+        midi = fopen(argv[1], "rb");
+    }
+
+    if (!midi || !roll) {
+        perror("midiroll");
+        return 1;
+    }
+
+    struct sink sink = { roll, 0, format, keyboard, 0 };
+    struct midi_roll renderer;
+    size_t size;
+    uint8_t *data;
+    int status = MIDI_OutOfMemory;
+
+    if ((data = midi_load(midi, &size)) && midi_roll_new(&renderer, format, time, step, block_rows, &sink, emit)) {
+        sink.row_size = renderer.row_size;
+        status = midi_roll_render(&renderer, data, size);
+        midi_roll_free(&renderer);
+    }
+
+    if (status != MIDI_Success)
+        fprintf(stderr, "midiroll: could not render the MIDI file, error %d\n", status);
+    else
+        fprintf(stderr, "%" PRIu64 " rows of %zu bytes\n", sink.rows, sink.row_size);
+
+    free(data);
+    fclose(midi);
+    fclose(roll);
+    return status != MIDI_Success;
+}
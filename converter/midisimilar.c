@@ -0,0 +1,318 @@
+/*
+Find melodically similar files in a corpus, see `midi_ngram.h`.
+With `-q`, the files of the index sharing the most n-grams with the query are printed,
+one per line as the number of shared n-grams and the path, most similar first.
+Without it, every MIDI file found under the given files and directories is indexed:
+each thread collects and sorts the postings of its files, and the runs are merged into the index.
+
+Options:
+-i index    index file, written when indexing and read by queries
+-q query    MIDI file to look for
+-n count    number of files printed by a query, 10 by default
+-j threads  number of indexing threads, 1 by default
+
+Usage:
+make converter
+./bin/midisimilar -j 4 -i corpus.mng corpus/
+./bin/midisimilar -i corpus.mng -q tune.mid
+*/
+
+
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <ftw.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "midi_parser.h"
+#include "midi_ngram.h"
+
+
+struct entry
+{
+    char *path;
+    uint32_t gram_count;
+    int status;
+};
+
+struct worker
+{
+    pthread_t thread;
+    struct entry *entries;
+    size_t count, first, step;
+    struct midi_ngram_run run;
+    int status;
+};
+
+// Files found by `collect`, `nftw` takes no context.
+static struct entry *entries;
+static size_t entry_count, entry_capacity;
+
+
+static int is_midi(const char *path)
+{
+    static const char *extensions[] = { ".mid", ".midi", ".rmi", ".smf", ".kar" };
+    const char *dot = strrchr(path, '.');
+
+    for (size_t i = 0; dot && i < sizeof(extensions) / sizeof(*extensions); ++i)
+        if (!strcasecmp(dot, extensions[i]))
+            return 1;
+
+    return 0;
+}
+
+static int collect(const char *path, const struct stat *status, int type, struct FTW *ftw)
+{
+    // Files named on the command line are taken whatever their name.
+    if (type != FTW_F || (ftw->level && !is_midi(path)))
+        return 0;
+
+    if (entry_count == entry_capacity) {
+        entry_capacity = entry_capacity ? entry_capacity * 2 : 1024;
+        if (!(entries = realloc(entries, entry_capacity * sizeof(struct entry))))
+            return 1;
+    }
+
+    if (!(entries[entry_count].path = strdup(path)))
+        return 1;
+    ++entry_count;
+
+    return 0;
+}
+
+/// Collect the n-grams of the MIDI file at `path` into `ngram`.
+static int file_ngrams(const char *path, struct midi_ngram *ngram)
+{
+    size_t size;
+    uint8_t *data;
+    int status;
+    FILE *midi = fopen(path, "rb");
+
+    midi_ngram_new(ngram);
+
+    if (!midi)
+        return MIDI_InvalidHeaderChunk;
+
+    data = midi_load(midi, &size);
+    fclose(midi);
+
+    if (!data)
+        return MIDI_OutOfMemory;
+
+    status = midi_ngram_file(ngram, data, size);
+    free(data);
+    return status;
+}
+
+static void *work(void *context)
+{
+    struct worker *self = (struct worker *) context;
+    struct midi_ngram ngram;
+
+    for (size_t i = self->first; i < self->count && self->status == MIDI_Success; i += self->step) {
+        struct entry *entry = self->entries + i;
+
+        // Files are numbered by their place in `entries` until the failed ones are dropped.
+        if ((entry->status = file_ngrams(entry->path, &ngram)) == MIDI_Success) {
+            entry->gram_count = (uint32_t) ngram.count;
+            if (!midi_ngram_run_add(&self->run, &ngram, (uint32_t) i))
+                self->status = midi_status;
+        }
+
+        midi_ngram_free(&ngram);
+    }
+
+    midi_ngram_run_sort(&self->run);
+    return NULL;
+}
+
+static int build(const char *path, char **roots, int root_count, size_t thread_count)
+{
+    for (int i = 0; i < root_count; ++i) {
+        if (nftw(roots[i], collect, 64, FTW_PHYS)) {
+            perror("midisimilar");
+            return 1;
+        }
+    }
+
+    struct worker *workers = calloc(thread_count, sizeof(struct worker));
+    uint32_t *numbers = malloc((entry_count + 1) * sizeof(uint32_t));
+    FILE *index = fopen(path, "wb");
+
+    if (!workers || !numbers || !index) {
+        perror("midisimilar");
+        return 1;
+    }
+
+    for (size_t i = 0; i < thread_count; ++i) {
+        struct worker *worker = workers + i;
+
+        worker->entries = entries;
+        worker->count = entry_count;
+        worker->first = i;
+        worker->step = thread_count;
+
+        if (pthread_create(&worker->thread, NULL, work, worker)) {
+            perror("midisimilar");
+            return 1;
+        }
+    }
+
+    int status = MIDI_Success;
+
+    for (size_t i = 0; i < thread_count; ++i) {
+        pthread_join(workers[i].thread, NULL);
+        if (workers[i].status != MIDI_Success)
+            status = workers[i].status;
+    }
+
+    // Failed files go aside and the others are numbered again, in the same order,
+    // so the runs stay sorted.
+    const char **paths = malloc((entry_count + 1) * sizeof(char *));
+    uint32_t *gram_counts = malloc((entry_count + 1) * sizeof(uint32_t));
+    size_t count = 0;
+
+    if (!paths || !gram_counts) {
+        perror("midisimilar");
+        return 1;
+    }
+
+    for (size_t i = 0; i < entry_count; ++i) {
+        if (entries[i].status != MIDI_Success) {
+            fprintf(stderr, "midisimilar: %s: error %d\n", entries[i].path, entries[i].status);
+            continue;
+        }
+
+        numbers[i] = (uint32_t) count;
+        paths[count] = entries[i].path;
+        gram_counts[count] = entries[i].gram_count;
+        ++count;
+    }
+
+    struct midi_ngram_run *runs = malloc((thread_count + 1) * sizeof(struct midi_ngram_run));
+    uint64_t gram_count = 0;
+
+    if (!runs) {
+        perror("midisimilar");
+        return 1;
+    }
+
+    for (size_t i = 0; i < thread_count; ++i) {
+        runs[i] = workers[i].run;
+        for (size_t j = 0; j < runs[i].count; ++j)
+            runs[i].postings[j].file = numbers[runs[i].postings[j].file];
+    }
+
+    if (status == MIDI_Success) {
+        gram_count = midi_ngram_index_write(index, paths, gram_counts, (uint32_t) count, runs, thread_count);
+        status = midi_status;
+    }
+
+    if (status != MIDI_Success)
+        fprintf(stderr, "midisimilar: could not write the index, error %d\n", status);
+    else
+        fprintf(stderr, "%zu files, %" PRIu64 " n-grams\n", count, gram_count);
+
+    for (size_t i = 0; i < thread_count; ++i)
+        midi_ngram_run_free(runs + i);
+    for (size_t i = 0; i < entry_count; ++i)
+        free(entries[i].path);
+    free(entries);
+    free(runs);
+    free(paths);
+    free(gram_counts);
+    free(numbers);
+    free(workers);
+    fclose(index);
+    return status != MIDI_Success;
+}
+
+static int query(const char *path, const char *query_path, size_t limit)
+{
+    struct midi_ngram_index index;
+    struct midi_ngram ngram;
+    struct midi_ngram_match *matches = malloc((limit + 1) * sizeof(struct midi_ngram_match));
+    struct timespec start, end;
+    size_t count = 0;
+    int status;
+
+    if (!matches) {
+        perror("midisimilar");
+        return 1;
+    }
+
+    if (!midi_ngram_open(&index, path)) {
+        fprintf(stderr, "midisimilar: %s: not an index, error %d\n", path, midi_status);
+        free(matches);
+        return 1;
+    }
+
+    if ((status = file_ngrams(query_path, &ngram)) == MIDI_Success) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        count = midi_ngram_query(&index, &ngram, matches, limit);
+        status = midi_status;
+        clock_gettime(CLOCK_MONOTONIC, &end);
+    }
+
+    if (status != MIDI_Success) {
+        fprintf(stderr, "midisimilar: could not query the index, error %d\n", status);
+    } else {
+        for (size_t i = 0; i < count; ++i)
+            printf("%u\t%s\n", matches[i].shared, midi_ngram_path(&index, matches[i].file));
+
+        fprintf(stderr, "%zu n-grams looked up in %.3f ms\n", ngram.count,
+            (end.tv_sec - start.tv_sec) * 1E3 + (end.tv_nsec - start.tv_nsec) / 1E6);
+    }
+
+    midi_ngram_free(&ngram);
+    midi_ngram_close(&index);
+    free(matches);
+    return status != MIDI_Success;
+}
+
+int main(int argc, char **argv)
+{
+    const char *index = NULL, *query_path = NULL;
+    size_t thread_count = 1, limit = 10;
+    int option;
+
+    while ((option = getopt(argc, argv, "i:q:n:j:")) != -1) {
+        switch (option) {
+        case 'i':
+            index = optarg;
+            break;
+        case 'q':
+            query_path = optarg;
+            break;
+        case 'n':
+            limit = strtoul(optarg, NULL, 10);
+            break;
+        case 'j':
+            thread_count = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            index = NULL;
+            optind = argc;
+        }
+    }
+
+    if (!index || (!query_path && optind == argc)) {
+        fprintf(stderr, "usage: midisimilar [-j threads] -i index corpus...\n       midisimilar [-n count] -i index -q query.mid\n");
+        return 1;
+    }
+
+    if (!thread_count)
+        thread_count = 1;
+
+    if (query_path)
+        return query(index, query_path, limit);
+
+    return build(index, argv + optind, argc - optind, thread_count);
+}
@@ -0,0 +1,163 @@
+/*
+Statistics of a corpus of MIDI files, see `midi_stats.h`.
+Files are spread over threads, each thread keeps its own partial statistics
+and they are merged once every file is done.
+`.midx` sidecars written by midiindex are scanned instead of being decoded.
+
+Options:
+-j threads  number of threads, 1 by default
+-v          statistics of every file as well
+
+Usage:
+make converter
+./bin/midistats -j 4 music.mid other.mid
+*/
+
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "midi_parser.h"
+#include "midi_index.h"
+#include "midi_stats.h"
+
+
+struct worker
+{
+    pthread_t thread;
+    struct midi_stats stats;
+
+    char **paths;
+    size_t count, first, step;
+    uint8_t verbose;
+};
+
+static pthread_mutex_t output_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/// Add the statistics of the file at `path` to `stats`.
+static int file_stats(struct midi_stats *stats, const char *path)
+{
+    struct midi_index index;
+    char magic[4] = { 0 };
+    size_t size;
+    uint8_t *data;
+    int status;
+    FILE *midi = fopen(path, "rb");
+
+    if (!midi)
+        return MIDI_InvalidHeaderChunk;
+
+    fread(magic, 1, sizeof(magic), midi);
+
+    if (!memcmp(magic, MIDI_INDEX_MAGIC, 4)) {
+        fclose(midi);
+        if (!midi_index_open(&index, path))
+            return midi_status;
+        midi_stats_index(stats, &index);
+        midi_index_close(&index);
+        return midi_status;
+    }
+
+    rewind(midi);
+    data = midi_load(midi, &size);
+    fclose(midi);
+
+    if (!data)
+        return MIDI_OutOfMemory;
+
+    status = midi_stats_file(stats, data, size);
+    free(data);
+    return status;
+}
+
+static void *work(void *context)
+{
+    struct worker *self = (struct worker *) context;
+    struct midi_stats file;
+
+    for (size_t i = self->first; i < self->count; i += self->step) {
+        midi_stats_new(&file);
+        int status = file_stats(&file, self->paths[i]);
+
+        pthread_mutex_lock(&output_lock);
+        if (status != MIDI_Success) {
+            fprintf(stderr, "midistats: %s: error %d\n", self->paths[i], status);
+        } else if (self->verbose) {
+            printf("== %s\n", self->paths[i]);
+            midi_stats_print(&file, stdout);
+        }
+        pthread_mutex_unlock(&output_lock);
+
+        if (status == MIDI_Success)
+            midi_stats_merge(&self->stats, &file);
+    }
+
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    size_t thread_count = 1;
+    uint8_t verbose = 0;
+    int option;
+
+    while ((option = getopt(argc, argv, "j:v")) != -1) {
+        switch (option) {
+        case 'j':
+            thread_count = strtoul(optarg, NULL, 10);
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        default:
+            fprintf(stderr, "usage: midistats [-v] [-j threads] music.mid...\n");
+            return 1;
+        }
+    }
+
+    if (!thread_count)
+        thread_count = 1;
+
+    struct worker *workers = calloc(thread_count, sizeof(struct worker));
+    struct midi_stats total;
+
+    if (!workers) {
+        perror("midistats");
+        return 1;
+    }
+
+    for (size_t i = 0; i < thread_count; ++i) {
+        struct worker *worker = workers + i;
+
+        midi_stats_new(&worker->stats);
+        worker->paths = argv + optind;
+        worker->count = argc - optind;
+        worker->first = i;
+        worker->step = thread_count;
+        worker->verbose = verbose;
+
+        if (pthread_create(&worker->thread, NULL, work, worker)) {
+            perror("midistats");
+            return 1;
+        }
+    }
+
+    midi_stats_new(&total);
+
+    for (size_t i = 0; i < thread_count; ++i) {
+        pthread_join(workers[i].thread, NULL);
+        midi_stats_merge(&total, &workers[i].stats);
+    }
+
+    if (verbose)
+        printf("== total\n");
+    midi_stats_print(&total, stdout);
+
+    free(workers);
+    return 0;
+}
@@ -0,0 +1,120 @@
+/*
+Print the events of a MIDI file as it is being written, like `tail -f`, see `midi_follow` in `midi_stream.h`.
+
+Each poll decodes only the bytes appended since the previous one, and track chunk
+lengths are not trusted, so a capture whose chunk lengths are only written once it
+is over can be followed. It stops at the end of the last track.
+
+One line per event: track, tick and status, then the data bytes of channel events,
+the length of sysex events, or the type and length of meta events, with their text.
+
+Options:
+-i ms       time between polls, 200 by default
+
+Usage:
+make converter
+./bin/miditail -i 50 capture.mid
+*/
+
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "midi_parser.h"
+#include "midi_stream.h"
+#include "output.h"
+
+
+static void print_event(void *context, struct midi_stream_event *stream_event)
+{
+    struct output *output = (struct output *) context;
+    const struct midi_event *event = &stream_event->event;
+
+    output_u64(output, stream_event->track);
+    output_literal(output, ", ");
+    output_u64(output, stream_event->timestamp);
+    output_literal(output, ", ");
+    output_u64(output, event->status);
+
+    if (event->status < 0xF0) {
+        for (uint32_t i = 0; i < event->size; ++i) {
+            output_literal(output, ", ");
+            output_u64(output, event->midi_data[i]);
+        }
+    } else if (event->status == 0xFF) {
+        output_literal(output, ", ");
+        output_u64(output, event->meta_type);
+        output_literal(output, ", ");
+        output_u64(output, event->size);
+
+        #if MIDI_META_EVENT >= 3
+            if (event->meta_type >= MetaText && event->meta_type <= MetaCuePoint) {
+                output_literal(output, ", \"");
+                output_escaped(output, (const uint8_t *) event->meta_data.text, strlen(event->meta_data.text));
+                output_char(output, '"');
+            }
+        #endif
+    } else {
+        output_literal(output, ", ");
+        output_u64(output, event->size);
+    }
+
+    output_char(output, '\n');
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t interval = 200;
+    int option;
+
+    while ((option = getopt(argc, argv, "i:")) != -1) {
+        switch (option) {
+        case 'i':
+            interval = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            fprintf(stderr, "usage: miditail [-i ms] capture.mid\n");
+            return 1;
+        }
+    }
+
+    if (optind != argc - 1) {
+        fprintf(stderr, "usage: miditail [-i ms] capture.mid\n");
+        return 1;
+    }
+
+    FILE *midi = fopen(argv[optind], "rb");
+    if (!midi) {
+        perror("miditail");
+        return 1;
+    }
+
+    static struct output output;
+    static struct midi_follow follow;
+    struct timespec pause = { interval / 1000, interval % 1000 * 1000000L };
+
+    output_new(&output, stdout);
+    midi_follow_new(&follow, &output, print_event);
+
+    for (;;) {
+        midi_follow_poll(&follow, midi);
+
+        output_flush(&output);
+        fflush(stdout);
+
+        if (midi_stream_over(&follow.stream))
+            break;
+
+        nanosleep(&pause, NULL);
+    }
+
+    if (follow.stream.state == StreamError)
+        fprintf(stderr, "miditail: invalid MIDI file at byte %" PRIu64 ", error %d\n", follow.offset, midi_status);
+
+    fclose(midi);
+    return follow.stream.state == StreamError;
+}
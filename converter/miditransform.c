@@ -0,0 +1,168 @@
+/*
+Transform a MIDI file in batches of events, see `midi_transform.h`.
+Stages run in the order of the options: `-c 0:9 -t 12` leaves the notes moved to
+channel 10 as they are, percussion is never transposed, while `-t 12 -c 0:9` transposes them first.
+
+Options:
+-t semitones    transpose notes, except on channel 10
+-q grid         quantize every event to a grid of this many ticks
+-c from:to      move the events of channel `from` to channel `to`, channels counted from 0
+-d channel      drop the events of the channel
+-s ratio        stretch time by multiplying every tempo, as `3/2` or `2`
+-m bytes        memory per output track before it spills to a temporary file, 1 MiB by default, 0 for no limit
+
+A regular input file is mapped rather than read, so the memory of a job does not grow with the file.
+
+Usage:
+make converter
+./bin/miditransform -t -2 -q 120 music.mid transformed.mid
+*/
+
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "midi_parser.h"
+#include "midi_writer.h"
+#include "midi_transform.h"
+
+
+/// Identity channel map in `stage`.
+static void channels_identity(struct midi_transform_stage *stage)
+{
+    stage->type = TransformChannels;
+    for (uint8_t channel = 0; channel < 16; ++channel)
+        stage->channels[channel] = channel;
+}
+
+/// Parse the value of option `option`, return 0 if it is not valid.
+static int parse_stage(struct midi_transform_stage *stage, int option, const char *value)
+{
+    char *end;
+    unsigned long from, to;
+    long semitones;
+
+    switch (option) {
+    case 't':
+        stage->type = TransformTranspose;
+        semitones = strtol(value, &end, 10);
+        stage->semitones = (int8_t) semitones;
+        return !*end && semitones >= -127 && semitones <= 127;
+
+    case 'q':
+        stage->type = TransformQuantize;
+        stage->grid = strtoul(value, &end, 10);
+        return !*end && stage->grid;
+
+    case 'c':
+        channels_identity(stage);
+        from = strtoul(value, &end, 10);
+        if (*end != ':' || from > 15)
+            return 0;
+        to = strtoul(end + 1, &end, 10);
+        stage->channels[from] = (uint8_t) to;
+        return !*end && to <= 15;
+
+    case 'd':
+        channels_identity(stage);
+        from = strtoul(value, &end, 10);
+        if (*end || from > 15)
+            return 0;
+        stage->channels[from] = MIDI_TRANSFORM_DROP;
+        return 1;
+
+    case 's':
+        stage->type = TransformTempo;
+        stage->tempo.numerator = strtoul(value, &end, 10);
+        stage->tempo.denominator = 1;
+        if (*end == '/')
+            stage->tempo.denominator = strtoul(end + 1, &end, 10);
+        return !*end && stage->tempo.numerator && stage->tempo.denominator;
+    }
+
+    return 0;
+}
+
+/// Map the regular file `midi`, or load it when it can not be mapped. Set `mapped` to tell which.
+static uint8_t *input(FILE *midi, size_t *size, int *mapped)
+{
+    struct stat status;
+    void *data;
+
+    *mapped = !fstat(fileno(midi), &status) && S_ISREG(status.st_mode) && status.st_size > 0
+        && (data = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, fileno(midi), 0)) != MAP_FAILED;
+
+    if (!*mapped)
+        return midi_load(midi, size);
+
+    *size = status.st_size;
+    return (uint8_t *) data;
+}
+
+int main(int argc, char **argv)
+{
+    static struct midi_transform transform;
+    struct midi_transform_stage stage;
+    int option;
+
+    midi_transform_new(&transform);
+    transform.spill_size = 1 << 20;
+
+    while ((option = getopt(argc, argv, "t:q:c:d:s:m:")) != -1) {
+        if (option == 'm') {
+            transform.spill_size = strtoul(optarg, NULL, 10);
+            continue;
+        }
+
+        if (option == '?' || !parse_stage(&stage, option, optarg) || !midi_transform_add(&transform, &stage)) {
+            fprintf(stderr, "usage: miditransform [-t semitones] [-q grid] [-c from:to] [-d channel] [-s ratio] [-m bytes] [music.mid [transformed.mid]]\n");
+            return 1;
+        }
+    }
+
+    argc -= optind - 1;
+    argv += optind - 1;
+
+    FILE
+    *midi = stdin,
+    *output = stdout;
+
+    switch (argc) {
+    case 3:
+        output = fopen(argv[2], "wb");
+    case 2:
+        midi = fopen(argv[1], "rb");
+    }
+
+    if (!midi || !output) {
+        perror("miditransform");
+        return 1;
+    }
+
+    struct midi_writer writer;
+    size_t size;
+    uint8_t *data;
+    int status = MIDI_OutOfMemory, mapped;
+
+    if ((data = input(midi, &size, &mapped))) {
+        status = midi_transform_file(&transform, data, size, &writer);
+        if (status == MIDI_Success && !midi_writer_finalize(&writer, output))
+            status = midi_status;
+        midi_writer_free(&writer);
+    }
+
+    if (status != MIDI_Success)
+        fprintf(stderr, "miditransform: could not transform the MIDI file, error %d\n", status);
+
+    if (mapped)
+        munmap(data, size);
+    else
+        free(data);
+    fclose(midi);
+    fclose(output);
+    return status != MIDI_Success;
+}
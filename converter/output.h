@@ -0,0 +1,307 @@
+/*
+Block buffered output shared by the converters.
+
+Records are assembled in one large buffer with hand rolled integer formatting
+and written out with a single `fwrite` per block, instead of going through
+`fprintf` format parsing for every field.
+*/
+
+
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __SSE2__
+    #include <emmintrin.h>
+#endif
+
+
+#define OUTPUT_BUFFER_SIZE (1 << 16)
+
+// Longest single field written through `output_reserve`.
+#define OUTPUT_FIELD_SIZE 32
+
+#define output_literal(output, string) output_write((output), (string), sizeof(string) - 1)
+
+
+struct output
+{
+    FILE *file;
+    size_t size;
+    char data[OUTPUT_BUFFER_SIZE];
+};
+
+
+static const char output_digits[200] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+
+static inline void output_new(struct output *self, FILE *file)
+{
+    self->file = file;
+    self->size = 0;
+}
+
+static inline void output_flush(struct output *self)
+{
+    if (self->size)
+        fwrite(self->data, 1, self->size, self->file);
+    self->size = 0;
+}
+
+/// Make room for `n` bytes and return where they go.
+static inline char *output_reserve(struct output *self, size_t n)
+{
+    if (self->size + n > OUTPUT_BUFFER_SIZE)
+        output_flush(self);
+    return self->data + self->size;
+}
+
+static inline void output_write(struct output *self, const char *data, size_t n)
+{
+    if (n > OUTPUT_BUFFER_SIZE / 2) {
+        output_flush(self);
+        fwrite(data, 1, n, self->file);
+        return;
+    }
+
+    memcpy(output_reserve(self, n), data, n);
+    self->size += n;
+}
+
+static inline void output_char(struct output *self, char c)
+{
+    *output_reserve(self, 1) = c;
+    ++self->size;
+}
+
+/// Format `n` in decimal into `end`, backwards. Return the first character.
+static inline char *output_format_u64(char *end, uint64_t n)
+{
+    while (n >= 100) {
+        end -= 2;
+        memcpy(end, output_digits + n % 100 * 2, 2);
+        n /= 100;
+    }
+
+    if (n >= 10) {
+        end -= 2;
+        memcpy(end, output_digits + n * 2, 2);
+    } else {
+        *--end = '0' + n;
+    }
+
+    return end;
+}
+
+static inline void output_u64(struct output *self, uint64_t n)
+{
+    char buffer[OUTPUT_FIELD_SIZE];
+    char *end = buffer + sizeof(buffer);
+    char *start = output_format_u64(end, n);
+
+    memcpy(output_reserve(self, end - start), start, end - start);
+    self->size += end - start;
+}
+
+static inline void output_i64(struct output *self, int64_t n)
+{
+    if (n < 0) {
+        output_char(self, '-');
+        output_u64(self, -(uint64_t) n);
+    } else {
+        output_u64(self, n);
+    }
+}
+
+/// 3 digits octal representation of `c` prefixed with `\`.
+static inline void output_octal(struct output *self, uint8_t c)
+{
+    char *buffer = output_reserve(self, 4);
+    buffer[0] = '\\';
+    buffer[1] = '0' + (c >> 6);
+    buffer[2] = '0' + (c >> 3 & 7);
+    buffer[3] = '0' + (c & 7);
+    self->size += 4;
+}
+
+/// Length of the prefix of `data` made of bytes midicsv writes as they are.
+static inline size_t output_plain_csv(const uint8_t *data, size_t n)
+{
+    size_t i = 0;
+
+    #ifdef __SSE2__
+        const __m128i control = _mm_set1_epi8(0x1F), quote = _mm_set1_epi8('"'), backslash = _mm_set1_epi8('\\');
+
+        for (; i + 16 <= n; i += 16) {
+            __m128i bytes = _mm_loadu_si128((const __m128i *) (data + i));
+            // Unsigned `bytes <= 0x1F`, a quote or a backslash.
+            __m128i special = _mm_or_si128(
+                _mm_cmpeq_epi8(_mm_min_epu8(bytes, control), bytes),
+                _mm_or_si128(_mm_cmpeq_epi8(bytes, quote), _mm_cmpeq_epi8(bytes, backslash))
+            );
+            int mask = _mm_movemask_epi8(special);
+            if (mask)
+                return i + __builtin_ctz(mask);
+        }
+    #endif
+
+    for (; i < n; ++i)
+        if (data[i] < ' ' || data[i] == '"' || data[i] == '\\')
+            break;
+
+    return i;
+}
+
+/// Length of the prefix of `data` made of printable ASCII needing no JSON escape.
+static inline size_t output_plain_json(const uint8_t *data, size_t n)
+{
+    size_t i = 0;
+
+    #ifdef __SSE2__
+        const __m128i control = _mm_set1_epi8(0x1F), quote = _mm_set1_epi8('"'), backslash = _mm_set1_epi8('\\');
+
+        for (; i + 16 <= n; i += 16) {
+            __m128i bytes = _mm_loadu_si128((const __m128i *) (data + i));
+            __m128i special = _mm_or_si128(
+                _mm_cmpeq_epi8(_mm_min_epu8(bytes, control), bytes),
+                _mm_or_si128(_mm_cmpeq_epi8(bytes, quote), _mm_cmpeq_epi8(bytes, backslash))
+            );
+            // Non ASCII bytes have their high bit set.
+            int mask = _mm_movemask_epi8(special) | _mm_movemask_epi8(bytes);
+            if (mask)
+                return i + __builtin_ctz(mask);
+        }
+    #endif
+
+    for (; i < n; ++i)
+        if (data[i] < ' ' || data[i] >= 0x80 || data[i] == '"' || data[i] == '\\')
+            break;
+
+    return i;
+}
+
+/// Length of the well formed UTF-8 sequence starting at `data`, 0 if there is none.
+static inline size_t output_utf8_length(const uint8_t *data, size_t n)
+{
+    uint8_t c = data[0];
+    size_t size;
+    uint8_t low = 0x80, high = 0xBF;
+
+    if (c >= 0xC2 && c <= 0xDF)
+        size = 2;
+    else if (c >= 0xE0 && c <= 0xEF)
+        size = 3;
+    else if (c >= 0xF0 && c <= 0xF4)
+        size = 4;
+    else
+        return 0;
+
+    // Reject overlong forms, surrogates and code points past U+10FFFF.
+    switch (c) {
+    case 0xE0: low = 0xA0; break;
+    case 0xED: high = 0x9F; break;
+    case 0xF0: low = 0x90; break;
+    case 0xF4: high = 0x8F; break;
+    }
+
+    if (size > n || data[1] < low || data[1] > high)
+        return 0;
+
+    for (size_t i = 2; i < size; ++i)
+        if (data[i] < 0x80 || data[i] > 0xBF)
+            return 0;
+
+    return size;
+}
+
+/**
+Write `n` bytes the way midicsv quotes strings: printable and non ASCII bytes as they are,
+quotes doubled, backslashes doubled and everything else in octal.
+Runs of bytes needing no escape are found 16 at a time and copied in bulk.
+*/
+static inline void output_escaped(struct output *self, const uint8_t *data, size_t n)
+{
+    size_t i = 0, run;
+
+    while (i < n) {
+        run = output_plain_csv(data + i, n - i);
+        output_write(self, (const char *) data + i, run);
+        i += run;
+
+        if (i == n)
+            break;
+
+        if (data[i] == '"')
+            // Quote characters embedded within strings are represented by `two` consecutive quotes.
+            output_literal(self, "\"\"");
+        else if (data[i] == '\\')
+            output_literal(self, "\\\\");
+        else
+            output_octal(self, data[i]);
+        ++i;
+    }
+}
+
+/**
+Write `n` bytes as the inside of a JSON string.
+Well formed UTF-8 is kept, any other byte becomes the code point of the same value,
+as if the text was Latin-1, so that the result is always valid JSON.
+*/
+static inline void output_json_escaped(struct output *self, const uint8_t *data, size_t n)
+{
+    static const char hex[] = "0123456789abcdef";
+    size_t i = 0, run;
+    uint8_t c;
+
+    while (i < n) {
+        run = output_plain_json(data + i, n - i);
+        output_write(self, (const char *) data + i, run);
+        i += run;
+
+        if (i == n)
+            break;
+
+        c = data[i];
+
+        if (c >= 0x80 && (run = output_utf8_length(data + i, n - i))) {
+            output_write(self, (const char *) data + i, run);
+            i += run;
+            continue;
+        }
+
+        switch (c) {
+        case '"': output_literal(self, "\\\""); break;
+        case '\\': output_literal(self, "\\\\"); break;
+        case '\b': output_literal(self, "\\b"); break;
+        case '\f': output_literal(self, "\\f"); break;
+        case '\n': output_literal(self, "\\n"); break;
+        case '\r': output_literal(self, "\\r"); break;
+        case '\t': output_literal(self, "\\t"); break;
+        default: {
+            char *buffer = output_reserve(self, 6);
+            memcpy(buffer, "\\u00", 4);
+            buffer[4] = hex[c >> 4];
+            buffer[5] = hex[c & 0x0F];
+            self->size += 6;
+        }
+        }
+        ++i;
+    }
+}
+
+
+#endif /* OUTPUT_H */
@@ -0,0 +1,370 @@
+#ifndef MIDI_EXTRACT_H
+#define MIDI_EXTRACT_H
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "midi_parser.h"
+#include "midi_index.h"
+#include "midi_writer.h"
+
+
+#define MIDI_EXTRACT_CELLS (16 * 128)
+
+/// Controllers from this one on are channel mode messages, they are not chased.
+#define MIDI_EXTRACT_CONTROLLERS 120
+
+/// Value of a chased controller or program that never changed.
+#define MIDI_EXTRACT_UNSET 0x80
+
+
+/**
+State in effect at the cut, rebuilt at the start of the extract:
+the last tempo, time signature and key signature, and per channel the last
+program, controller values and pitch bend.
+*/
+struct midi_chase
+{
+	// 0 when there was no tempo event.
+	uint32_t tempo;
+
+	uint8_t has_time_signature, has_key_signature;
+	uint8_t time_signature[4];
+	uint8_t key_signature[2];
+
+	uint8_t programs[16];
+	uint8_t controllers[16][MIDI_EXTRACT_CONTROLLERS];
+	// Both data bytes, `pitch_bends[channel][0]` is `MIDI_EXTRACT_UNSET` when there was none.
+	uint8_t pitch_bends[16][2];
+};
+
+/**
+Copy of the events between `start_us` included and `end_us` excluded into a new file.
+Times are shifted so that the extract starts at tick 0, where the chased state goes,
+in the first track. Notes still sounding at the end are ended there,
+note off events of notes started before the cut are left out.
+*/
+struct midi_extract
+{
+	struct midi_writer *writer;
+	uint64_t start_us, end_us;
+
+	// Tick of the input where the extract starts, and the last one it holds.
+	uint32_t cut, end;
+
+	struct midi_chase chase;
+
+	// Track plus 1 of the note sounding in each `channel * 128 + pitch` cell, 0 for none.
+	uint16_t owners[MIDI_EXTRACT_CELLS];
+};
+
+
+static inline struct midi_extract *midi_extract_new(struct midi_extract *self, uint64_t start_us, uint64_t end_us)
+{
+	if (!self)
+		self = (struct midi_extract *) malloc(sizeof(struct midi_extract));
+
+	self->writer = NULL;
+	self->start_us = start_us;
+	self->end_us = end_us;
+	self->cut = self->end = 0;
+
+	memset(&self->chase, 0, sizeof(self->chase));
+	memset(self->chase.programs, MIDI_EXTRACT_UNSET, sizeof(self->chase.programs));
+	memset(self->chase.controllers, MIDI_EXTRACT_UNSET, sizeof(self->chase.controllers));
+	memset(self->chase.pitch_bends, MIDI_EXTRACT_UNSET, sizeof(self->chase.pitch_bends));
+	memset(self->owners, 0, sizeof(self->owners));
+
+	return self;
+}
+
+/// Remember the state `message`, before the cut, leaves behind.
+static inline void midi_extract_chase(struct midi_extract *self, const struct midi_message *message)
+{
+	struct midi_chase *chase = &self->chase;
+	uint8_t channel = message->status & 0x0F;
+
+	switch (message->status & 0xF0) {
+	case EventProgramChange:
+		chase->programs[channel] = message->data[0] & 0x7F;
+		return;
+	case EventControllerChange:
+		if ((message->data[0] & 0x7F) < MIDI_EXTRACT_CONTROLLERS)
+			chase->controllers[channel][message->data[0] & 0x7F] = message->data[1] & 0x7F;
+		return;
+	case EventPitchBend:
+		chase->pitch_bends[channel][0] = message->data[0] & 0x7F;
+		chase->pitch_bends[channel][1] = message->data[1] & 0x7F;
+		return;
+	}
+
+	if (message->status != 0xFF)
+		return;
+
+	if (message->meta_type == MetaSetTempo && message->size >= 3) {
+		chase->tempo = message->data[0] << 16 | message->data[1] << 8 | message->data[2];
+	} else if (message->meta_type == MetaTimeSignature && message->size >= 4) {
+		memcpy(chase->time_signature, message->data, 4);
+		chase->has_time_signature = 1;
+	} else if (message->meta_type == MetaKeySignature && message->size >= 2) {
+		memcpy(chase->key_signature, message->data, 2);
+		chase->has_key_signature = 1;
+	}
+}
+
+/// Set the cut from `clock`, the tempo in effect at `start_us`, and write the chased state at tick 0.
+static inline int midi_extract_begin(struct midi_extract *self, const struct midi_clock *clock)
+{
+	const struct midi_chase *chase = &self->chase;
+	struct midi_writer *writer = self->writer;
+	uint8_t tempo[3] = { (uint8_t) (chase->tempo >> 16), (uint8_t) (chase->tempo >> 8), (uint8_t) chase->tempo };
+
+	self->cut = midi_clock_tick(clock, self->start_us);
+
+	if ((chase->tempo && !midi_writer_meta(writer, 0, 0, MetaSetTempo, tempo, 3))
+	|| (chase->has_time_signature && !midi_writer_meta(writer, 0, 0, MetaTimeSignature, chase->time_signature, 4))
+	|| (chase->has_key_signature && !midi_writer_meta(writer, 0, 0, MetaKeySignature, chase->key_signature, 2)))
+		return midi_status;
+
+	for (uint8_t channel = 0; channel < 16; ++channel) {
+		const uint8_t *controllers = chase->controllers[channel];
+
+		// Bank select goes before the program change it applies to.
+		for (uint8_t controller = 0; controller <= 32; controller += 32)
+			if (controllers[controller] != MIDI_EXTRACT_UNSET
+			&& !midi_writer_event(writer, 0, 0, EventControllerChange | channel, controller, controllers[controller]))
+				return midi_status;
+
+		if (chase->programs[channel] != MIDI_EXTRACT_UNSET
+		&& !midi_writer_event(writer, 0, 0, EventProgramChange | channel, chase->programs[channel], 0))
+			return midi_status;
+
+		for (uint8_t controller = 0; controller < MIDI_EXTRACT_CONTROLLERS; ++controller)
+			if (controller != 0 && controller != 32 && controllers[controller] != MIDI_EXTRACT_UNSET
+			&& !midi_writer_event(writer, 0, 0, EventControllerChange | channel, controller, controllers[controller]))
+				return midi_status;
+
+		if (chase->pitch_bends[channel][0] != MIDI_EXTRACT_UNSET
+		&& !midi_writer_event(writer, 0, 0, EventPitchBend | channel, chase->pitch_bends[channel][0], chase->pitch_bends[channel][1]))
+			return midi_status;
+	}
+
+	return midi_status = MIDI_Success;
+}
+
+/// Copy `message`, inside the range, to the extract.
+static inline int midi_extract_message(struct midi_extract *self, const struct midi_message *message)
+{
+	uint8_t type = message->status & 0xF0;
+	struct midi_message shifted = *message;
+
+	shifted.timestamp = message->timestamp - self->cut;
+	self->end = MIDI_MAX(self->end, shifted.timestamp);
+
+	// Every track gets its end of track at the end of the extract.
+	if (message->status == 0xFF && message->meta_type == MetaEndOfTrack)
+		return MIDI_Success;
+
+	if (type == EventNoteOn || type == EventNoteOff) {
+		size_t cell = (message->status & 0x0F) * 128 + (message->data[0] & 0x7F);
+
+		if (type == EventNoteOn && message->data[1]) {
+			self->owners[cell] = message->track + 1;
+		} else if (self->owners[cell] == message->track + 1) {
+			self->owners[cell] = 0;
+		} else {
+			return MIDI_Success;
+		}
+	}
+
+	return midi_writer_message(self->writer, &shifted) ? MIDI_Success : midi_status;
+}
+
+/// End the notes still sounding and every track at `end`, the first tick past the range.
+static inline int midi_extract_finish(struct midi_extract *self, uint32_t end)
+{
+	struct midi_writer *writer = self->writer;
+
+	self->end = MIDI_MAX(self->end, end - MIDI_MIN(end, self->cut));
+
+	for (size_t cell = 0; cell < MIDI_EXTRACT_CELLS; ++cell)
+		if (self->owners[cell] && !midi_writer_event(writer, self->owners[cell] - 1, self->end, EventNoteOff | cell >> 7, cell & 0x7F, 0))
+			return midi_status;
+
+	for (uint16_t track = 0; track < writer->header.track_count; ++track)
+		if (!midi_writer_meta(writer, track, MIDI_MAX(self->end, writer->tracks[track].tick), MetaEndOfTrack, NULL, 0))
+			return midi_status;
+
+	return midi_status = MIDI_Success;
+}
+
+/**
+Extract the range from the MIDI file in `data` into `writer`, created here with the same header.
+Events before the range are only chased, decoding stops at the first event past it.
+Return `MIDI_Success` or the error that stopped it. `writer` must be freed either way.
+*/
+static inline int midi_extract_file(struct midi_extract *self, const uint8_t *data, size_t size, struct midi_writer *writer)
+{
+	struct midi_merge merge;
+	struct midi_message message;
+	struct midi_clock clock;
+	uint8_t started = 0;
+	int status = MIDI_Success;
+
+	writer->tracks = NULL;
+	writer->header.track_count = 0;
+	self->writer = writer;
+
+	if (!midi_merge_new(&merge, data, size))
+		return midi_status;
+
+	// A cut needs a single time line.
+	if (merge.header.format == 2) {
+		midi_merge_free(&merge);
+		return midi_status = MIDI_Unimplemented;
+	}
+
+	if (!midi_writer_new(writer, merge.header.format, merge.header.track_count, merge.header.time_division)) {
+		midi_merge_free(&merge);
+		return midi_status;
+	}
+
+	// The clock before each message still covers the time up to it.
+	for (clock = merge.clock; midi_merge_next(&merge, &message); clock = merge.clock) {
+		if (merge.us >= self->end_us)
+			break;
+
+		if (merge.us < self->start_us) {
+			midi_extract_chase(self, &message);
+			continue;
+		}
+
+		if (!started && (status = midi_extract_begin(self, &clock)))
+			break;
+		started = 1;
+
+		if ((status = midi_extract_message(self, &message)))
+			break;
+	}
+
+	if (!status && midi_status != MIDI_Success)
+		status = midi_status;
+
+	if (!status && !started)
+		status = midi_extract_begin(self, &clock);
+
+	// Past the last event, the extract ends with it.
+	if (!status)
+		status = midi_extract_finish(self, merge.us >= self->end_us ? midi_clock_tick(&clock, self->end_us) : 0);
+
+	midi_merge_free(&merge);
+	return midi_status = status;
+}
+
+/// Message `i` of `index`, `bytes` holding the data bytes of channel events.
+static inline void midi_extract_index_message(const struct midi_index *index, uint64_t i, struct midi_message *message, uint8_t *bytes)
+{
+	message->track = index->track[i];
+	message->timestamp = index->tick[i];
+	message->dtime = 0;
+	message->status = index->status[i];
+	message->meta_type = index->meta_type[i];
+	message->size = index->size_column[i];
+
+	if (message->status < 0xF0) {
+		bytes[0] = (uint8_t) index->data[i];
+		bytes[1] = (uint8_t) (index->data[i] >> 8);
+		message->data = bytes;
+	} else {
+		message->data = midi_index_payload(index, i);
+	}
+}
+
+/// First event of `index` at or after `us`, the time column being sorted.
+static inline uint64_t midi_extract_index_find(const struct midi_index *index, uint64_t us)
+{
+	uint64_t low = 0, high = index->header->event_count;
+
+	while (low < high) {
+		uint64_t middle = low + (high - low) / 2;
+
+		if (index->us[middle] < us)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	return low;
+}
+
+/// Clock with the tempo in effect at `us`, replaying the tempo map of `index`.
+static inline void midi_extract_index_clock(const struct midi_index *index, struct midi_clock *clock, uint64_t us)
+{
+	midi_clock_new(clock, index->header->time_division);
+
+	for (uint64_t i = 0; i < index->header->tempo_count && index->tempo[i].us < us; ++i)
+		midi_clock_tempo(clock, index->tempo[i].tick, index->tempo[i].tempo);
+}
+
+/**
+Extract the range from a `.midx` file into `writer`, created here with the same header.
+The ends of the range are found by binary search on the time column,
+the state before the range is chased from the columns without decoding anything.
+*/
+static inline int midi_extract_index(struct midi_extract *self, const struct midi_index *index, struct midi_writer *writer)
+{
+	const struct midi_index_header *header = index->header;
+	struct midi_message message;
+	struct midi_clock clock;
+	uint8_t bytes[2];
+	uint64_t first = midi_extract_index_find(index, self->start_us);
+	uint64_t last = midi_extract_index_find(index, self->end_us);
+	int status;
+
+	writer->tracks = NULL;
+	writer->header.track_count = 0;
+	self->writer = writer;
+
+	if (header->format == 2)
+		return midi_status = MIDI_Unimplemented;
+
+	if (!midi_clock_new(&clock, header->time_division))
+		return midi_status = MIDI_InvalidHeaderChunk;
+
+	if (!midi_writer_new(writer, header->format, header->track_count, header->time_division))
+		return midi_status;
+
+	for (uint64_t i = 0; i < first; ++i) {
+		uint8_t status = index->status[i];
+
+		// Only the events the chase keeps are looked at.
+		if ((status & 0xF0) == EventProgramChange || (status & 0xF0) == EventControllerChange
+		|| (status & 0xF0) == EventPitchBend || status == 0xFF) {
+			midi_extract_index_message(index, i, &message, bytes);
+			midi_extract_chase(self, &message);
+		}
+	}
+
+	midi_extract_index_clock(index, &clock, self->start_us);
+	if ((status = midi_extract_begin(self, &clock)))
+		return status;
+
+	for (uint64_t i = first; i < last; ++i) {
+		midi_extract_index_message(index, i, &message, bytes);
+		if ((status = midi_extract_message(self, &message)))
+			return status;
+	}
+
+	uint32_t end = 0;
+	if (last < header->event_count) {
+		midi_extract_index_clock(index, &clock, self->end_us);
+		end = midi_clock_tick(&clock, self->end_us);
+	}
+
+	return midi_extract_finish(self, end);
+}
+
+
+#endif /* MIDI_EXTRACT_H */
@@ -0,0 +1,214 @@
+#ifndef MIDI_FINGERPRINT_H
+#define MIDI_FINGERPRINT_H
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "midi_parser.h"
+
+
+/// Resolution every file is rescaled to before hashing.
+#define MIDI_FINGERPRINT_PPQ 960
+
+/// Note on events kept per instant, an instant with more is split.
+#define MIDI_FINGERPRINT_NOTES 2048
+
+/// Channel 10, percussion, is never transposed.
+#define MIDI_FINGERPRINT_DRUMS 9
+
+
+enum MIDI_FingerprintFlags
+{
+	// Pitches are hashed relative to each other, so transposed copies match.
+	FingerprintTranspose = 1
+};
+
+/**
+Content hash of the music of a MIDI file, the same for byte different copies of it.
+
+Only channel events are hashed, in merged order, at their time rescaled to `MIDI_FINGERPRINT_PPQ`
+ticks per quarter note, or in milli seconds with SMPTE time division.
+Events of the same instant are summed as a multiset, so the order of tracks does not matter,
+and note on events with a zero velocity count as note off events.
+Running status, value encodings, meta and sysex events leave the hash unchanged.
+
+With `FingerprintTranspose`, the note on events of an instant are hashed relative to
+the lowest of them, and that lowest pitch relative to the one of the previous instant with notes.
+*/
+struct midi_fingerprint
+{
+	uint8_t flags;
+	uint16_t ticks_per_quarter;
+
+	uint64_t hash;
+	// Channel events hashed.
+	uint64_t events;
+
+	// Instant being collected, in canonical time, and the previous one.
+	uint64_t time, previous_time;
+	uint64_t sum;
+	uint32_t count;
+
+	// Lowest transposable pitch of the last instant with notes, -1 before the first one.
+	int16_t reference;
+
+	// Note on events of the instant, as `channel * 128 + pitch` and velocity.
+	uint16_t note_count;
+	uint16_t cells[MIDI_FINGERPRINT_NOTES];
+	uint8_t velocities[MIDI_FINGERPRINT_NOTES];
+};
+
+
+/// Finalizer of a 64 bit hash, every input bit flips about half of the output bits.
+static inline uint64_t midi_fingerprint_mix(uint64_t x)
+{
+	x ^= x >> 30;
+	x *= 0xBF58476D1CE4E5B9;
+	x ^= x >> 27;
+	x *= 0x94D049BB133111EB;
+	x ^= x >> 31;
+	return x;
+}
+
+/// `ticks_per_quarter` of the file, 0 with SMPTE time division.
+static inline struct midi_fingerprint *midi_fingerprint_new(struct midi_fingerprint *self, uint16_t ticks_per_quarter, uint8_t flags)
+{
+	if (!self)
+		self = (struct midi_fingerprint *) malloc(sizeof(struct midi_fingerprint));
+
+	self->flags = flags;
+	self->ticks_per_quarter = ticks_per_quarter;
+	self->hash = 0;
+	self->events = 0;
+	self->time = self->previous_time = 0;
+	self->sum = 0;
+	self->count = 0;
+	self->reference = -1;
+	self->note_count = 0;
+
+	return self;
+}
+
+/// Add a channel event of the current instant to the multiset, `key` holds everything hashed.
+static inline void midi_fingerprint_add(struct midi_fingerprint *self, uint64_t key)
+{
+	self->sum += midi_fingerprint_mix(key);
+	++self->count;
+}
+
+/// Fold the instant into the hash and start an empty one.
+static inline void midi_fingerprint_flush(struct midi_fingerprint *self)
+{
+	int16_t lowest = 128;
+
+	if (self->flags & FingerprintTranspose) {
+		for (uint16_t i = 0; i < self->note_count; ++i)
+			if (self->cells[i] >> 7 != MIDI_FINGERPRINT_DRUMS)
+				lowest = MIDI_MIN(lowest, (int16_t) (self->cells[i] & 0x7F));
+	}
+
+	for (uint16_t i = 0; i < self->note_count; ++i) {
+		uint16_t cell = self->cells[i];
+
+		if (lowest < 128 && cell >> 7 != MIDI_FINGERPRINT_DRUMS)
+			cell -= lowest;
+		midi_fingerprint_add(self, (uint64_t) EventNoteOn << 24 | (uint64_t) cell << 8 | self->velocities[i]);
+	}
+
+	// The melodic step between instants, the first one only anchors the others.
+	if (lowest < 128) {
+		if (self->reference >= 0)
+			midi_fingerprint_add(self, (uint64_t) 1 << 40 | (uint16_t) (lowest - self->reference));
+		self->reference = lowest;
+	}
+
+	if (self->count) {
+		self->hash = midi_fingerprint_mix(self->hash ^ midi_fingerprint_mix(self->time - self->previous_time) ^ self->sum);
+		self->previous_time = self->time;
+	}
+
+	self->sum = 0;
+	self->count = 0;
+	self->note_count = 0;
+}
+
+/**
+Hash `message`, happening at `us`, in the decode loop.
+Messages must come in time order, as `midi_merge_next` returns them.
+*/
+static inline void midi_fingerprint_message(struct midi_fingerprint *self, const struct midi_message *message, uint64_t us)
+{
+	uint8_t status = message->status, type = status & 0xF0;
+	uint64_t time;
+
+	if (status >= 0xF0)
+		return;
+
+	if (self->ticks_per_quarter)
+		time = ((uint64_t) message->timestamp * MIDI_FINGERPRINT_PPQ + self->ticks_per_quarter / 2) / self->ticks_per_quarter;
+	else
+		time = us / 1000;
+
+	if (time != self->time || self->note_count == MIDI_FINGERPRINT_NOTES) {
+		midi_fingerprint_flush(self);
+		self->time = time;
+	}
+
+	++self->events;
+
+	uint8_t data1 = message->data[0] & 0x7F, data2 = message->size > 1 ? message->data[1] & 0x7F : 0;
+
+	if (type == EventNoteOn && data2) {
+		self->cells[self->note_count] = (status & 0x0F) << 7 | data1;
+		self->velocities[self->note_count++] = data2;
+		return;
+	}
+
+	// Release velocities are rarely meaningful and differ between exporters.
+	if (type == EventNoteOn || type == EventNoteOff) {
+		type = EventNoteOff;
+		data2 = 0;
+	}
+
+	if (self->flags & FingerprintTranspose && (status & 0x0F) != MIDI_FINGERPRINT_DRUMS
+	&& (type == EventNoteOff || type == EventKeyPressure))
+		data1 = self->reference >= 0 ? (uint8_t) (data1 - self->reference) : 0;
+
+	midi_fingerprint_add(self, (uint64_t) (type | (status & 0x0F)) << 16 | data1 << 8 | data2);
+}
+
+/// Fold the last instant, return the fingerprint.
+static inline uint64_t midi_fingerprint_end(struct midi_fingerprint *self)
+{
+	midi_fingerprint_flush(self);
+	return self->hash;
+}
+
+/**
+Fingerprint the MIDI file in `data`, decoded once with the tracks merged.
+Return `MIDI_Success` or the error that stopped decoding, the fingerprint goes to `hash`.
+*/
+static inline int midi_fingerprint_file(const uint8_t *data, size_t size, uint8_t flags, uint64_t *hash)
+{
+	struct midi_fingerprint fingerprint;
+	struct midi_merge merge;
+	struct midi_message message;
+
+	if (!midi_merge_new(&merge, data, size))
+		return midi_status;
+
+	midi_fingerprint_new(&fingerprint, merge.clock.ticks_per_quarter, flags);
+
+	while (midi_merge_next(&merge, &message))
+		midi_fingerprint_message(&fingerprint, &message, merge.us);
+
+	*hash = midi_fingerprint_end(&fingerprint);
+	midi_merge_free(&merge);
+
+	return midi_status;
+}
+
+
+#endif /* MIDI_FINGERPRINT_H */
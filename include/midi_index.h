@@ -0,0 +1,346 @@
+#ifndef MIDI_INDEX_H
+#define MIDI_INDEX_H
+
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "midi_parser.h"
+
+
+/**
+`.midx` sidecar: a MIDI file merged into playing order and resolved to absolute time,
+stored as fixed width columns so it can be mapped and scanned without any decoding.
+
+Layout, in the byte order of the host that wrote it, every section aligned to 8 bytes:
+	header
+	tick[event_count]         uint32_t, absolute ticks
+	us[event_count]           uint64_t, absolute micro seconds
+	data[event_count]         uint32_t, data bytes of channel events (first in the low byte),
+	                          offset in the payload heap otherwise
+	size[event_count]         uint32_t, number of data bytes or payload size
+	track[event_count]        uint16_t
+	status[event_count]       uint8_t
+	meta_type[event_count]    uint8_t, 0 for events other than meta events
+	tempo[tempo_count]        struct midi_index_tempo, the tempo map
+	payload[payload_size]     sysex and meta event payloads back to back
+
+The file is mapped as is, a file written with the other byte order reads as another
+`version` and is rejected by the open.
+*/
+#define MIDI_INDEX_MAGIC "MIDX"
+#define MIDI_INDEX_VERSION 1
+
+#define MIDI_INDEX_ALIGN(n) (((n) + 7) & ~(uint64_t) 7)
+
+
+enum MIDI_IndexColumn
+{
+	IndexTick,
+	IndexUs,
+	IndexData,
+	IndexSize,
+	IndexTrack,
+	IndexStatus,
+	IndexMetaType,
+	IndexTempo,
+	IndexPayload,
+	IndexColumnCount
+};
+
+struct midi_index_header
+{
+	char magic[4];
+	uint32_t version;
+
+	uint16_t format, track_count, time_division, reserved;
+
+	uint64_t event_count;
+	uint64_t tempo_count;
+	uint64_t payload_size;
+
+	// Byte offsets of the columns from the start of the file.
+	uint64_t offsets[IndexColumnCount];
+};
+
+/// Tempo change, `us` being the absolute time at which it happens.
+struct midi_index_tempo
+{
+	uint32_t tick;
+	uint32_t tempo;
+	uint64_t us;
+};
+
+/// A mapped `.midx` file, all pointers point into the mapping.
+struct midi_index
+{
+	const struct midi_index_header *header;
+	size_t size;
+
+	const uint32_t *tick;
+	const uint64_t *us;
+	const uint32_t *data;
+	const uint32_t *size_column;
+	const uint16_t *track;
+	const uint8_t *status;
+	const uint8_t *meta_type;
+	const struct midi_index_tempo *tempo;
+	const uint8_t *payload;
+};
+
+
+/// Width in bytes of an element of `column`.
+static inline size_t midi_index_width(enum MIDI_IndexColumn column)
+{
+	static const uint8_t widths[IndexColumnCount] = {
+		[IndexTick] = sizeof(uint32_t),
+		[IndexUs] = sizeof(uint64_t),
+		[IndexData] = sizeof(uint32_t),
+		[IndexSize] = sizeof(uint32_t),
+		[IndexTrack] = sizeof(uint16_t),
+		[IndexStatus] = sizeof(uint8_t),
+		[IndexMetaType] = sizeof(uint8_t),
+		[IndexTempo] = sizeof(struct midi_index_tempo),
+		[IndexPayload] = sizeof(uint8_t)
+	};
+
+	return widths[column];
+}
+
+/// Number of elements of `column`.
+static inline uint64_t midi_index_count(const struct midi_index_header *header, enum MIDI_IndexColumn column)
+{
+	switch (column) {
+	case IndexTempo:
+		return header->tempo_count;
+	case IndexPayload:
+		return header->payload_size;
+	default:
+		return header->event_count;
+	}
+}
+
+/// Lay out the columns after the header, return the total file size.
+static inline uint64_t midi_index_layout(struct midi_index_header *header)
+{
+	uint64_t offset = MIDI_INDEX_ALIGN(sizeof(struct midi_index_header));
+
+	for (size_t column = 0; column < IndexColumnCount; ++column) {
+		header->offsets[column] = offset;
+		offset = MIDI_INDEX_ALIGN(offset + midi_index_count(header, (enum MIDI_IndexColumn) column) * midi_index_width((enum MIDI_IndexColumn) column));
+	}
+
+	return offset;
+}
+
+
+/// Payload of event `i`, NULL for channel events.
+static inline const uint8_t *midi_index_payload(const struct midi_index *self, uint64_t i)
+{
+	return self->status[i] >= 0xF0 ? self->payload + self->data[i] : NULL;
+}
+
+/**
+Map the `.midx` file at `path` and point the columns into it.
+Nothing is read or decoded past the header checks. Release it with `midi_index_close`.
+*/
+static inline struct midi_index *midi_index_open(struct midi_index *self, const char *path)
+{
+	struct stat status;
+	void *data;
+	int file = open(path, O_RDONLY);
+
+	if (file < 0) {
+		midi_status = MIDI_InvalidHeaderChunk;
+		return NULL;
+	}
+
+	if (fstat(file, &status) || (size_t) status.st_size < sizeof(struct midi_index_header)) {
+		close(file);
+		midi_status = MIDI_InvalidHeaderChunk;
+		return NULL;
+	}
+
+	data = mmap(NULL, status.st_size, PROT_READ, MAP_SHARED, file, 0);
+	close(file);
+
+	if (data == MAP_FAILED) {
+		midi_status = MIDI_OutOfMemory;
+		return NULL;
+	}
+
+	const struct midi_index_header *header = (const struct midi_index_header *) data;
+	struct midi_index_header expected = *header;
+
+	// A foreign byte order shows as another version.
+	// The columns must sit where the writer puts them, which also keeps them inside the file.
+	// Counts are bounded first so that the layout can not overflow.
+	if (memcmp(header->magic, MIDI_INDEX_MAGIC, 4) || header->version != MIDI_INDEX_VERSION
+	|| header->event_count > (uint64_t) status.st_size || header->tempo_count > (uint64_t) status.st_size
+	|| header->payload_size > (uint64_t) status.st_size
+	|| midi_index_layout(&expected) > (uint64_t) status.st_size
+	|| memcmp(expected.offsets, header->offsets, sizeof(expected.offsets))) {
+		munmap(data, status.st_size);
+		midi_status = MIDI_InvalidHeaderChunk;
+		return NULL;
+	}
+
+	if (!self)
+		self = (struct midi_index *) malloc(sizeof(struct midi_index));
+
+	const uint8_t *base = (const uint8_t *) data;
+
+	self->header = header;
+	self->size = status.st_size;
+	self->tick = (const uint32_t *) (base + header->offsets[IndexTick]);
+	self->us = (const uint64_t *) (base + header->offsets[IndexUs]);
+	self->data = (const uint32_t *) (base + header->offsets[IndexData]);
+	self->size_column = (const uint32_t *) (base + header->offsets[IndexSize]);
+	self->track = (const uint16_t *) (base + header->offsets[IndexTrack]);
+	self->status = base + header->offsets[IndexStatus];
+	self->meta_type = base + header->offsets[IndexMetaType];
+	self->tempo = (const struct midi_index_tempo *) (base + header->offsets[IndexTempo]);
+	self->payload = base + header->offsets[IndexPayload];
+
+	midi_status = MIDI_Success;
+	return self;
+}
+
+static inline void midi_index_close(struct midi_index *self)
+{
+	if (self->header) {
+		munmap((void *) self->header, self->size);
+		self->header = NULL;
+	}
+}
+
+/**
+Merge the MIDI file in `data` and write it to `file` as a `.midx`.
+The file is decoded twice, once to size the columns and once to fill them,
+so every column is allocated exactly once.
+Return the number of events written, with `midi_status` set on failure.
+*/
+static inline uint64_t midi_index_write(const uint8_t *data, size_t size, FILE *file)
+{
+	struct midi_index_header header;
+	struct midi_merge merge;
+	struct midi_message message;
+	uint8_t *columns[IndexColumnCount];
+	uint64_t i = 0, tempo = 0, payload = 0;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, MIDI_INDEX_MAGIC, 4);
+	header.version = MIDI_INDEX_VERSION;
+
+	if (!midi_merge_new(&merge, data, size))
+		return 0;
+
+	while (midi_merge_next(&merge, &message)) {
+		++header.event_count;
+		if (message.status >= 0xF0)
+			header.payload_size += message.size;
+		if (message.status == 0xFF && message.meta_type == MetaSetTempo && message.size >= 3)
+			++header.tempo_count;
+	}
+
+	midi_merge_free(&merge);
+
+	if (midi_status != MIDI_Success)
+		return 0;
+
+	if (header.payload_size > UINT32_MAX) {
+		midi_status = MIDI_Unimplemented;
+		return 0;
+	}
+
+	header.format = merge.header.format;
+	header.track_count = merge.header.track_count;
+	header.time_division = merge.header.time_division;
+	midi_index_layout(&header);
+
+	for (size_t column = 0; column < IndexColumnCount; ++column) {
+		columns[column] = (uint8_t *) malloc(midi_index_count(&header, (enum MIDI_IndexColumn) column) * midi_index_width((enum MIDI_IndexColumn) column) + 1);
+		if (!columns[column]) {
+			while (column--)
+				free(columns[column]);
+			midi_status = MIDI_OutOfMemory;
+			return 0;
+		}
+	}
+
+	uint32_t *tick_column = (uint32_t *) columns[IndexTick];
+	uint64_t *us_column = (uint64_t *) columns[IndexUs];
+	uint32_t *data_column = (uint32_t *) columns[IndexData];
+	uint32_t *size_column = (uint32_t *) columns[IndexSize];
+	uint16_t *track_column = (uint16_t *) columns[IndexTrack];
+	struct midi_index_tempo *tempo_column = (struct midi_index_tempo *) columns[IndexTempo];
+
+	if (!midi_merge_new(&merge, data, size)) {
+		for (size_t column = 0; column < IndexColumnCount; ++column)
+			free(columns[column]);
+		return 0;
+	}
+
+	for (; midi_merge_next(&merge, &message); ++i) {
+		tick_column[i] = message.timestamp;
+		us_column[i] = merge.us;
+		size_column[i] = message.size;
+		track_column[i] = message.track;
+		columns[IndexStatus][i] = message.status;
+		columns[IndexMetaType][i] = message.status == 0xFF ? message.meta_type : 0;
+
+		if (message.status < 0xF0) {
+			data_column[i] = message.data[0] | (message.size > 1 ? message.data[1] << 8 : 0);
+			continue;
+		}
+
+		data_column[i] = (uint32_t) payload;
+		memcpy(columns[IndexPayload] + payload, message.data, message.size);
+		payload += message.size;
+
+		if (message.status == 0xFF && message.meta_type == MetaSetTempo && message.size >= 3) {
+			tempo_column[tempo].tick = message.timestamp;
+			// The clock keeps its tempo with SMPTE time division, the event tells the tempo.
+			tempo_column[tempo].tempo = message.data[0] << 16 | message.data[1] << 8 | message.data[2];
+			tempo_column[tempo].us = merge.us;
+			++tempo;
+		}
+	}
+
+	midi_merge_free(&merge);
+
+	// Sections back to back, zero padded up to their aligned offsets.
+	static const uint8_t padding[8] = { 0 };
+	uint64_t position = sizeof(header);
+
+	fwrite(&header, sizeof(header), 1, file);
+
+	for (size_t column = 0; column < IndexColumnCount; ++column) {
+		uint64_t bytes = midi_index_count(&header, (enum MIDI_IndexColumn) column) * midi_index_width((enum MIDI_IndexColumn) column);
+
+		fwrite(padding, 1, header.offsets[column] - position, file);
+		fwrite(columns[column], 1, bytes, file);
+		position = header.offsets[column] + bytes;
+		free(columns[column]);
+	}
+
+	fwrite(padding, 1, MIDI_INDEX_ALIGN(position) - position, file);
+
+	if (ferror(file)) {
+		midi_status = MIDI_WriteFailed;
+		return 0;
+	}
+
+	midi_status = MIDI_Success;
+	return header.event_count;
+}
+
+
+#endif /* MIDI_INDEX_H */
@@ -0,0 +1,751 @@
+#ifndef MIDI_NGRAM_H
+#define MIDI_NGRAM_H
+
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "midi_parser.h"
+#include "midi_writer.h"
+
+
+/**
+Melodic n-gram inverted index: for every n-gram, the files it appears in,
+so that files similar to a query are found without decoding the corpus again.
+
+The melody of a channel is the highest note of each onset. Every run of
+`MIDI_NGRAM_LENGTH` onsets gives two n-grams, both independent of key and tempo:
+	pitch     the intervals between the onsets, in semitones clamped to +-`MIDI_NGRAM_INTERVAL`
+	rhythm    the ratios between the inter onset intervals, in half powers of 2 clamped to 1/4..4
+
+Layout, in the byte order of the host that wrote it, every section aligned to 8 bytes:
+	header
+	files[file_count]         struct midi_ngram_file
+	dictionary[gram_count]    struct midi_ngram_entry, sorted by n-gram
+	postings[postings_size]   per n-gram, increasing file numbers as variable length values,
+	                          the first one as is and the others as the difference to the previous one
+	paths[paths_size]         NUL terminated file paths back to back
+
+The file is mapped as is, a file written with the other byte order reads as another
+`version` and is rejected by the open.
+*/
+#define MIDI_NGRAM_MAGIC "MNGR"
+#define MIDI_NGRAM_VERSION 1
+
+/// Onsets per n-gram.
+#define MIDI_NGRAM_LENGTH 5
+
+/// Widest interval kept, wider leaps count as this one.
+#define MIDI_NGRAM_INTERVAL 24
+
+/// Set in rhythm n-grams, clear in pitch n-grams.
+#define MIDI_NGRAM_RHYTHM 0x80000000u
+
+/// Channel 10, percussion, has no melody.
+#define MIDI_NGRAM_DRUMS 9
+
+/**
+In an index of at least `MIDI_NGRAM_COMMON_FILES` files, n-grams found in more than
+1 / `MIDI_NGRAM_COMMON` of them rank nothing and are skipped by queries.
+Smaller indexes count every n-gram, a few copies of a piece there would be most of the files.
+*/
+#define MIDI_NGRAM_COMMON 2
+#define MIDI_NGRAM_COMMON_FILES 64
+
+#define MIDI_NGRAM_ALIGN(n) (((n) + 7) & ~(uint64_t) 7)
+
+
+enum MIDI_NgramSection
+{
+	NgramFiles,
+	NgramDictionary,
+	NgramPostings,
+	NgramPaths,
+	NgramSectionCount
+};
+
+struct midi_ngram_header
+{
+	char magic[4];
+	uint32_t version;
+
+	uint32_t length, file_count;
+
+	uint64_t gram_count;
+	uint64_t postings_size;
+	uint64_t paths_size;
+
+	// Byte offsets of the sections from the start of the file.
+	uint64_t offsets[NgramSectionCount];
+};
+
+struct midi_ngram_file
+{
+	// Offset of the path in the paths section.
+	uint64_t path;
+	// Distinct n-grams of the file.
+	uint32_t gram_count;
+	uint32_t reserved;
+};
+
+struct midi_ngram_entry
+{
+	uint32_t gram;
+	// Files the n-gram appears in.
+	uint32_t count;
+	// Offset of its posting list in the postings section.
+	uint64_t offset;
+};
+
+/// Melody of a channel.
+struct midi_ngram_voice
+{
+	// Last onsets, oldest first.
+	uint8_t pitches[MIDI_NGRAM_LENGTH];
+	uint32_t onsets[MIDI_NGRAM_LENGTH];
+	uint8_t count;
+
+	// Onset being collected, -1 before the first note: notes starting together keep the highest.
+	int16_t pending;
+	uint32_t pending_tick;
+};
+
+/// N-grams of one file.
+struct midi_ngram
+{
+	struct midi_ngram_voice voices[16];
+
+	// Sorted and distinct once `midi_ngram_end` returned.
+	uint32_t *grams;
+	size_t count, capacity;
+};
+
+/// Occurrence of an n-gram in a file.
+struct midi_ngram_posting
+{
+	uint32_t gram, file;
+};
+
+/// Postings gathered by one thread, sorted by n-gram then file before they are merged.
+struct midi_ngram_run
+{
+	struct midi_ngram_posting *postings;
+	size_t count, capacity;
+};
+
+/// A mapped index file, all pointers point into the mapping.
+struct midi_ngram_index
+{
+	const struct midi_ngram_header *header;
+	size_t size;
+
+	const struct midi_ngram_file *files;
+	const struct midi_ngram_entry *dictionary;
+	const uint8_t *postings;
+	const char *paths;
+};
+
+/// File of a query result.
+struct midi_ngram_match
+{
+	uint32_t file;
+	// Distinct n-grams it shares with the query.
+	uint32_t shared;
+};
+
+
+static inline struct midi_ngram *midi_ngram_new(struct midi_ngram *self)
+{
+	if (!self)
+		self = (struct midi_ngram *) malloc(sizeof(struct midi_ngram));
+
+	for (uint8_t channel = 0; channel < 16; ++channel) {
+		self->voices[channel].count = 0;
+		self->voices[channel].pending = -1;
+	}
+
+	self->grams = NULL;
+	self->count = self->capacity = 0;
+
+	return self;
+}
+
+static inline void midi_ngram_free(struct midi_ngram *self)
+{
+	free(self->grams);
+	self->grams = NULL;
+	self->count = self->capacity = 0;
+}
+
+static inline struct midi_ngram *midi_ngram_append(struct midi_ngram *self, uint32_t gram)
+{
+	if (self->count == self->capacity) {
+		size_t capacity = self->capacity ? self->capacity * 2 : 256;
+		uint32_t *grams = (uint32_t *) realloc(self->grams, capacity * sizeof(uint32_t));
+
+		if (!grams) {
+			midi_status = MIDI_OutOfMemory;
+			return NULL;
+		}
+
+		self->grams = grams;
+		self->capacity = capacity;
+	}
+
+	self->grams[self->count++] = gram;
+	return self;
+}
+
+/// Interval from pitch `from` to pitch `to`, as 6 bits.
+static inline uint32_t midi_ngram_interval(uint8_t from, uint8_t to)
+{
+	int interval = MIDI_MAX(MIDI_MIN((int) to - from, MIDI_NGRAM_INTERVAL), -MIDI_NGRAM_INTERVAL);
+
+	return (uint32_t) (interval + MIDI_NGRAM_INTERVAL);
+}
+
+/// Ratio of inter onset interval `next` to `previous` rounded to a half power of 2, as 4 bits, 4 for equal ones.
+static inline uint32_t midi_ngram_ratio(uint32_t previous, uint32_t next)
+{
+	// 2 ^ (k / 2 - 7 / 4) * 1000, the bounds between the ratios 1/4, 1/2^1.5, ... 4.
+	static const uint16_t bounds[8] = { 297, 420, 595, 841, 1189, 1682, 2378, 3364 };
+	uint32_t code = 0;
+
+	while (code < 8 && (uint64_t) next * 1000 >= (uint64_t) previous * bounds[code])
+		++code;
+
+	return code;
+}
+
+/// Add the pending onset of `voice` to its melody, and the n-grams it completes.
+static inline struct midi_ngram *midi_ngram_commit(struct midi_ngram *self, struct midi_ngram_voice *voice)
+{
+	uint32_t pitch = 0, rhythm = MIDI_NGRAM_RHYTHM;
+
+	if (voice->pending < 0)
+		return self;
+
+	if (voice->count == MIDI_NGRAM_LENGTH) {
+		memmove(voice->pitches, voice->pitches + 1, MIDI_NGRAM_LENGTH - 1);
+		memmove(voice->onsets, voice->onsets + 1, (MIDI_NGRAM_LENGTH - 1) * sizeof(uint32_t));
+		--voice->count;
+	}
+
+	voice->pitches[voice->count] = (uint8_t) voice->pending;
+	voice->onsets[voice->count] = voice->pending_tick;
+	++voice->count;
+	voice->pending = -1;
+
+	if (voice->count < MIDI_NGRAM_LENGTH)
+		return self;
+
+	for (uint8_t i = 1; i < MIDI_NGRAM_LENGTH; ++i)
+		pitch |= midi_ngram_interval(voice->pitches[i - 1], voice->pitches[i]) << 6 * (i - 1);
+
+	for (uint8_t i = 2; i < MIDI_NGRAM_LENGTH; ++i)
+		rhythm |= midi_ngram_ratio(voice->onsets[i - 1] - voice->onsets[i - 2], voice->onsets[i] - voice->onsets[i - 1]) << 4 * (i - 2);
+
+	if (!midi_ngram_append(self, pitch) || !midi_ngram_append(self, rhythm))
+		return NULL;
+
+	return self;
+}
+
+/// Close the pending onsets and forget the melodies, before the next sequence of a format 2 file.
+static inline struct midi_ngram *midi_ngram_reset(struct midi_ngram *self)
+{
+	for (uint8_t channel = 0; channel < 16; ++channel) {
+		if (!midi_ngram_commit(self, self->voices + channel))
+			return NULL;
+		self->voices[channel].count = 0;
+	}
+
+	return self;
+}
+
+/**
+Add `message` to the melody of its channel, in the decode loop.
+Messages must come in time order, as `midi_merge_next` returns them.
+*/
+static inline struct midi_ngram *midi_ngram_message(struct midi_ngram *self, const struct midi_message *message)
+{
+	uint8_t channel = message->status & 0x0F;
+	struct midi_ngram_voice *voice = self->voices + channel;
+
+	if ((message->status & 0xF0) != EventNoteOn || message->size < 2 || !message->data[1] || channel == MIDI_NGRAM_DRUMS)
+		return self;
+
+	if (voice->pending >= 0 && voice->pending_tick == message->timestamp) {
+		voice->pending = MIDI_MAX(voice->pending, (int16_t) message->data[0]);
+		return self;
+	}
+
+	if (!midi_ngram_commit(self, voice))
+		return NULL;
+
+	voice->pending = message->data[0];
+	voice->pending_tick = message->timestamp;
+	return self;
+}
+
+static int midi_ngram_compare(const void *a, const void *b)
+{
+	uint32_t x = * (const uint32_t *) a, y = * (const uint32_t *) b;
+
+	return (x > y) - (x < y);
+}
+
+/// Close the melodies and leave the distinct n-grams of the file sorted in `grams`.
+static inline struct midi_ngram *midi_ngram_end(struct midi_ngram *self)
+{
+	size_t count = 0;
+
+	if (!midi_ngram_reset(self))
+		return NULL;
+
+	if (self->count)
+		qsort(self->grams, self->count, sizeof(uint32_t), midi_ngram_compare);
+
+	for (size_t i = 0; i < self->count; ++i)
+		if (!count || self->grams[i] != self->grams[count - 1])
+			self->grams[count++] = self->grams[i];
+
+	self->count = count;
+	return self;
+}
+
+/**
+Collect the n-grams of the MIDI file in `data` into `self`, created with `midi_ngram_new`.
+Return `MIDI_Success` or the error that stopped it.
+*/
+static inline int midi_ngram_file(struct midi_ngram *self, const uint8_t *data, size_t size)
+{
+	struct midi_merge merge;
+	struct midi_message message;
+	uint16_t track = 0;
+
+	if (!midi_merge_new(&merge, data, size))
+		return midi_status;
+
+	while (midi_merge_next(&merge, &message)) {
+		// Sequences of a format 2 file each start from 0, they are separate melodies.
+		if (merge.header.format == 2 && message.track != track && !midi_ngram_reset(self))
+			break;
+		track = message.track;
+
+		if (!midi_ngram_message(self, &message))
+			break;
+	}
+
+	midi_merge_free(&merge);
+
+	if (midi_status != MIDI_Success || !midi_ngram_end(self))
+		return midi_status;
+
+	return midi_status = MIDI_Success;
+}
+
+
+static inline void midi_ngram_run_free(struct midi_ngram_run *self)
+{
+	free(self->postings);
+	self->postings = NULL;
+	self->count = self->capacity = 0;
+}
+
+/// Add the n-grams of file number `file` to the run.
+static inline struct midi_ngram_run *midi_ngram_run_add(struct midi_ngram_run *self, const struct midi_ngram *ngram, uint32_t file)
+{
+	if (self->count + ngram->count > self->capacity) {
+		size_t capacity = MIDI_MAX(self->capacity * 2, self->count + ngram->count);
+		struct midi_ngram_posting *postings = (struct midi_ngram_posting *) realloc(self->postings, capacity * sizeof(struct midi_ngram_posting));
+
+		if (!postings) {
+			midi_status = MIDI_OutOfMemory;
+			return NULL;
+		}
+
+		self->postings = postings;
+		self->capacity = capacity;
+	}
+
+	for (size_t i = 0; i < ngram->count; ++i) {
+		self->postings[self->count].gram = ngram->grams[i];
+		self->postings[self->count].file = file;
+		++self->count;
+	}
+
+	return self;
+}
+
+static int midi_ngram_posting_compare(const void *a, const void *b)
+{
+	const struct midi_ngram_posting *x = (const struct midi_ngram_posting *) a, *y = (const struct midi_ngram_posting *) b;
+
+	if (x->gram != y->gram)
+		return x->gram < y->gram ? -1 : 1;
+	return (x->file > y->file) - (x->file < y->file);
+}
+
+/// Sort the run for `midi_ngram_index_write`, on the thread that filled it.
+static inline void midi_ngram_run_sort(struct midi_ngram_run *self)
+{
+	if (self->count)
+		qsort(self->postings, self->count, sizeof(struct midi_ngram_posting), midi_ngram_posting_compare);
+}
+
+/// Lay out the sections after the header, return the total file size.
+static inline uint64_t midi_ngram_layout(struct midi_ngram_header *header)
+{
+	const uint64_t sizes[NgramSectionCount] = {
+		[NgramFiles] = header->file_count * sizeof(struct midi_ngram_file),
+		[NgramDictionary] = header->gram_count * sizeof(struct midi_ngram_entry),
+		[NgramPostings] = header->postings_size,
+		[NgramPaths] = header->paths_size
+	};
+	uint64_t offset = MIDI_NGRAM_ALIGN(sizeof(struct midi_ngram_header));
+
+	for (size_t section = 0; section < NgramSectionCount; ++section) {
+		header->offsets[section] = offset;
+		offset = MIDI_NGRAM_ALIGN(offset + sizes[section]);
+	}
+
+	return offset;
+}
+
+/// Write the sections laid out in `header`, zero padded up to their aligned offsets.
+static inline void midi_ngram_sections_write(FILE *file, const struct midi_ngram_header *header, const struct midi_ngram_file *files,
+	const struct midi_ngram_entry *dictionary, const uint8_t *postings, const char *const *paths)
+{
+	static const uint8_t padding[8] = { 0 };
+	const void *sections[NgramSectionCount] = { files, dictionary, postings, NULL };
+	const uint64_t sizes[NgramSectionCount] = {
+		header->file_count * sizeof(struct midi_ngram_file),
+		header->gram_count * sizeof(struct midi_ngram_entry),
+		header->postings_size,
+		header->paths_size
+	};
+	uint64_t position = sizeof(*header);
+
+	fwrite(header, sizeof(*header), 1, file);
+
+	for (size_t section = 0; section < NgramSectionCount; ++section) {
+		fwrite(padding, 1, header->offsets[section] - position, file);
+
+		if (section == NgramPaths) {
+			for (uint32_t i = 0; i < header->file_count; ++i)
+				fwrite(paths[i], 1, strlen(paths[i]) + 1, file);
+		} else if (sizes[section]) {
+			fwrite(sections[section], 1, sizes[section], file);
+		}
+
+		position = header->offsets[section] + sizes[section];
+	}
+
+	fwrite(padding, 1, MIDI_NGRAM_ALIGN(position) - position, file);
+}
+
+/**
+Merge the sorted runs into one index and write it to `file`.
+`paths` and `gram_counts` describe the `file_count` files the postings number from 0,
+fewer than 2^28 so that any difference fits a variable length value.
+Every run is read once, the n-gram and file in front of each run being compared to pick the next posting.
+Return the number of distinct n-grams written, with `midi_status` set on failure.
+*/
+static inline uint64_t midi_ngram_index_write(FILE *file, const char *const *paths, const uint32_t *gram_counts, uint32_t file_count, const struct midi_ngram_run *runs, size_t run_count)
+{
+	struct midi_ngram_header header;
+	struct midi_ngram_file *files;
+	struct midi_ngram_entry *dictionary = NULL;
+	uint8_t *postings = NULL;
+	size_t *positions, dictionary_capacity = 0, postings_capacity = 0;
+	uint32_t previous = 0;
+
+	if (file_count > 0x0FFFFFFF) {
+		midi_status = MIDI_Unimplemented;
+		return 0;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, MIDI_NGRAM_MAGIC, 4);
+	header.version = MIDI_NGRAM_VERSION;
+	header.length = MIDI_NGRAM_LENGTH;
+	header.file_count = file_count;
+
+	files = (struct midi_ngram_file *) calloc(file_count + 1, sizeof(struct midi_ngram_file));
+	positions = (size_t *) calloc(run_count + 1, sizeof(size_t));
+	if (!files || !positions)
+		goto out_of_memory;
+
+	for (uint32_t i = 0; i < file_count; ++i) {
+		files[i].path = header.paths_size;
+		files[i].gram_count = gram_counts[i];
+		header.paths_size += strlen(paths[i]) + 1;
+	}
+
+	for (;;) {
+		const struct midi_ngram_posting *next = NULL;
+		size_t best = 0;
+
+		for (size_t run = 0; run < run_count; ++run) {
+			const struct midi_ngram_posting *posting = runs[run].postings + positions[run];
+
+			if (positions[run] < runs[run].count && (!next || midi_ngram_posting_compare(posting, next) < 0)) {
+				next = posting;
+				best = run;
+			}
+		}
+
+		if (!next)
+			break;
+		++positions[best];
+
+		// A new n-gram starts a posting list, its first file is stored as is.
+		if (!header.gram_count || dictionary[header.gram_count - 1].gram != next->gram) {
+			if (header.gram_count == dictionary_capacity) {
+				struct midi_ngram_entry *entries;
+
+				dictionary_capacity = dictionary_capacity ? dictionary_capacity * 2 : 4096;
+				if (!(entries = (struct midi_ngram_entry *) realloc(dictionary, dictionary_capacity * sizeof(struct midi_ngram_entry))))
+					goto out_of_memory;
+				dictionary = entries;
+			}
+
+			dictionary[header.gram_count].gram = next->gram;
+			dictionary[header.gram_count].count = 0;
+			dictionary[header.gram_count].offset = header.postings_size;
+			++header.gram_count;
+			previous = 0;
+		}
+
+		if (header.postings_size + 4 > postings_capacity) {
+			uint8_t *bytes;
+
+			postings_capacity = postings_capacity ? postings_capacity * 2 : 1 << 16;
+			if (!(bytes = (uint8_t *) realloc(postings, postings_capacity)))
+				goto out_of_memory;
+			postings = bytes;
+		}
+
+		header.postings_size += midi_value_encode(postings + header.postings_size, next->file - previous);
+		++dictionary[header.gram_count - 1].count;
+		previous = next->file;
+	}
+
+	midi_ngram_layout(&header);
+	midi_ngram_sections_write(file, &header, files, dictionary, postings, paths);
+
+	free(files);
+	free(dictionary);
+	free(postings);
+	free(positions);
+
+	if (ferror(file)) {
+		midi_status = MIDI_WriteFailed;
+		return 0;
+	}
+
+	midi_status = MIDI_Success;
+	return header.gram_count;
+
+out_of_memory:
+	free(files);
+	free(dictionary);
+	free(postings);
+	free(positions);
+	midi_status = MIDI_OutOfMemory;
+	return 0;
+}
+
+
+/**
+Map the index file at `path` and point the sections into it.
+Nothing is read past the header checks. Release it with `midi_ngram_close`.
+*/
+static inline struct midi_ngram_index *midi_ngram_open(struct midi_ngram_index *self, const char *path)
+{
+	struct stat status;
+	void *data;
+	int file = open(path, O_RDONLY);
+
+	if (file < 0) {
+		midi_status = MIDI_InvalidHeaderChunk;
+		return NULL;
+	}
+
+	if (fstat(file, &status) || (size_t) status.st_size < sizeof(struct midi_ngram_header)) {
+		close(file);
+		midi_status = MIDI_InvalidHeaderChunk;
+		return NULL;
+	}
+
+	data = mmap(NULL, status.st_size, PROT_READ, MAP_SHARED, file, 0);
+	close(file);
+
+	if (data == MAP_FAILED) {
+		midi_status = MIDI_OutOfMemory;
+		return NULL;
+	}
+
+	const struct midi_ngram_header *header = (const struct midi_ngram_header *) data;
+	struct midi_ngram_header expected = *header;
+
+	// A foreign byte order shows as another version.
+	// The sections must sit where the writer puts them, which also keeps them inside the file.
+	// Sizes are bounded first so that the layout can not overflow.
+	if (memcmp(header->magic, MIDI_NGRAM_MAGIC, 4) || header->version != MIDI_NGRAM_VERSION
+	|| header->length != MIDI_NGRAM_LENGTH
+	|| header->gram_count > (uint64_t) status.st_size || header->postings_size > (uint64_t) status.st_size
+	|| header->paths_size > (uint64_t) status.st_size
+	|| midi_ngram_layout(&expected) > (uint64_t) status.st_size
+	|| memcmp(expected.offsets, header->offsets, sizeof(expected.offsets))
+	|| (header->paths_size && ((const char *) data)[header->offsets[NgramPaths] + header->paths_size - 1])) {
+		munmap(data, status.st_size);
+		midi_status = MIDI_InvalidHeaderChunk;
+		return NULL;
+	}
+
+	if (!self)
+		self = (struct midi_ngram_index *) malloc(sizeof(struct midi_ngram_index));
+
+	const uint8_t *base = (const uint8_t *) data;
+
+	self->header = header;
+	self->size = status.st_size;
+	self->files = (const struct midi_ngram_file *) (base + header->offsets[NgramFiles]);
+	self->dictionary = (const struct midi_ngram_entry *) (base + header->offsets[NgramDictionary]);
+	self->postings = base + header->offsets[NgramPostings];
+	self->paths = (const char *) (base + header->offsets[NgramPaths]);
+
+	midi_status = MIDI_Success;
+	return self;
+}
+
+static inline void midi_ngram_close(struct midi_ngram_index *self)
+{
+	if (self->header) {
+		munmap((void *) self->header, self->size);
+		self->header = NULL;
+	}
+}
+
+/// Path of file number `file`, NULL if the index does not hold it.
+static inline const char *midi_ngram_path(const struct midi_ngram_index *self, uint32_t file)
+{
+	if (file >= self->header->file_count || self->files[file].path >= self->header->paths_size)
+		return NULL;
+
+	return self->paths + self->files[file].path;
+}
+
+/// Dictionary entry of `gram`, found by binary search, NULL if no file has it.
+static inline const struct midi_ngram_entry *midi_ngram_lookup(const struct midi_ngram_index *self, uint32_t gram)
+{
+	uint64_t low = 0, high = self->header->gram_count;
+
+	while (low < high) {
+		uint64_t middle = low + (high - low) / 2;
+
+		if (self->dictionary[middle].gram < gram)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	return low < self->header->gram_count && self->dictionary[low].gram == gram ? self->dictionary + low : NULL;
+}
+
+static int midi_ngram_match_compare(const void *a, const void *b)
+{
+	const struct midi_ngram_match *x = (const struct midi_ngram_match *) a, *y = (const struct midi_ngram_match *) b;
+
+	if (x->shared != y->shared)
+		return x->shared > y->shared ? -1 : 1;
+	return (x->file > y->file) - (x->file < y->file);
+}
+
+/**
+Rank the files of the index by the distinct n-grams they share with `query`, as `midi_ngram_end` left them.
+Only the posting lists of the query n-grams are decoded, each checked against the end of the postings
+and for file numbers increasing within it.
+Fill `matches` with at most `limit` files, most similar first, and return how many.
+Return 0 with `midi_status` set on failure.
+*/
+static inline size_t midi_ngram_query(const struct midi_ngram_index *self, const struct midi_ngram *query, struct midi_ngram_match *matches, size_t limit)
+{
+	const struct midi_ngram_header *header = self->header;
+	const uint8_t *end = self->postings + header->postings_size;
+	uint32_t *shared = (uint32_t *) calloc(header->file_count + 1, sizeof(uint32_t));
+	struct midi_ngram_match *candidates;
+	size_t count = 0;
+
+	if (!shared) {
+		midi_status = MIDI_OutOfMemory;
+		return 0;
+	}
+
+	for (size_t i = 0; i < query->count; ++i) {
+		const struct midi_ngram_entry *entry = midi_ngram_lookup(self, query->grams[i]);
+		uint32_t file = 0, delta;
+
+		if (!entry || entry->offset > header->postings_size
+		|| (header->file_count >= MIDI_NGRAM_COMMON_FILES && entry->count > header->file_count / MIDI_NGRAM_COMMON))
+			continue;
+
+		const uint8_t *position = self->postings + entry->offset;
+
+		for (uint32_t j = 0; j < entry->count; ++j) {
+			size_t used = midi_value_decode(position, end, &delta);
+
+			// A repeated file would be counted twice for the same n-gram.
+			if (!used || (j && !delta) || delta >= header->file_count - file) {
+				free(shared);
+				midi_status = MIDI_PotentialBufferOverflow;
+				return 0;
+			}
+
+			position += used;
+			file += delta;
+			++shared[file];
+		}
+	}
+
+	for (uint32_t file = 0; file < header->file_count; ++file)
+		count += shared[file] > 0;
+
+	if (!(candidates = (struct midi_ngram_match *) malloc((count + 1) * sizeof(struct midi_ngram_match)))) {
+		free(shared);
+		midi_status = MIDI_OutOfMemory;
+		return 0;
+	}
+
+	count = 0;
+	for (uint32_t file = 0; file < header->file_count; ++file) {
+		if (shared[file]) {
+			candidates[count].file = file;
+			candidates[count].shared = shared[file];
+			++count;
+		}
+	}
+
+	qsort(candidates, count, sizeof(struct midi_ngram_match), midi_ngram_match_compare);
+
+	count = MIDI_MIN(count, limit);
+	memcpy(matches, candidates, count * sizeof(struct midi_ngram_match));
+
+	free(candidates);
+	free(shared);
+
+	midi_status = MIDI_Success;
+	return count;
+}
+
+
+#endif /* MIDI_NGRAM_H */
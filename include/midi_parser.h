@@ -5,8 +5,16 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 
+#ifdef __SSE2__
+	#include <emmintrin.h>
+#endif
+#ifdef __BMI2__
+	#include <immintrin.h>
+#endif
+
 
 #define MIDI_META_EVENT 3
 #define MIDI_SYSEX_EVENT
@@ -17,6 +25,12 @@
 #define MIDI_HEADER_SIZE 14
 #define MIDI_TRACK_HEADER_SIZE 8
 
+/// Size of the `RIFF` header of an `.rmi` file, with its `RMID` form type.
+#define MIDI_RIFF_HEADER_SIZE 12
+
+/// Most `LIST INFO` entries kept by `midi_riff_new`.
+#define MIDI_RIFF_INFO 16
+
 /// Return minimum of two 32 bit unsigned integers.
 #define MIDI_MIN(x, y) ((x) <= (y) ? (x) : (y))
 
@@ -26,10 +40,24 @@
 #define MIDI_EVENT_TYPE(midi_event) ((midi_event)->status & 0xF0)
 #define MIDI_EVENT_CHANNEL(midi_event) ((midi_event)->status & 0x0F)
 
-#define MIDI_DELAY(midi_parser) (((midi_parser)->dtime * (midi_parser)->us_per_tick))
+/// Micro seconds from the current event to the next one, exact across tempo changes, 0 after the last one.
+#define MIDI_DELAY(midi_parser) \
+	((midi_parser)->end_of_file || (midi_parser)->dtime == (uint32_t) ~0 ? 0 \
+	: midi_clock_us(&(midi_parser)->clock, (midi_parser)->timestamp + (midi_parser)->dtime) \
+	- midi_clock_us(&(midi_parser)->clock, (midi_parser)->timestamp))
+
+/// Absolute time of the current event in micro seconds.
+#define MIDI_TIME(midi_parser) (midi_clock_us(&(midi_parser)->clock, (midi_parser)->timestamp))
 
 
-static uint8_t midi_status;
+#ifdef __cplusplus
+	#define MIDI_THREAD_LOCAL thread_local
+#else
+	#define MIDI_THREAD_LOCAL _Thread_local
+#endif
+
+/// Status of the last call, one per thread so that decoders on different threads never see each other's.
+static MIDI_THREAD_LOCAL uint8_t midi_status;
 
 
 enum MIDI_EventType
@@ -70,7 +98,10 @@ enum
 	MIDI_InvalidTrackChunk,
 	MIDI_PotentialBufferOverflow,
 	MIDI_NoCaseMatch,
-	MIDI_Unimplemented
+	MIDI_Unimplemented,
+	MIDI_InvalidEvent,
+	MIDI_OutOfMemory,
+	MIDI_WriteFailed
 };
 
 
@@ -137,6 +168,29 @@ struct midi_track
 };
 
 
+/**
+Tick to micro second conversion.
+Time is computed from the last tempo change instead of being summed per event,
+so integer rounding never accumulates.
+*/
+struct midi_clock
+{
+	// 0 with SMPTE time division.
+	uint32_t ticks_per_quarter;
+
+	// In micro seconds per quarter note
+	uint32_t tempo;
+
+	// Micro seconds per tick as the exact fraction `scale / divisor`:
+	// `tempo / ticks_per_quarter`, or fixed by the frame rate with SMPTE time division.
+	uint64_t scale, divisor;
+
+	// Tick and absolute time in micro seconds of the last tempo change.
+	uint32_t tick;
+	uint64_t us;
+};
+
+
 struct midi_parser
 {
 	uint16_t format, track_count, time_division, active_track_count;
@@ -149,6 +203,8 @@ struct midi_parser
 
 	uint8_t end_of_file;
 
+	struct midi_clock clock;
+
 	#ifdef MIDI_TRACKS_ON_HEAP
 		struct midi_track *tracks;
 	#else
@@ -157,15 +213,15 @@ struct midi_parser
 };
 
 
-static struct midi_event *midi_event_new(struct midi_event *self, FILE *midi, uint8_t *running_status);
+static inline struct midi_event *midi_event_new(struct midi_event *self, FILE *midi, uint8_t *running_status);
 
-static struct midi_track *midi_track_new(struct midi_track *self, FILE *midi, size_t track_number);
+static inline struct midi_track *midi_track_new(struct midi_track *self, FILE *midi, size_t track_number);
 
-static struct midi_parser *midi_parser_new(struct midi_parser *self, FILE *midi);
+static inline struct midi_parser *midi_parser_new(struct midi_parser *self, FILE *midi);
 
-static struct midi_event *midi_track_next(struct midi_track *self, FILE *midi, struct midi_event *event);
+static inline struct midi_event *midi_track_next(struct midi_track *self, FILE *midi, struct midi_event *event);
 
-static struct midi_event *midi_parser_next(struct midi_parser *self, FILE *midi, struct midi_event *event);
+static inline struct midi_event *midi_parser_next(struct midi_parser *self, FILE *midi, struct midi_event *event);
 
 
 /// Reverse the bytes of a 16 bit unsigned integer.
@@ -180,36 +236,185 @@ static inline uint32_t reverse32(uint32_t n)
 	return (n << 24 & 0xFF000000) | (n << 8 & 0x00FF0000) | (n >> 8 & 0x0000FF00) | (n >> 24 & 0x000000FF);
 }
 
-/// Read multi byte value from the MIDI file.
-static uint32_t midi_value_read(FILE *midi)
+/**
+Read multi byte value from the MIDI file, of at most 4 bytes.
+A value cut by the end of the file or longer than 4 bytes sets `midi_status`.
+*/
+static inline uint32_t midi_value_read(FILE *midi)
 {
-	uint8_t buffer = 0x80;
+	int buffer = 0x80;
 	uint32_t value = 0;
 
-	while (buffer & 0x80) {
-		buffer = getc(midi);
+	for (uint8_t count = 0; count < 4 && buffer & 0x80; ++count) {
+		if ((buffer = getc(midi)) == EOF) {
+			midi_status = MIDI_PotentialBufferOverflow;
+			return value;
+		}
 		value = value << 7 | (buffer & 0x7F);
 	}
 
+	if (buffer & 0x80)
+		midi_status = MIDI_PotentialBufferOverflow;
+
 	return value;
 }
 
-/// Read multi byte value from the MIDI file.
-static uint32_t midi_value_peek(FILE *midi)
+/// Read multi byte value from the MIDI file and go back to where it started.
+static inline uint32_t midi_value_peek(FILE *midi)
 {
-	uint8_t count = 0;
-	uint8_t buffer = 0x80;
-	uint32_t value = 0;
+	long position = ftell(midi);
+	uint32_t value = midi_value_read(midi);
 
-	while (buffer & 0x80) {
-		buffer = getc(midi);
-		value = value << 7 | (buffer & 0x7F);
-		++count;
+	fseek(midi, position, SEEK_SET);
+
+	return value;
+}
+
+/**
+Decode a multi byte value from memory one byte at a time, reading nothing at or past `end`.
+Return the number of bytes used, 0 if the value is truncated or longer than 4 bytes.
+*/
+static inline size_t midi_value_decode_scalar(const uint8_t *data, const uint8_t *end, uint32_t *value)
+{
+	uint32_t result = 0;
+	size_t limit = MIDI_MIN((size_t) (end - data), 4);
+
+	for (size_t i = 0; i < limit; ++i) {
+		result = result << 7 | (data[i] & 0x7F);
+		if (!(data[i] & 0x80)) {
+			*value = result;
+			return i + 1;
+		}
 	}
 
-	fseek(midi, -1 * count, SEEK_CUR);
+	return 0;
+}
 
-	return value;
+/**
+Decode a multi byte value from memory without a data dependent loop.
+Where 8 bytes can be loaded, the terminator is found with a mask and a count of
+trailing zeros and the 7 bit groups are compacted with shifts, or `pext` with BMI2.
+Closer to `end` it falls back to `midi_value_decode_scalar`.
+*/
+static inline size_t midi_value_decode_branchless(const uint8_t *data, const uint8_t *end, uint32_t *value)
+{
+	if (end - data < 8)
+		return midi_value_decode_scalar(data, end, value);
+
+	// Most delta times fit in a byte, keep that case predictable for the branch predictor
+	// instead of making the next read wait on the mask.
+	if (!(data[0] & 0x80)) {
+		*value = data[0];
+		return 1;
+	}
+
+	uint64_t word;
+	uint32_t terminators;
+
+	memcpy(&word, data, sizeof(word));
+
+	#ifdef __SSE2__
+		terminators = ~_mm_movemask_epi8(_mm_cvtsi64_si128((long long) word)) & 0x0F;
+	#else
+		uint64_t high = ~word & 0x80808080;
+		// Gather the 4 high bits in the low nibble.
+		terminators = (uint32_t) ((high >> 7 | high >> 14 | high >> 21 | high >> 28) & 0x0F);
+	#endif
+
+	if (!terminators)
+		return 0;
+
+	size_t size = __builtin_ctz(terminators) + 1;
+
+	// Big endian value of the `size` bytes, first byte in the highest position.
+	uint32_t bytes = (uint32_t) (__builtin_bswap64(word) >> (64 - 8 * size));
+
+	#ifdef __BMI2__
+		*value = _pext_u32(bytes, 0x7F7F7F7F);
+	#else
+		*value = (bytes & 0x7F) | (bytes >> 1 & 0x3F80) | (bytes >> 2 & 0x1FC000) | (bytes >> 3 & 0xFE00000);
+	#endif
+
+	return size;
+}
+
+/**
+Decode a multi byte value from memory, with the scalar loop unless `MIDI_VALUE_BRANCHLESS` is defined.
+The branchless decoder waits on its mask where the loop predicts the common one byte value,
+and loses to it in `make bench`.
+*/
+static inline size_t midi_value_decode(const uint8_t *data, const uint8_t *end, uint32_t *value)
+{
+	#ifdef MIDI_VALUE_BRANCHLESS
+		return midi_value_decode_branchless(data, end, value);
+	#else
+		return midi_value_decode_scalar(data, end, value);
+	#endif
+}
+
+
+/**
+Set up the clock for the `time_division` of a header.
+With the top bit set, the high byte is minus the frames per second, 24, 25, 29 or 30, 29 standing
+for 29.97 drop frame, 30000 / 1001 frames per second, and the low byte the ticks per frame.
+Return NULL if the division has no ticks or another frame rate.
+*/
+static inline struct midi_clock *midi_clock_new(struct midi_clock *self, uint16_t time_division)
+{
+	// Default initial tempo is 120 BPM.
+	self->tempo = 60E6 / 120;
+	self->tick = 0;
+	self->us = 0;
+
+	if (time_division & 0x8000) {
+		uint32_t frames = (uint8_t) -(int8_t) (time_division >> 8), ticks_per_frame = time_division & 0xFF;
+
+		if ((frames != 24 && frames != 25 && frames != 29 && frames != 30) || !ticks_per_frame)
+			return NULL;
+
+		self->ticks_per_quarter = 0;
+		self->scale = 1000000 * (frames == 29 ? 1001 : 1000);
+		self->divisor = (uint64_t) (frames == 29 ? 30000 : frames * 1000) * ticks_per_frame;
+		return self;
+	}
+
+	if (!time_division)
+		return NULL;
+
+	self->ticks_per_quarter = time_division;
+	self->scale = self->tempo;
+	self->divisor = time_division;
+	return self;
+}
+
+/// Absolute time in micro seconds of `tick`, which must not precede the last tempo change.
+static inline uint64_t midi_clock_us(const struct midi_clock *self, uint32_t tick)
+{
+	return self->us + (uint64_t) (tick - self->tick) * self->scale / self->divisor;
+}
+
+/// First tick at or after the absolute time `us`, which must not precede the last tempo change.
+static inline uint32_t midi_clock_tick(const struct midi_clock *self, uint64_t us)
+{
+	return self->tick + (uint32_t) (((us - self->us) * self->divisor + self->scale - 1) / self->scale);
+}
+
+/**
+Apply a tempo change happening at `tick`, tempo changes have no effect with SMPTE time division.
+A tempo of 0 would stop the clock and leave `midi_clock_tick` nothing to divide by, it counts as 1.
+*/
+static inline void midi_clock_tempo(struct midi_clock *self, uint32_t tick, uint32_t tempo)
+{
+	if (!self->ticks_per_quarter)
+		return;
+
+	if (!tempo)
+		tempo = 1;
+
+	self->us = midi_clock_us(self, tick);
+	self->tick = tick;
+	self->tempo = tempo;
+	self->scale = tempo;
 }
 
 
@@ -223,10 +428,18 @@ static inline void midi_parser_free(struct midi_parser *self)
 }
 #endif
 
+/// Apply a tempo change happening at the current timestamp.
+static inline void midi_parser_tempo(struct midi_parser *self, uint32_t tempo)
+{
+	midi_clock_tempo(&self->clock, self->timestamp, tempo);
+	if (self->ticks_per_quarter)
+		self->us_per_tick = tempo / self->ticks_per_quarter;
+}
+
 /**
 Update parser state according to the event emitted.
 */
-static void midi_parser_update(struct midi_parser *self, struct midi_event *event)
+static inline void midi_parser_update(struct midi_parser *self, struct midi_event *event)
 {
 	switch (event->status & 0xF0) {
 	case EventSystemExclusive:
@@ -234,7 +447,7 @@ static void midi_parser_update(struct midi_parser *self, struct midi_event *even
 		case 0xFF:
 			switch (event->meta_type) {
 			case MetaSetTempo:
-				self->us_per_tick = event->meta_data.tempo / self->ticks_per_quarter;
+				midi_parser_tempo(self, event->meta_data.tempo);
 				break;
 			}
 		}
@@ -242,12 +455,40 @@ static void midi_parser_update(struct midi_parser *self, struct midi_event *even
 }
 
 
-static struct midi_header *midi_header_new(struct midi_header *self, FILE *midi)
+/**
+Skip the `RIFF` header of an `.rmi` file, whose magic was just read, and the chunks
+before its `data` chunk. Leave `midi` at the start of the standard MIDI file it holds.
+*/
+static inline uint8_t midi_riff_skip(FILE *midi)
+{
+	uint32_t buffer32, size;
+
+	// RIFF sizes are little endian, like the host.
+	if (fread(&buffer32, 4, 1, midi) != 1 || fread(&buffer32, 4, 1, midi) != 1 || buffer32 != * (uint32_t *) "RMID")
+		return 0;
+
+	while (fread(&buffer32, 4, 1, midi) == 1 && fread(&size, 4, 1, midi) == 1) {
+		if (buffer32 == * (uint32_t *) "data")
+			return 1;
+
+		// Chunks are padded to an even size.
+		if (fseek(midi, size + (size & 1), SEEK_CUR))
+			break;
+	}
+
+	return 0;
+}
+
+/// Read the header chunk, at the current position or inside the RIFF container of an `.rmi` file.
+static inline struct midi_header *midi_header_new(struct midi_header *self, FILE *midi)
 {
 	uint16_t buffer16;
 	uint32_t buffer32;
 
 	fread(&buffer32, 4, 1, midi);
+	if (buffer32 == * (uint32_t *) "RIFF" && midi_riff_skip(midi))
+		fread(&buffer32, 4, 1, midi);
+
 	if (buffer32 !=  * (uint32_t *) "MThd") {
 		midi_status = MIDI_InvalidHeaderChunk;
 		return NULL;
@@ -268,7 +509,7 @@ static struct midi_header *midi_header_new(struct midi_header *self, FILE *midi)
 	return self;
 }
 
-static struct midi_event *midi_event_midi_new(struct midi_event *self, FILE *midi, uint8_t status)
+static inline struct midi_event *midi_event_midi_new(struct midi_event *self, FILE *midi, uint8_t status)
 {
 	if (!self)
 		self = (struct midi_event *) malloc(sizeof(struct midi_event));
@@ -292,19 +533,25 @@ static struct midi_event *midi_event_midi_new(struct midi_event *self, FILE *mid
 		return NULL;
 	}
 
-	fread(self->midi_data, 1, self->size, midi);
+	if (fread(self->midi_data, 1, self->size, midi) != self->size) {
+		midi_status = MIDI_PotentialBufferOverflow;
+		return NULL;
+	}
 
 	midi_status = MIDI_Success;
 	return self;
 }
 
 
-static struct midi_event *midi_event_sysex_new(struct midi_event *self, FILE *midi)
+static inline struct midi_event *midi_event_sysex_new(struct midi_event *self, FILE *midi)
 {
 	if (!self)
 		self = (struct midi_event *) malloc(sizeof(struct midi_event));
 
+	midi_status = MIDI_Success;
 	self->size = midi_value_read(midi);
+	if (midi_status != MIDI_Success)
+		return NULL;
 
 	#ifdef MIDI_SYSEX_EVENT
 		// Read some bytes to the buffer and discard the rest of the bytes.
@@ -322,13 +569,18 @@ static struct midi_event *midi_event_sysex_new(struct midi_event *self, FILE *mi
 	return self;
 }
 
-static struct midi_event *midi_event_meta_new(struct midi_event *self, FILE *midi)
+static inline struct midi_event *midi_event_meta_new(struct midi_event *self, FILE *midi)
 {
 	if (!self)
 		self = (struct midi_event *) malloc(sizeof(struct midi_event));
 
-	self->meta_type = MIDI_GETC(midi);
+	int meta_type = MIDI_GETC(midi);
+
+	midi_status = meta_type == EOF ? MIDI_PotentialBufferOverflow : MIDI_Success;
+	self->meta_type = (uint8_t) meta_type;
 	self->size = midi_value_read(midi);
+	if (midi_status != MIDI_Success)
+		return NULL;
 
 	switch (self->meta_type) {
 	#if MIDI_META_EVENT >= 1
@@ -413,7 +665,7 @@ static inline uint8_t midi_track_over(struct midi_track *self)
 }
 
 
-static struct midi_event *midi_event_new(struct midi_event *self, FILE *midi, uint8_t *running_status)
+static inline struct midi_event *midi_event_new(struct midi_event *self, FILE *midi, uint8_t *running_status)
 {
 	if (!self)
 		self = (struct midi_event *) malloc(sizeof(struct midi_event));
@@ -421,12 +673,25 @@ static struct midi_event *midi_event_new(struct midi_event *self, FILE *midi, ui
 	// All MIDI events contain a timecode, and a status byte.
 	// Delta time in "ticks" from the previous event.
 	// Could be 0 if two events happen simultaneously.
+	midi_status = MIDI_Success;
 	self->dtime = midi_value_read(midi);
+	if (midi_status != MIDI_Success)
+		return NULL;
+
 	// Read first byte of message, this could be the status byte, or not.
-	self->status = MIDI_GETC(midi);
+	int status = MIDI_GETC(midi);
+	if (status == EOF) {
+		midi_status = MIDI_PotentialBufferOverflow;
+		return NULL;
+	}
+	self->status = (uint8_t) status;
 
 	// Handle MIDI running status
 	if (self->status < 0x80) {
+		if (!*running_status) {
+			midi_status = MIDI_NoCaseMatch;
+			return NULL;
+		}
 		self->status = *running_status;
 		fseek(midi, -1, SEEK_CUR);
 	}
@@ -456,10 +721,16 @@ static struct midi_event *midi_event_new(struct midi_event *self, FILE *midi, ui
 		switch (self->status) {
 		case 0xF0: // System exclusive message begin
 		case 0xF7: // System exclusive message end
-			midi_event_sysex_new(self, midi);
+			if (!midi_event_sysex_new(self, midi))
+				return NULL;
 			break;
 		case 0xFF:
-			midi_event_meta_new(self, midi);
+			if (!midi_event_meta_new(self, midi))
+				return NULL;
+			break;
+		default:
+			midi_status = MIDI_NoCaseMatch;
+			return NULL;
 		}
 		break;
 
@@ -472,25 +743,48 @@ static struct midi_event *midi_event_new(struct midi_event *self, FILE *midi, ui
 	return self;
 }
 
-static struct midi_track *midi_track_new(struct midi_track *self, FILE *midi, size_t track_number)
+/// Seek `midi` from its start to the first chunk after the header, stepping over a RIFF container.
+static inline uint8_t midi_header_skip(FILE *midi)
 {
-	size_t saved_position = ftell(midi);
+	uint32_t magic, header_size;
+
+	rewind(midi);
+	if (fread(&magic, 4, 1, midi) != 1)
+		return 0;
+	if (magic == * (uint32_t *) "RIFF" && (!midi_riff_skip(midi) || fread(&magic, 4, 1, midi) != 1))
+		return 0;
+
+	return magic == * (uint32_t *) "MThd" && fread(&header_size, 4, 1, midi) == 1
+	&& !fseek(midi, reverse32(header_size), SEEK_CUR);
+}
+
+/**
+Find track `track_number` of `midi`, counting from the first chunk after the header.
+The position of `midi` is left as it was.
+*/
+static inline struct midi_track *midi_track_new(struct midi_track *self, FILE *midi, size_t track_number)
+{
+	size_t saved_position = ftell(midi), start_position = 0;
 	uint32_t magic, track_size;
 
-	fseek(midi, MIDI_HEADER_SIZE, SEEK_SET);
+	if (!midi_header_skip(midi)) {
+		fseek(midi, saved_position, SEEK_SET);
+		midi_status = MIDI_InvalidHeaderChunk;
+		return NULL;
+	}
 
 	// Skip previous tracks to get to the `track_number` track.
 	for (size_t i = 0; i <= track_number; ++i) {
-		fread(&magic, 1, 4, midi);
-		assert(magic == * (uint32_t *) "MTrk");
-		if (magic != * (uint32_t *) "MTrk") {
+		start_position = ftell(midi);
+		if (fread(&magic, 4, 1, midi) != 1 || magic != * (uint32_t *) "MTrk"
+		|| fread(&track_size, 4, 1, midi) != 1) {
+			fseek(midi, saved_position, SEEK_SET);
 			midi_status = MIDI_InvalidTrackChunk;
 			return NULL;
 		}
 
 		// Track chunk length in bytes.
 		// Skip this number of bytes to get to next track.
-		fread(&track_size, 4, 1, midi);
 		track_size = reverse32(track_size);
 		fseek(midi, track_size, SEEK_CUR);
 	}
@@ -498,7 +792,7 @@ static struct midi_track *midi_track_new(struct midi_track *self, FILE *midi, si
 	if (!self)
 		self = (struct midi_track *) malloc(sizeof(struct midi_track));
 
-	self->start_position = ftell(midi) - track_size - MIDI_TRACK_HEADER_SIZE;
+	self->start_position = start_position;
 	self->current_position = self->start_position + MIDI_TRACK_HEADER_SIZE;
 	self->size = track_size;
 	self->running_status = 0;
@@ -518,7 +812,7 @@ static struct midi_track *midi_track_new(struct midi_track *self, FILE *midi, si
 }
 
 
-static struct midi_event *midi_track_next(struct midi_track *self, FILE *midi, struct midi_event *event)
+static inline struct midi_event *midi_track_next(struct midi_track *self, FILE *midi, struct midi_event *event)
 {
 	if (!event)
 		event = (struct midi_event *) malloc(sizeof(struct midi_event));
@@ -528,7 +822,17 @@ static struct midi_event *midi_track_next(struct midi_track *self, FILE *midi, s
 	// Get `midi` to the `current_position` of this track.
 	fseek(midi, self->current_position, SEEK_SET);
 
-	midi_event_new(event, midi, &self->running_status);
+	// A malformed event, or one crossing the end of the chunk, ends the track.
+	if (!midi_event_new(event, midi, &self->running_status) || feof(midi)
+	|| (size_t) ftell(midi) > self->start_position + MIDI_TRACK_HEADER_SIZE + self->size) {
+		int status = midi_status == MIDI_Success ? MIDI_PotentialBufferOverflow : midi_status;
+
+		self->end_of_track = 1;
+		self->current_position = self->start_position + MIDI_TRACK_HEADER_SIZE + self->size;
+		fseek(midi, saved_position, SEEK_SET);
+		midi_status = status;
+		return NULL;
+	}
 
 	switch (event->status) {
 	case 0xFF:
@@ -553,19 +857,36 @@ static struct midi_event *midi_track_next(struct midi_track *self, FILE *midi, s
 }
 
 
-static struct midi_parser *midi_parser_new(struct midi_parser *self, FILE *midi)
+static inline struct midi_parser *midi_parser_new(struct midi_parser *self, FILE *midi)
 {
 	assert(ftell(midi) == 0);
 
 	struct midi_header header;
+	struct midi_clock clock;
+
 	if (!midi_header_new(&header, midi))
 		return NULL;
 
-	if (header.time_division >= 0x8000 || header.format >= 2) {
+	// Format 2 sequences are not merged, read them from memory with `midi_sequences_new`.
+	if (header.format >= 2) {
 		midi_status = MIDI_Unimplemented;
 		return NULL;
 	}
 
+	if (!midi_clock_new(&clock, header.time_division)) {
+		midi_status = MIDI_InvalidHeaderChunk;
+		return NULL;
+	}
+
+	#ifndef MIDI_TRACKS_ON_HEAP
+		if (header.track_count > sizeof(self->tracks) / sizeof(*self->tracks)) {
+			midi_status = MIDI_PotentialBufferOverflow;
+			return NULL;
+		}
+	#endif
+
+	uint8_t allocated = !self;
+
 	if (!self)
 		self = (struct midi_parser *) calloc(1, sizeof(struct midi_parser));
 
@@ -574,9 +895,14 @@ static struct midi_parser *midi_parser_new(struct midi_parser *self, FILE *midi)
 	self->time_division = header.time_division;
 
 	self->track_count = header.track_count;
-	self->ticks_per_quarter = header.time_division & 0x7FFF;
 	self->timestamp = 0;
 	self->dtime = 0;
+	self->end_of_file = 0;
+
+	// SMPTE timed files have no quarter notes, their ticks last a fixed time.
+	self->clock = clock;
+	self->ticks_per_quarter = clock.ticks_per_quarter;
+	self->us_per_tick = clock.scale / clock.divisor;
 
 	self->active_track_count = self->track_count;
 
@@ -585,14 +911,23 @@ static struct midi_parser *midi_parser_new(struct midi_parser *self, FILE *midi)
 	#endif
 
 	// Load track into memory and the first event of that track in track's `event` buffer.
-	for (size_t i = 0; i < self->track_count; ++i)
-		midi_track_new(self->tracks + i, midi, i);
+	for (size_t i = 0; i < self->track_count; ++i) {
+		if (!midi_track_new(self->tracks + i, midi, i)) {
+			#ifdef MIDI_TRACKS_ON_HEAP
+				midi_parser_free(self);
+			#endif
+			if (allocated)
+				free(self);
+			return NULL;
+		}
+	}
 
+	midi_status = MIDI_Success;
 	return self;
 }
 
 
-static struct midi_event *midi_parser_next(struct midi_parser *self, FILE *midi, struct midi_event *event)
+static inline struct midi_event *midi_parser_next(struct midi_parser *self, FILE *midi, struct midi_event *event)
 {
 	if (self->end_of_file)
 		return NULL;
@@ -615,7 +950,15 @@ static struct midi_event *midi_parser_next(struct midi_parser *self, FILE *midi,
 
 		if (!chosen && self->timestamp == track->next_event_timestamp) {
 			// Get next event and update to absolute timestamp.
-			event = midi_track_next(track, midi, event);
+			// A malformed track ends the file, with `midi_status` set.
+			struct midi_event *next = midi_track_next(track, midi, event);
+
+			if (!next) {
+				self->end_of_file = 1;
+				return NULL;
+			}
+
+			event = next;
 			track_over = midi_track_over(track);
 			track->next_event_timestamp += self->timestamp;
 
@@ -632,4 +975,797 @@ static struct midi_event *midi_parser_next(struct midi_parser *self, FILE *midi,
 }
 
 
+
+/**
+Event decoded in place from a buffer.
+Nothing is copied or truncated, `data` points to the data bytes or the payload inside the buffer.
+*/
+struct midi_message
+{
+	uint16_t track;
+	// Absolute timestamp in ticks from the start of the track.
+	uint32_t timestamp;
+	uint32_t dtime;
+
+	uint8_t status;
+	uint8_t meta_type;
+	uint32_t size;
+	const uint8_t *data;
+};
+
+
+/// Read position inside one track chunk of a buffer.
+struct midi_cursor
+{
+	const uint8_t *position, *end;
+	uint32_t timestamp;
+	uint16_t track;
+
+	uint8_t running_status;
+	uint8_t end_of_track;
+};
+
+
+/**
+Events of every track of a buffer merged in time order, as `midi_parser_next` does:
+on equal timestamps the track with the lowest index goes first.
+Tracks sit in a binary heap keyed on the timestamp of their next message.
+
+The tracks of a format 2 file are independent sequences, they are not merged but
+returned one after the other, each with its own time starting from 0 and its own tempo.
+*/
+struct midi_merge
+{
+	struct midi_header header;
+	struct midi_clock clock;
+
+	// Absolute time in micro seconds of the last message returned.
+	uint64_t us;
+
+	// Track of the last message returned.
+	uint16_t track;
+
+	// Decode with `midi_cursor_next_trusted`, set only once `midi_validate` accepted the buffer.
+	uint8_t trusted;
+
+	uint16_t heap_size;
+	uint16_t *heap;
+	struct midi_cursor *cursors;
+	struct midi_message *next;
+};
+
+
+/**
+One independent sequence of a format 2 file: a track with its own tempo state.
+Sequences share nothing and `midi_status` is per thread, each can be decoded on its own thread.
+*/
+struct midi_sequence
+{
+	struct midi_cursor cursor;
+	struct midi_clock clock;
+
+	// Absolute time in micro seconds of the last message returned.
+	uint64_t us;
+};
+
+
+/// Bytes of a string in the input buffer, not NUL terminated.
+struct midi_string
+{
+	const char *data;
+	uint32_t size;
+};
+
+/**
+Standard MIDI file found in a buffer, either the whole of it or the `data` chunk
+of an `.rmi` RIFF `RMID` container, with the entries of its `LIST INFO` chunk.
+Everything points into the buffer, nothing is copied.
+*/
+struct midi_riff
+{
+	const uint8_t *smf;
+	size_t size;
+
+	uint32_t info_count;
+	struct
+	{
+		char id[4];
+		struct midi_string value;
+	}
+	info[MIDI_RIFF_INFO];
+};
+
+
+/**
+Callbacks of `midi_visit`, any of them may be NULL.
+A callback returning anything but 0 stops the decoding and `midi_visit` returns that value.
+*/
+struct midi_visitor
+{
+	void *context;
+
+	int (*header)(void *context, const struct midi_header *header);
+	int (*track)(void *context, uint16_t track);
+	int (*message)(void *context, const struct midi_message *message);
+};
+
+
+static inline uint32_t midi_read32(const uint8_t *data)
+{
+	return (uint32_t) data[0] << 24 | data[1] << 16 | data[2] << 8 | data[3];
+}
+
+static inline uint16_t midi_read16(const uint8_t *data)
+{
+	return data[0] << 8 | data[1];
+}
+
+/**
+Read the whole of `midi` into memory, it does not need to be seekable.
+Return a buffer to be released with `free`, NULL if it could not be read.
+*/
+static inline uint8_t *midi_load(FILE *midi, size_t *size)
+{
+	size_t capacity = 1 << 16, used = 0, read_size;
+	uint8_t *data = NULL, *grown;
+
+	long position = ftell(midi);
+	if (position >= 0 && !fseek(midi, 0, SEEK_END)) {
+		long end = ftell(midi);
+		fseek(midi, position, SEEK_SET);
+		if (end > position)
+			capacity = end - position + 1;
+	}
+
+	for (;;) {
+		if (!(grown = (uint8_t *) realloc(data, capacity))) {
+			free(data);
+			return NULL;
+		}
+		data = grown;
+
+		read_size = fread(data + used, 1, capacity - used, midi);
+		used += read_size;
+
+		if (used < capacity)
+			break;
+		capacity *= 2;
+	}
+
+	*size = used;
+	return data;
+}
+
+/**
+Decode the header chunk at the start of `data`.
+Return the first chunk following it, NULL if there is no valid header.
+*/
+static inline const uint8_t *midi_header_decode(struct midi_header *self, const uint8_t *data, size_t size)
+{
+	if (size < MIDI_HEADER_SIZE || memcmp(data, "MThd", 4) || midi_read32(data + 4) < 6
+	|| midi_read32(data + 4) > size - MIDI_TRACK_HEADER_SIZE) {
+		midi_status = MIDI_InvalidHeaderChunk;
+		return NULL;
+	}
+
+	self->format = midi_read16(data + 8);
+	self->track_count = midi_read16(data + 10);
+	self->time_division = midi_read16(data + 12);
+
+	midi_status = MIDI_Success;
+	return data + MIDI_TRACK_HEADER_SIZE + midi_read32(data + 4);
+}
+
+static inline uint32_t midi_read32le(const uint8_t *data)
+{
+	return (uint32_t) data[3] << 24 | data[2] << 16 | data[1] << 8 | data[0];
+}
+
+/// Add the entries of the `LIST INFO` chunk payload in `[data, end)` to `self`.
+static inline void midi_riff_info_decode(struct midi_riff *self, const uint8_t *data, const uint8_t *end)
+{
+	while (end - data >= 8 && self->info_count < MIDI_RIFF_INFO) {
+		uint32_t size = midi_read32le(data + 4);
+
+		if (size > (size_t) (end - data) - 8)
+			return;
+
+		// Values are NUL terminated, the terminator is not part of the view.
+		const char *value = (const char *) data + 8;
+		uint32_t length = size;
+		while (length && !value[length - 1])
+			--length;
+
+		memcpy(self->info[self->info_count].id, data, 4);
+		self->info[self->info_count].value.data = value;
+		self->info[self->info_count].value.size = length;
+		++self->info_count;
+
+		data += 8 + size;
+		if (size & 1 && data < end)
+			++data;
+	}
+}
+
+/**
+Find the standard MIDI file in `data`: all of it, or the `data` chunk of an `.rmi` file.
+Return NULL with `midi_status` set if a RIFF container has no such chunk or a chunk does not fit.
+*/
+static inline struct midi_riff *midi_riff_new(struct midi_riff *self, const uint8_t *data, size_t size)
+{
+	const uint8_t *chunk = data + MIDI_RIFF_HEADER_SIZE, *end;
+
+	if (!self)
+		self = (struct midi_riff *) malloc(sizeof(struct midi_riff));
+
+	self->smf = data;
+	self->size = size;
+	self->info_count = 0;
+	midi_status = MIDI_Success;
+
+	if (size < 4 || memcmp(data, "RIFF", 4))
+		return self;
+
+	if (size < MIDI_RIFF_HEADER_SIZE || memcmp(data + 8, "RMID", 4)) {
+		midi_status = MIDI_InvalidHeaderChunk;
+		return NULL;
+	}
+
+	// A RIFF size past the end of the buffer is not trusted, the buffer bounds the chunks.
+	end = data + MIDI_MIN(size, (size_t) midi_read32le(data + 4) + 8);
+	self->smf = NULL;
+
+	while (end - chunk >= 8) {
+		uint32_t chunk_size = midi_read32le(chunk + 4);
+
+		if (chunk_size > (size_t) (end - chunk) - 8)
+			break;
+
+		if (!memcmp(chunk, "data", 4) && !self->smf) {
+			self->smf = chunk + 8;
+			self->size = chunk_size;
+		} else if (!memcmp(chunk, "LIST", 4) && chunk_size >= 4 && !memcmp(chunk + 8, "INFO", 4)) {
+			midi_riff_info_decode(self, chunk + 12, chunk + 8 + chunk_size);
+		}
+
+		chunk += 8 + chunk_size + (chunk_size & 1);
+	}
+
+	if (!self->smf) {
+		midi_status = MIDI_InvalidHeaderChunk;
+		return NULL;
+	}
+
+	return self;
+}
+
+/// Value of the INFO entry `id`, such as "INAM" or "ICOP", NULL if the file has none.
+static inline const struct midi_string *midi_riff_info(const struct midi_riff *self, const char *id)
+{
+	for (uint32_t i = 0; i < self->info_count; ++i)
+		if (!memcmp(self->info[i].id, id, 4))
+			return &self->info[i].value;
+
+	return NULL;
+}
+
+/**
+Start of the standard MIDI file in `data`, past the RIFF header of `.rmi` files.
+`size` is narrowed to the file. Return NULL with `midi_status` set on a broken container.
+*/
+static inline const uint8_t *midi_smf(const uint8_t *data, size_t *size)
+{
+	struct midi_riff riff;
+
+	if (!midi_riff_new(&riff, data, *size))
+		return NULL;
+
+	*size = riff.size;
+	return riff.smf;
+}
+
+/**
+Find the next track chunk from `chunk` on, skipping chunks of other types.
+Return NULL if there is none before `end` or a chunk does not fit.
+*/
+static inline const uint8_t *midi_chunk_track(const uint8_t *chunk, const uint8_t *end)
+{
+	while (end - chunk >= MIDI_TRACK_HEADER_SIZE) {
+		uint32_t size = midi_read32(chunk + 4);
+
+		if (size > (size_t) (end - chunk) - MIDI_TRACK_HEADER_SIZE)
+			break;
+		if (!memcmp(chunk, "MTrk", 4)) {
+			midi_status = MIDI_Success;
+			return chunk;
+		}
+
+		chunk += MIDI_TRACK_HEADER_SIZE + size;
+	}
+
+	midi_status = MIDI_InvalidTrackChunk;
+	return NULL;
+}
+
+/// Position `self` at the first event of the track chunk `chunk`, found with `midi_chunk_track`.
+static inline struct midi_cursor *midi_cursor_new(struct midi_cursor *self, const uint8_t *chunk, uint16_t track)
+{
+	if (!self)
+		self = (struct midi_cursor *) malloc(sizeof(struct midi_cursor));
+
+	self->position = chunk + MIDI_TRACK_HEADER_SIZE;
+	self->end = self->position + midi_read32(chunk + 4);
+	self->timestamp = 0;
+	self->track = track;
+	self->running_status = 0;
+	self->end_of_track = 0;
+
+	return self;
+}
+
+static inline uint8_t midi_cursor_over(const struct midi_cursor *self)
+{
+	return self->end_of_track || self->position >= self->end;
+}
+
+/// Where the chunk following the one of `self` starts.
+static inline const uint8_t *midi_cursor_chunk_end(const struct midi_cursor *self)
+{
+	return self->end;
+}
+
+/**
+Decode the next event of the track, checking every read against the end of the chunk.
+Return NULL at the end of the track or, with `midi_status` set, on malformed input.
+*/
+static inline struct midi_message *midi_cursor_next(struct midi_cursor *self, struct midi_message *message)
+{
+	const uint8_t *position = self->position, *end = self->end;
+	uint32_t dtime, size = 0;
+	uint8_t status, meta_type = 0;
+	size_t used;
+
+	midi_status = MIDI_Success;
+
+	if (midi_cursor_over(self))
+		return NULL;
+
+	if (!(used = midi_value_decode(position, end, &dtime)) || (position += used) >= end)
+		goto overflow;
+
+	// Handle MIDI running status
+	status = *position;
+	if (status < 0x80) {
+		if (!(status = self->running_status)) {
+			midi_status = MIDI_NoCaseMatch;
+			return NULL;
+		}
+	} else {
+		++position;
+	}
+
+	switch (status & 0xF0) {
+	case EventNoteOff:
+	case EventNoteOn:
+	case EventKeyPressure:
+	case EventControllerChange:
+	case EventPitchBend:
+		size = 2;
+		self->running_status = status;
+		break;
+	case EventProgramChange:
+	case EventChannelPressure:
+		size = 1;
+		self->running_status = status;
+		break;
+
+	case EventSystemExclusive:
+		// SystemExclusive events and meta events cancel any running status which was in effect.
+		self->running_status = 0;
+
+		switch (status) {
+		case 0xFF:
+			if (position >= end)
+				goto overflow;
+			meta_type = *position++;
+			if (meta_type == MetaEndOfTrack)
+				self->end_of_track = 1;
+			// fallthrough
+		case 0xF0: // System exclusive message begin
+		case 0xF7: // System exclusive message end or continuation packet
+			if (!(used = midi_value_decode(position, end, &size)))
+				goto overflow;
+			position += used;
+			break;
+		default:
+			midi_status = MIDI_NoCaseMatch;
+			return NULL;
+		}
+		break;
+	}
+
+	if (size > (size_t) (end - position))
+		goto overflow;
+
+	if (!message)
+		message = (struct midi_message *) malloc(sizeof(struct midi_message));
+
+	self->timestamp += dtime;
+
+	message->track = self->track;
+	message->timestamp = self->timestamp;
+	message->dtime = dtime;
+	message->status = status;
+	message->meta_type = meta_type;
+	message->size = size;
+	message->data = position;
+
+	self->position = position + size;
+	return message;
+
+overflow:
+	midi_status = MIDI_PotentialBufferOverflow;
+	return NULL;
+}
+
+/**
+Decode the next event of a track `midi_validate` accepted, without checking anything.
+On input it did not accept, this reads out of bounds.
+Return NULL at the end of the track.
+*/
+static inline struct midi_message *midi_cursor_next_trusted(struct midi_cursor *self, struct midi_message *message)
+{
+	const uint8_t *position = self->position;
+	uint32_t dtime = 0, size = 0;
+	uint8_t status, meta_type = 0;
+
+	if (midi_cursor_over(self)) {
+		midi_status = MIDI_Success;
+		return NULL;
+	}
+
+	position += midi_value_decode(position, self->end, &dtime);
+
+	status = *position;
+	if (status < 0x80)
+		status = self->running_status;
+	else
+		++position;
+
+	if (status < 0xF0) {
+		size = (status & 0xE0) == 0xC0 ? 1 : 2;
+		self->running_status = status;
+	} else {
+		self->running_status = 0;
+		if (status == 0xFF) {
+			meta_type = *position++;
+			self->end_of_track = meta_type == MetaEndOfTrack;
+		}
+		position += midi_value_decode(position, self->end, &size);
+	}
+
+	self->timestamp += dtime;
+
+	message->track = self->track;
+	message->timestamp = self->timestamp;
+	message->dtime = dtime;
+	message->status = status;
+	message->meta_type = meta_type;
+	message->size = size;
+	message->data = position;
+
+	self->position = position + size;
+	return message;
+}
+
+/**
+Check the structure of the MIDI file in `data` before anything trusts it:
+header and chunk lengths within the buffer, variable length values of at most 4 bytes,
+every event within its chunk and every track closed by an end of track event.
+Nothing is allocated and no time is computed, this is the checked cursor run over every track.
+Return `MIDI_Success`, or the error found first.
+*/
+static inline int midi_validate(const uint8_t *data, size_t size)
+{
+	struct midi_header header;
+	struct midi_cursor cursor;
+	struct midi_message message;
+	const uint8_t *chunk, *end;
+
+	if (!(data = midi_smf(data, &size)))
+		return midi_status;
+	end = data + size;
+
+	if (!(chunk = midi_header_decode(&header, data, size)))
+		return midi_status;
+
+	for (uint16_t track = 0; track < header.track_count; ++track) {
+		if (!(chunk = midi_chunk_track(chunk, end)))
+			return midi_status;
+
+		midi_cursor_new(&cursor, chunk, track);
+
+		while (midi_cursor_next(&cursor, &message))
+			;
+
+		if (midi_status != MIDI_Success)
+			return midi_status;
+		if (!cursor.end_of_track)
+			return midi_status = MIDI_InvalidTrackChunk;
+
+		chunk = midi_cursor_chunk_end(&cursor);
+	}
+
+	return midi_status = MIDI_Success;
+}
+
+/**
+Decode a whole MIDI file held in memory, one track after the other, through `visitor`.
+This is the decoding loop every converter shares.
+Return `MIDI_Success`, or the error that stopped it.
+*/
+static inline int midi_visit(const uint8_t *data, size_t size, const struct midi_visitor *visitor)
+{
+	struct midi_header header;
+	struct midi_cursor cursor;
+	struct midi_message message;
+	const uint8_t *chunk, *end;
+	int stop;
+
+	if (!(data = midi_smf(data, &size)))
+		return midi_status;
+	end = data + size;
+
+	if (!(chunk = midi_header_decode(&header, data, size)))
+		return midi_status;
+
+	if (visitor->header && (stop = visitor->header(visitor->context, &header)))
+		return stop;
+
+	for (uint16_t track = 0; track < header.track_count; ++track) {
+		if (!(chunk = midi_chunk_track(chunk, end)))
+			return midi_status;
+
+		midi_cursor_new(&cursor, chunk, track);
+
+		if (visitor->track && (stop = visitor->track(visitor->context, track)))
+			return stop;
+
+		while (midi_cursor_next(&cursor, &message)) {
+			if (visitor->message && (stop = visitor->message(visitor->context, &message)))
+				return stop;
+		}
+
+		if (midi_status != MIDI_Success)
+			return midi_status;
+
+		chunk = midi_cursor_chunk_end(&cursor);
+	}
+
+	return midi_status = MIDI_Success;
+}
+
+
+static inline void midi_merge_free(struct midi_merge *self)
+{
+	free(self->cursors);
+	self->cursors = NULL;
+	self->next = NULL;
+	self->heap = NULL;
+}
+
+/// Whether the next message of track `a` goes before the one of track `b`.
+static inline uint8_t midi_merge_before(const struct midi_merge *self, uint16_t a, uint16_t b)
+{
+	uint32_t x = self->next[a].timestamp, y = self->next[b].timestamp;
+
+	if (self->header.format == 2)
+		return a < b;
+	return x < y || (x == y && a < b);
+}
+
+static inline void midi_merge_sift_down(struct midi_merge *self, uint16_t i)
+{
+	uint16_t *heap = self->heap, size = self->heap_size;
+
+	for (;;) {
+		uint32_t smallest = i, left = 2 * i + 1, right = left + 1;
+
+		if (left < size && midi_merge_before(self, heap[left], heap[smallest]))
+			smallest = left;
+		if (right < size && midi_merge_before(self, heap[right], heap[smallest]))
+			smallest = right;
+		if (smallest == i)
+			return;
+
+		uint16_t swap = heap[i];
+		heap[i] = heap[smallest];
+		heap[smallest] = swap;
+		i = smallest;
+	}
+}
+
+/**
+Decode the header of the MIDI file in `data` and the first message of every track.
+The buffer must outlive the merge, release it with `midi_merge_free`.
+*/
+static inline struct midi_merge *midi_merge_new(struct midi_merge *self, const uint8_t *data, size_t size)
+{
+	struct midi_header header;
+	const uint8_t *chunk, *end;
+
+	if (!(data = midi_smf(data, &size)))
+		return NULL;
+	end = data + size;
+
+	if (!(chunk = midi_header_decode(&header, data, size)))
+		return NULL;
+
+	struct midi_clock clock;
+
+	if (!midi_clock_new(&clock, header.time_division)) {
+		midi_status = MIDI_InvalidHeaderChunk;
+		return NULL;
+	}
+
+	if (!self)
+		self = (struct midi_merge *) malloc(sizeof(struct midi_merge));
+
+	self->header = header;
+	self->clock = clock;
+	self->us = 0;
+	self->track = 0;
+	self->trusted = 0;
+	self->heap_size = 0;
+
+	// One allocation for the cursors, their next message and the heap.
+	self->cursors = (struct midi_cursor *) malloc(
+		header.track_count * (sizeof(struct midi_cursor) + sizeof(struct midi_message) + sizeof(uint16_t)) + 1
+	);
+	if (!self->cursors) {
+		midi_status = MIDI_OutOfMemory;
+		return NULL;
+	}
+	self->next = (struct midi_message *) (self->cursors + header.track_count);
+	self->heap = (uint16_t *) (self->next + header.track_count);
+
+	for (uint16_t track = 0; track < header.track_count; ++track) {
+		if (!(chunk = midi_chunk_track(chunk, end))) {
+			midi_merge_free(self);
+			return NULL;
+		}
+
+		midi_cursor_new(self->cursors + track, chunk, track);
+		chunk = midi_cursor_chunk_end(self->cursors + track);
+
+		if (midi_cursor_next(self->cursors + track, self->next + track))
+			self->heap[self->heap_size++] = track;
+		else if (midi_status != MIDI_Success) {
+			midi_merge_free(self);
+			return NULL;
+		}
+	}
+
+	for (uint16_t i = self->heap_size / 2; i-- > 0;)
+		midi_merge_sift_down(self, i);
+
+	midi_status = MIDI_Success;
+	return self;
+}
+
+/**
+Return the next message of the whole file and set `self->us` to its time in micro seconds,
+tempo changes from any track applying from their timestamp on.
+Return NULL at the end of the file or, with `midi_status` set, on malformed input.
+*/
+static inline struct midi_message *midi_merge_next(struct midi_merge *self, struct midi_message *message)
+{
+	if (!self->heap_size) {
+		midi_status = MIDI_Success;
+		return NULL;
+	}
+
+	uint16_t track = self->heap[0];
+
+	if (!message)
+		message = (struct midi_message *) malloc(sizeof(struct midi_message));
+
+	*message = self->next[track];
+
+	// Next sequence of a format 2 file, back to the initial tempo.
+	if (self->header.format == 2 && track != self->track)
+		midi_clock_new(&self->clock, self->header.time_division);
+	self->track = track;
+
+	self->us = midi_clock_us(&self->clock, message->timestamp);
+
+	if (message->status == 0xFF && message->meta_type == MetaSetTempo && message->size >= 3)
+		midi_clock_tempo(&self->clock, message->timestamp, message->data[0] << 16 | message->data[1] << 8 | message->data[2]);
+
+	if (!(self->trusted ? midi_cursor_next_trusted : midi_cursor_next)(self->cursors + track, self->next + track)) {
+		if (midi_status != MIDI_Success)
+			return NULL;
+		self->heap[0] = self->heap[--self->heap_size];
+	}
+
+	midi_merge_sift_down(self, 0);
+
+	midi_status = MIDI_Success;
+	return message;
+}
+
+
+/// Position `self` at the start of the track chunk `chunk`, found with `midi_chunk_track`.
+static inline struct midi_sequence *midi_sequence_new(struct midi_sequence *self, const struct midi_header *header, const uint8_t *chunk, uint16_t track)
+{
+	struct midi_clock clock;
+
+	if (!midi_clock_new(&clock, header->time_division)) {
+		midi_status = MIDI_InvalidHeaderChunk;
+		return NULL;
+	}
+
+	if (!self)
+		self = (struct midi_sequence *) malloc(sizeof(struct midi_sequence));
+
+	midi_cursor_new(&self->cursor, chunk, track);
+	self->clock = clock;
+	self->us = 0;
+
+	midi_status = MIDI_Success;
+	return self;
+}
+
+/**
+Find every track of the MIDI file in `data`, decoding `header` on the way.
+Return an array of `header->track_count` sequences to be released with `free`, NULL on failure.
+Only the chunk headers are read, events are decoded by `midi_sequence_next`.
+*/
+static inline struct midi_sequence *midi_sequences_new(const uint8_t *data, size_t size, struct midi_header *header)
+{
+	struct midi_sequence *sequences;
+	const uint8_t *chunk, *end;
+
+	if (!(data = midi_smf(data, &size)))
+		return NULL;
+	end = data + size;
+
+	if (!(chunk = midi_header_decode(header, data, size)))
+		return NULL;
+
+	if (!(sequences = (struct midi_sequence *) malloc(sizeof(struct midi_sequence) * header->track_count + 1))) {
+		midi_status = MIDI_OutOfMemory;
+		return NULL;
+	}
+
+	for (uint16_t track = 0; track < header->track_count; ++track) {
+		if (!(chunk = midi_chunk_track(chunk, end)) || !midi_sequence_new(sequences + track, header, chunk, track)) {
+			free(sequences);
+			return NULL;
+		}
+		chunk = midi_cursor_chunk_end(&sequences[track].cursor);
+	}
+
+	return sequences;
+}
+
+/**
+Decode the next message of the sequence and set `self->us` to its time,
+following the tempo changes of this sequence only.
+Return NULL at the end of the sequence or, with `midi_status` set, on malformed input.
+*/
+static inline struct midi_message *midi_sequence_next(struct midi_sequence *self, struct midi_message *message)
+{
+	if (!(message = midi_cursor_next(&self->cursor, message)))
+		return NULL;
+
+	self->us = midi_clock_us(&self->clock, message->timestamp);
+
+	if (message->status == 0xFF && message->meta_type == MetaSetTempo && message->size >= 3)
+		midi_clock_tempo(&self->clock, message->timestamp, message->data[0] << 16 | message->data[1] << 8 | message->data[2]);
+
+	return message;
+}
+
+
 #endif /* MIDI_PARSER_H */
\ No newline at end of file
@@ -0,0 +1,577 @@
+#ifndef MIDI_PARSER_HPP
+#define MIDI_PARSER_HPP
+
+
+#include <cstddef>
+#include <iterator>
+#include <type_traits>
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+	#include <coroutine>
+	#define MIDI_COROUTINE
+#endif
+
+#include "midi_parser.h"
+
+
+namespace midi
+{
+
+/**
+Decode policies select what a decoder variant keeps, independently of the
+`MIDI_META_EVENT` and `MIDI_SYSEX_EVENT` knobs which fix the layout of the C `midi_event`.
+Meta levels mean the same as `MIDI_META_EVENT`, 0 keeps no meta data at all.
+Whatever is not kept is skipped without being decoded and has no storage in the event.
+*/
+template <unsigned MetaLevel, bool Sysex>
+struct decode_policy
+{
+	static constexpr unsigned meta_level = MetaLevel;
+	static constexpr bool sysex = Sysex;
+};
+
+/// Channel messages and tempo, enough for playback.
+using realtime = decode_policy<1, false>;
+/// Everything the C decoder knows about.
+using archival = decode_policy<3, true>;
+
+/// Decode with the C `midi_parser` itself into a `midi_event`.
+struct native {};
+
+
+/// Field that is compiled out.
+struct none {};
+
+template <unsigned MetaLevel>
+union meta_storage;
+
+template <>
+union meta_storage<0>
+{
+	none nothing;
+};
+
+template <>
+union meta_storage<1>
+{
+	uint32_t tempo;
+};
+
+template <>
+union meta_storage<2>
+{
+	uint32_t tempo;
+	uint8_t channel_prefix;
+	uint16_t sequence_number;
+	uint8_t key_signature[2];
+	uint8_t time_signature[4];
+};
+
+template <>
+union meta_storage<3>
+{
+	uint32_t tempo;
+	uint8_t channel_prefix;
+	uint16_t sequence_number;
+	uint8_t key_signature[2];
+	uint8_t time_signature[4];
+	uint8_t SMPTE_offset[5];
+	uint8_t sequencer_specific[128];
+	char text[128];
+};
+
+template <bool Sysex>
+struct sysex_storage
+{
+	using type = uint8_t[128];
+};
+
+template <>
+struct sysex_storage<false>
+{
+	using type = none;
+};
+
+
+/// `midi_event` holding only what `Policy` keeps.
+template <class Policy>
+struct basic_event
+{
+	uint32_t dtime;
+	uint8_t status;
+	uint8_t meta_type;
+	uint32_t size;
+
+	union
+	{
+		uint8_t midi_data[2];
+		typename sysex_storage<Policy::sysex>::type sysex_data;
+		meta_storage<Policy::meta_level> meta_data;
+	};
+};
+
+template <class Policy>
+struct event_type
+{
+	using type = basic_event<Policy>;
+};
+
+template <>
+struct event_type<native>
+{
+	using type = midi_event;
+};
+
+
+/// Meta event reading of `midi_event_meta_new`, without the cases `Policy` drops.
+template <class Policy>
+inline bool decode_meta(basic_event<Policy> &self, FILE *midi)
+{
+	int meta_type = MIDI_GETC(midi);
+
+	midi_status = meta_type == EOF ? MIDI_PotentialBufferOverflow : MIDI_Success;
+	self.meta_type = (uint8_t) meta_type;
+	self.size = midi_value_read(midi);
+	if (midi_status != MIDI_Success)
+		return false;
+
+	switch (self.meta_type) {
+	case MetaSetTempo:
+		if constexpr (Policy::meta_level >= 1) {
+			self.meta_data.tempo = MIDI_GETC(midi) << 16;
+			self.meta_data.tempo |= MIDI_GETC(midi) << 8;
+			self.meta_data.tempo |= MIDI_GETC(midi);
+			return true;
+		}
+		break;
+
+	case MetaSequence:
+		if constexpr (Policy::meta_level >= 2) {
+			self.meta_data.sequence_number = MIDI_GETC(midi) << 8;
+			self.meta_data.sequence_number |= MIDI_GETC(midi);
+			return true;
+		}
+		break;
+	case MetaChannelPrefix:
+		if constexpr (Policy::meta_level >= 2) {
+			self.meta_data.channel_prefix = MIDI_GETC(midi);
+			return true;
+		}
+		break;
+	case MetaTimeSignature:
+		if constexpr (Policy::meta_level >= 2) {
+			fread(self.meta_data.time_signature, 1, 4, midi);
+			return true;
+		}
+		break;
+	case MetaKeySignature:
+		if constexpr (Policy::meta_level >= 2) {
+			fread(self.meta_data.key_signature, 1, 2, midi);
+			return true;
+		}
+		break;
+
+	case MetaSMPTEOffset:
+		if constexpr (Policy::meta_level >= 3) {
+			fread(self.meta_data.SMPTE_offset, 1, 5, midi);
+			return true;
+		}
+		break;
+	case MetaSequencerSpecific:
+		if constexpr (Policy::meta_level >= 3) {
+			size_t read_size = MIDI_MIN(self.size, sizeof(self.meta_data.sequencer_specific));
+			fread(self.meta_data.sequencer_specific, 1, read_size, midi);
+			fseek(midi, self.size - read_size, SEEK_CUR);
+			return true;
+		}
+		break;
+	case MetaText:
+	case MetaCopyright:
+	case MetaTrackName:
+	case MetaInstrumentName:
+	case MetaLyrics:
+	case MetaMarker:
+	case MetaCuePoint:
+		if constexpr (Policy::meta_level >= 3) {
+			size_t read_size = MIDI_MIN(self.size, sizeof(self.meta_data.text) - 1);
+			fread(self.meta_data.text, 1, read_size, midi);
+			self.meta_data.text[read_size] = 0;
+			fseek(midi, self.size - read_size, SEEK_CUR);
+			return true;
+		}
+		break;
+	}
+
+	fseek(midi, self.size, SEEK_CUR);
+	return true;
+}
+
+/// `midi_event_new` for a policy event, false with `midi_status` set on malformed input.
+template <class Policy>
+inline bool decode_event(basic_event<Policy> &self, FILE *midi, uint8_t *running_status)
+{
+	midi_status = MIDI_Success;
+	self.dtime = midi_value_read(midi);
+	if (midi_status != MIDI_Success)
+		return false;
+
+	int status = MIDI_GETC(midi);
+	if (status == EOF) {
+		midi_status = MIDI_PotentialBufferOverflow;
+		return false;
+	}
+	self.status = (uint8_t) status;
+
+	if (self.status < 0x80) {
+		if (!*running_status) {
+			midi_status = MIDI_NoCaseMatch;
+			return false;
+		}
+		self.status = *running_status;
+		fseek(midi, -1, SEEK_CUR);
+	}
+
+	*running_status = self.status;
+
+	switch (self.status & 0xF0) {
+	case EventNoteOff:
+	case EventNoteOn:
+	case EventKeyPressure:
+	case EventControllerChange:
+	case EventPitchBend:
+		self.size = 2;
+		if (fread(self.midi_data, 1, 2, midi) != 2) {
+			midi_status = MIDI_PotentialBufferOverflow;
+			return false;
+		}
+		break;
+	case EventProgramChange:
+	case EventChannelPressure:
+		self.size = 1;
+		if (fread(self.midi_data, 1, 1, midi) != 1) {
+			midi_status = MIDI_PotentialBufferOverflow;
+			return false;
+		}
+		break;
+
+	case EventSystemExclusive:
+		*running_status = 0;
+
+		switch (self.status) {
+		case 0xF0:
+		case 0xF7:
+			self.size = midi_value_read(midi);
+			if (midi_status != MIDI_Success)
+				return false;
+			if constexpr (Policy::sysex) {
+				size_t read_size = MIDI_MIN(self.size, sizeof(self.sysex_data));
+				fread(self.sysex_data, 1, read_size, midi);
+				fseek(midi, self.size - read_size, SEEK_CUR);
+			} else {
+				fseek(midi, self.size, SEEK_CUR);
+			}
+			break;
+		case 0xFF:
+			if (!decode_meta(self, midi))
+				return false;
+			break;
+		default:
+			midi_status = MIDI_NoCaseMatch;
+			return false;
+		}
+		break;
+
+	default:
+		midi_status = MIDI_NoCaseMatch;
+		return false;
+	}
+
+	midi_status = MIDI_Success;
+	return true;
+}
+
+
+/**
+Non owning view of the event the parser is currently on.
+Only valid until the parser moves on.
+*/
+template <class Event>
+struct basic_event_view
+{
+	const Event *event;
+	// Absolute timestamp in ticks.
+	uint32_t timestamp;
+	// Absolute time in micro seconds.
+	uint64_t time_us;
+
+	uint8_t status() const { return event->status; }
+	uint8_t type() const { return MIDI_EVENT_TYPE(event); }
+	uint8_t channel() const { return MIDI_EVENT_CHANNEL(event); }
+	uint8_t meta_type() const { return event->meta_type; }
+	uint32_t size() const { return event->size; }
+	const uint8_t *data() const { return event->midi_data; }
+
+	const Event *operator->() const { return event; }
+	const Event &operator*() const { return *event; }
+};
+
+using event_view = basic_event_view<midi_event>;
+
+
+/**
+`midi_parser` driven through input iterators, so that
+
+	for (midi::event_view event : midi::parser(file))
+
+does exactly what the hand written `midi_parser_next` loop does.
+With a decode policy instead of `native`, events are decoded by a variant
+specialised for that policy, and several variants can live in one program.
+*/
+template <class Policy>
+class basic_parser
+{
+public:
+	using event = typename event_type<Policy>::type;
+	using view = basic_event_view<event>;
+
+	class iterator
+	{
+	public:
+		using iterator_category = std::input_iterator_tag;
+		using value_type = view;
+		using difference_type = std::ptrdiff_t;
+		using pointer = const view *;
+		using reference = view;
+
+		iterator() : owner(nullptr) {}
+		explicit iterator(basic_parser *owner) : owner(owner) {}
+
+		view operator*() const
+		{
+			return view { &owner->current, owner->state.timestamp, MIDI_TIME(&owner->state) };
+		}
+
+		iterator &operator++()
+		{
+			owner->state.timestamp += owner->state.dtime;
+			owner->advance();
+			return *this;
+		}
+
+		void operator++(int) { ++*this; }
+
+		bool operator==(const iterator &other) const { return done() == other.done(); }
+		bool operator!=(const iterator &other) const { return done() != other.done(); }
+
+	private:
+		bool done() const { return !owner || owner->state.end_of_file; }
+
+		basic_parser *owner;
+	};
+
+	explicit basic_parser(FILE *midi) : midi(midi)
+	{
+		status = midi_parser_new(&state, midi) ? MIDI_Success : midi_status;
+		#ifdef MIDI_TRACKS_ON_HEAP
+			if (status != MIDI_Success)
+				state.tracks = NULL;
+		#endif
+	}
+
+	~basic_parser()
+	{
+		#ifdef MIDI_TRACKS_ON_HEAP
+			midi_parser_free(&state);
+		#endif
+	}
+
+	basic_parser(const basic_parser &) = delete;
+	basic_parser &operator=(const basic_parser &) = delete;
+
+	/// `MIDI_Success`, or the reason the header or an event could not be parsed.
+	int error() const { return status; }
+	explicit operator bool() const { return status == MIDI_Success; }
+
+	/// Fetch the first event. A parser is a single pass range, call this once.
+	iterator begin()
+	{
+		if (status != MIDI_Success)
+			return iterator();
+
+		advance();
+		return iterator(this);
+	}
+
+	iterator end() { return iterator(); }
+
+	const midi_parser &raw() const { return state; }
+
+private:
+	void advance()
+	{
+		// A malformed event ends the range, `error` tells why.
+		if constexpr (std::is_same_v<Policy, native>) {
+			if (!midi_parser_next(&state, midi, &current))
+				status = midi_status;
+		} else if (!next()) {
+			status = midi_status;
+		}
+	}
+
+	/// `midi_track_next` for a policy event.
+	bool track_next(midi_track *track)
+	{
+		long saved_position = ftell(midi);
+		size_t chunk_end = track->start_position + MIDI_TRACK_HEADER_SIZE + track->size;
+		fseek(midi, track->current_position, SEEK_SET);
+
+		if (!decode_event(current, midi, &track->running_status) || feof(midi) || (size_t) ftell(midi) > chunk_end) {
+			int error = midi_status == MIDI_Success ? MIDI_PotentialBufferOverflow : midi_status;
+
+			track->end_of_track = 1;
+			track->current_position = chunk_end;
+			fseek(midi, saved_position, SEEK_SET);
+			midi_status = error;
+			return false;
+		}
+
+		if (current.status == 0xFF && current.meta_type == MetaEndOfTrack)
+			track->end_of_track = 1;
+
+		if (!midi_track_over(track))
+			track->next_event_timestamp = midi_value_peek(midi);
+
+		track->current_position = ftell(midi);
+		fseek(midi, saved_position, SEEK_SET);
+		return true;
+	}
+
+	/// `midi_parser_next` for a policy event.
+	bool next()
+	{
+		uint16_t active_track_count = 0;
+		bool chosen = false;
+
+		state.dtime = ~0;
+
+		for (size_t i = 0; i < state.track_count; ++i) {
+			midi_track *track = state.tracks + i;
+
+			if (midi_track_over(track))
+				continue;
+
+			++active_track_count;
+
+			if (!chosen && state.timestamp == track->next_event_timestamp) {
+				if (!track_next(track)) {
+					state.end_of_file = 1;
+					return false;
+				}
+				track->next_event_timestamp += state.timestamp;
+				chosen = true;
+
+				if constexpr (Policy::meta_level >= 1) {
+					if (current.status == 0xFF && current.meta_type == MetaSetTempo) {
+						midi_parser_tempo(&state, current.meta_data.tempo);
+					}
+				}
+			}
+
+			if (!midi_track_over(track))
+				state.dtime = MIDI_MIN(state.dtime, track->next_event_timestamp - state.timestamp);
+		}
+
+		state.end_of_file = !active_track_count;
+		return true;
+	}
+
+	FILE *midi;
+	int status;
+	midi_parser state;
+	event current;
+};
+
+using parser = basic_parser<native>;
+
+
+#ifdef MIDI_COROUTINE
+/// Minimal single pass generator for `events`.
+template <class T>
+class generator
+{
+public:
+	struct promise_type
+	{
+		const T *value;
+
+		generator get_return_object() { return generator(handle::from_promise(*this)); }
+		std::suspend_always initial_suspend() noexcept { return {}; }
+		std::suspend_always final_suspend() noexcept { return {}; }
+		std::suspend_always yield_value(const T &yielded) noexcept { value = &yielded; return {}; }
+		void return_void() noexcept {}
+		void unhandled_exception() { throw; }
+	};
+
+	using handle = std::coroutine_handle<promise_type>;
+
+	class iterator
+	{
+	public:
+		using iterator_category = std::input_iterator_tag;
+		using value_type = T;
+		using difference_type = std::ptrdiff_t;
+		using pointer = const T *;
+		using reference = const T &;
+
+		iterator() : coroutine(nullptr) {}
+		explicit iterator(handle coroutine) : coroutine(coroutine) {}
+
+		const T &operator*() const { return *coroutine.promise().value; }
+		iterator &operator++() { coroutine.resume(); return *this; }
+		void operator++(int) { ++*this; }
+
+		bool operator==(const iterator &other) const { return done() == other.done(); }
+		bool operator!=(const iterator &other) const { return done() != other.done(); }
+
+	private:
+		bool done() const { return !coroutine || coroutine.done(); }
+
+		handle coroutine;
+	};
+
+	explicit generator(handle coroutine) : coroutine(coroutine) {}
+	generator(generator &&other) noexcept : coroutine(other.coroutine) { other.coroutine = nullptr; }
+	generator(const generator &) = delete;
+
+	~generator()
+	{
+		if (coroutine)
+			coroutine.destroy();
+	}
+
+	iterator begin()
+	{
+		coroutine.resume();
+		return iterator(coroutine);
+	}
+
+	iterator end() { return iterator(); }
+
+private:
+	handle coroutine;
+};
+
+/// Coroutine flavour of `parser`, for code that composes generators.
+inline generator<event_view> events(FILE *midi)
+{
+	parser source(midi);
+
+	for (event_view event : source)
+		co_yield event;
+}
+#endif
+
+}
+
+
+#endif /* MIDI_PARSER_HPP */
@@ -0,0 +1,259 @@
+#ifndef MIDI_ROLL_H
+#define MIDI_ROLL_H
+
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+	#include <emmintrin.h>
+#endif
+
+#include "midi_parser.h"
+
+
+#define MIDI_ROLL_CHANNELS 16
+#define MIDI_ROLL_PITCHES 128
+#define MIDI_ROLL_CELLS (MIDI_ROLL_CHANNELS * MIDI_ROLL_PITCHES)
+
+
+/**
+Cell layout of a row, channel major: cell `channel * 128 + pitch`.
+`RollBytes` stores the velocity of the note sounding in a cell, 0 if there is none,
+`RollBits` one bit per cell, bit `cell % 8` of byte `cell / 8`.
+*/
+enum MIDI_RollFormat
+{
+	RollBytes,
+	RollBits
+};
+
+/// Unit of the time step of a row.
+enum MIDI_RollTime
+{
+	RollTicks,
+	RollMicroseconds
+};
+
+/**
+Piano roll rendered from an event stream, one row every `step` ticks or micro seconds.
+Rows are built in blocks of `block_rows` and handed to `emit` as soon as a block is full,
+so memory does not grow with the length of the piece.
+
+A note lights every row from the one of its note on to the one before its note off,
+and at least the row of its note on, so that notes shorter than a step are not lost.
+*/
+struct midi_roll
+{
+	enum MIDI_RollFormat format;
+	enum MIDI_RollTime time;
+	uint32_t step;
+
+	size_t row_size;
+	uint32_t block_rows;
+
+	// Return anything but 0 to stop rendering.
+	void *context;
+	int (*emit)(void *context, uint64_t first_row, const uint8_t *rows, uint32_t count);
+
+	// Row under construction and how many of the block are done.
+	uint64_t row;
+	uint32_t count;
+	uint8_t stopped;
+
+	// Notes sounding now, and the block whose last row is `row`.
+	uint8_t *state;
+	uint8_t *block;
+};
+
+
+static inline void midi_roll_free(struct midi_roll *self)
+{
+	free(self->state);
+	self->state = NULL;
+	self->block = NULL;
+}
+
+static inline struct midi_roll *midi_roll_new(
+	struct midi_roll *self, enum MIDI_RollFormat format, enum MIDI_RollTime time, uint32_t step, uint32_t block_rows,
+	void *context, int (*emit)(void *context, uint64_t first_row, const uint8_t *rows, uint32_t count)
+)
+{
+	if (!step || !block_rows) {
+		midi_status = MIDI_InvalidEvent;
+		return NULL;
+	}
+
+	if (!self)
+		self = (struct midi_roll *) malloc(sizeof(struct midi_roll));
+
+	self->format = format;
+	self->time = time;
+	self->step = step;
+	self->row_size = format == RollBits ? MIDI_ROLL_CELLS / 8 : MIDI_ROLL_CELLS;
+	self->block_rows = block_rows;
+	self->context = context;
+	self->emit = emit;
+	self->row = 0;
+	self->count = 0;
+	self->stopped = 0;
+
+	// State and block in one allocation, 16 byte aligned rows.
+	if (!(self->state = (uint8_t *) aligned_alloc(16, self->row_size * ((size_t) block_rows + 1)))) {
+		midi_status = MIDI_OutOfMemory;
+		return NULL;
+	}
+	self->block = self->state + self->row_size;
+
+	memset(self->state, 0, self->row_size * ((size_t) block_rows + 1));
+
+	midi_status = MIDI_Success;
+	return self;
+}
+
+/// Row being built in the block.
+static inline uint8_t *midi_roll_current(const struct midi_roll *self)
+{
+	return self->block + (size_t) self->count * self->row_size;
+}
+
+/// Hand the rows of the block done so far to `emit`.
+static inline void midi_roll_flush(struct midi_roll *self)
+{
+	if (self->count && !self->stopped && self->emit(self->context, self->row - self->count, self->block, self->count))
+		self->stopped = 1;
+	self->count = 0;
+}
+
+/**
+Write `count` copies of `row` to `rows`, the fill of sustained spans.
+Bit packed rows are 256 bytes and stay in registers for the whole span.
+*/
+static inline void midi_roll_fill(uint8_t *rows, const uint8_t *row, size_t row_size, uint64_t count)
+{
+	#ifdef __SSE2__
+		if (row_size == MIDI_ROLL_CELLS / 8) {
+			__m128i r[16];
+			for (size_t i = 0; i < 16; ++i)
+				r[i] = _mm_load_si128((const __m128i *) row + i);
+
+			for (; count; --count, rows += MIDI_ROLL_CELLS / 8)
+				for (size_t i = 0; i < 16; ++i)
+					_mm_store_si128((__m128i *) rows + i, r[i]);
+			return;
+		}
+
+		for (; count; --count, rows += row_size)
+			for (size_t i = 0; i < row_size; i += 64) {
+				__m128i a = _mm_load_si128((const __m128i *) (row + i));
+				__m128i b = _mm_load_si128((const __m128i *) (row + i + 16));
+				__m128i c = _mm_load_si128((const __m128i *) (row + i + 32));
+				__m128i d = _mm_load_si128((const __m128i *) (row + i + 48));
+				_mm_store_si128((__m128i *) (rows + i), a);
+				_mm_store_si128((__m128i *) (rows + i + 16), b);
+				_mm_store_si128((__m128i *) (rows + i + 32), c);
+				_mm_store_si128((__m128i *) (rows + i + 48), d);
+			}
+	#else
+		for (; count; --count, rows += row_size)
+			memcpy(rows, row, row_size);
+	#endif
+}
+
+/// Close the current row and start the following ones up to `row` with the notes sounding now.
+static inline void midi_roll_advance(struct midi_roll *self, uint64_t row)
+{
+	while (self->row < row && !self->stopped) {
+		// Close the current row.
+		++self->row;
+		if (++self->count == self->block_rows)
+			midi_roll_flush(self);
+
+		// Rows up to `row` included look like the state, filled up to the end of the block at a time.
+		uint64_t span = MIDI_MIN(row - self->row + 1, (uint64_t) (self->block_rows - self->count));
+		midi_roll_fill(midi_roll_current(self), self->state, self->row_size, span);
+
+		self->row += span - 1;
+		self->count += span - 1;
+	}
+}
+
+static inline void midi_roll_set(struct midi_roll *self, uint8_t *row, size_t cell, uint8_t velocity)
+{
+	if (self->format == RollBits) {
+		if (velocity)
+			row[cell >> 3] |= 1 << (cell & 7);
+		else
+			row[cell >> 3] &= ~(1 << (cell & 7));
+	} else {
+		row[cell] = velocity;
+	}
+}
+
+/**
+Render `message`, happening at `time` in the unit of the roll.
+Messages must come in time order, as `midi_merge_next` returns them.
+Return 0 once `emit` asked to stop.
+*/
+static inline int midi_roll_message(struct midi_roll *self, const struct midi_message *message, uint64_t time)
+{
+	uint8_t type = message->status & 0xF0, velocity;
+	size_t cell;
+
+	if (self->stopped)
+		return 0;
+
+	// Every event extends the roll, so that it lasts as long as the piece.
+	midi_roll_advance(self, time / self->step);
+
+	if (type != EventNoteOn && type != EventNoteOff)
+		return !self->stopped;
+
+	cell = (message->status & 0x0F) * MIDI_ROLL_PITCHES + (message->data[0] & 0x7F);
+	velocity = type == EventNoteOn ? message->data[1] & 0x7F : 0;
+
+	midi_roll_set(self, self->state, cell, velocity);
+
+	// A note off leaves the current row lit, the note sounded in it.
+	if (velocity)
+		midi_roll_set(self, midi_roll_current(self), cell, velocity);
+
+	return !self->stopped;
+}
+
+/// Close the last row and emit what is left of the block.
+static inline void midi_roll_finish(struct midi_roll *self)
+{
+	++self->row;
+	++self->count;
+	midi_roll_flush(self);
+}
+
+/**
+Render a whole MIDI file held in memory, tracks merged in playing order.
+Return `MIDI_Success` or the error that stopped decoding.
+*/
+static inline int midi_roll_render(struct midi_roll *self, const uint8_t *data, size_t size)
+{
+	struct midi_merge merge;
+	struct midi_message message;
+
+	if (!midi_merge_new(&merge, data, size))
+		return midi_status;
+
+	while (midi_merge_next(&merge, &message))
+		if (!midi_roll_message(self, &message, self->time == RollTicks ? message.timestamp : merge.us))
+			break;
+
+	midi_merge_free(&merge);
+
+	if (midi_status == MIDI_Success)
+		midi_roll_finish(self);
+
+	return midi_status;
+}
+
+
+#endif /* MIDI_ROLL_H */
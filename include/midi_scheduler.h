@@ -0,0 +1,109 @@
+#ifndef MIDI_SCHEDULER_H
+#define MIDI_SCHEDULER_H
+
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+
+/// Lateness histogram buckets: [0, 1) us, then [2^(i - 1), 2^i) us, the last one is open ended.
+#define MIDI_SCHEDULER_BUCKETS 16
+
+
+/**
+Playback pacing against absolute deadlines on `CLOCK_MONOTONIC`.
+Every event is scheduled relative to `start`, so sleep overshoot of one event
+is never carried over to the next one.
+*/
+struct midi_scheduler
+{
+	struct timespec start;
+
+	// Wake up this many micro seconds early and busy wait the rest, 0 to disable.
+	uint32_t spin_us;
+
+	uint64_t count;
+	uint64_t max_late_ns;
+	uint64_t histogram[MIDI_SCHEDULER_BUCKETS];
+};
+
+
+static inline uint64_t midi_timespec_ns(const struct timespec *time)
+{
+	return (uint64_t) time->tv_sec * 1000000000 + time->tv_nsec;
+}
+
+static inline struct timespec midi_ns_timespec(uint64_t ns)
+{
+	struct timespec time;
+	time.tv_sec = (time_t) (ns / 1000000000);
+	time.tv_nsec = (long) (ns % 1000000000);
+	return time;
+}
+
+
+static inline struct midi_scheduler *midi_scheduler_new(struct midi_scheduler *self, uint32_t spin_us)
+{
+	if (!self)
+		self = (struct midi_scheduler *) malloc(sizeof(struct midi_scheduler));
+
+	memset(self, 0, sizeof(struct midi_scheduler));
+	self->spin_us = spin_us;
+	clock_gettime(CLOCK_MONOTONIC, &self->start);
+
+	return self;
+}
+
+/**
+Block until `deadline_us` micro seconds after the scheduler start and record how late we woke up.
+*/
+static inline void midi_scheduler_wait(struct midi_scheduler *self, uint64_t deadline_us)
+{
+	uint64_t target = midi_timespec_ns(&self->start) + deadline_us * 1000;
+	uint64_t sleep_target = target - (uint64_t) self->spin_us * 1000;
+	struct timespec now, wake = midi_ns_timespec(sleep_target);
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL) == EINTR);
+
+	do
+		clock_gettime(CLOCK_MONOTONIC, &now);
+	while (self->spin_us && midi_timespec_ns(&now) < target);
+
+	uint64_t late_ns = midi_timespec_ns(&now) > target ? midi_timespec_ns(&now) - target : 0;
+	uint64_t late_us = late_ns / 1000;
+	size_t bucket = 0;
+
+	while (late_us && bucket < MIDI_SCHEDULER_BUCKETS - 1) {
+		late_us >>= 1;
+		++bucket;
+	}
+
+	++self->histogram[bucket];
+	++self->count;
+	if (late_ns > self->max_late_ns)
+		self->max_late_ns = late_ns;
+}
+
+static inline void midi_scheduler_report(const struct midi_scheduler *self, FILE *output)
+{
+	fprintf(output, "events: %" PRIu64 ", max late: %" PRIu64 " ns\n", self->count, self->max_late_ns);
+
+	for (size_t i = 0; i < MIDI_SCHEDULER_BUCKETS; ++i) {
+		if (!self->histogram[i])
+			continue;
+
+		if (!i)
+			fprintf(output, "[0, 1) us\t%" PRIu64 "\n", self->histogram[i]);
+		else if (i == MIDI_SCHEDULER_BUCKETS - 1)
+			fprintf(output, "[%" PRIu64 ", inf) us\t%" PRIu64 "\n", (uint64_t) 1 << (i - 1), self->histogram[i]);
+		else
+			fprintf(output, "[%" PRIu64 ", %" PRIu64 ") us\t%" PRIu64 "\n", (uint64_t) 1 << (i - 1), (uint64_t) 1 << i, self->histogram[i]);
+	}
+}
+
+#endif /* MIDI_SCHEDULER_H */
@@ -0,0 +1,326 @@
+#ifndef MIDI_STATS_H
+#define MIDI_STATS_H
+
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "midi_parser.h"
+#include "midi_index.h"
+
+
+#define MIDI_STATS_CELLS (16 * 128)
+
+#define MIDI_STATS_NAMES 8
+#define MIDI_STATS_NAME_SIZE 32
+
+
+/**
+Fixed layout summary of one file or, merged, of many.
+Everything is a count, a sum, a minimum or a maximum, so partial results of
+different threads merge with `midi_stats_merge` in any order.
+*/
+struct midi_stats
+{
+	uint64_t files;
+	uint64_t events;
+
+	// Summed over the files.
+	uint64_t duration_us;
+
+	// Most notes sounding at once in a file.
+	uint32_t max_polyphony;
+
+	// In micro seconds per quarter note, `tempo_min` is UINT32_MAX when there was no tempo event.
+	uint32_t tempo_min, tempo_max;
+
+	// Channel events per type, `(status >> 4) - 8`, and channel.
+	uint64_t channel_events[7][16];
+	uint64_t sysex_events;
+	uint64_t meta_events[128];
+
+	// Of note on events with a non zero velocity.
+	uint64_t pitches[128];
+	uint64_t velocities[128];
+
+	// The first track names met, truncated and NUL terminated.
+	uint32_t track_name_count;
+	char track_names[MIDI_STATS_NAMES][MIDI_STATS_NAME_SIZE];
+};
+
+/// What the statistics of one file need to remember between events.
+struct midi_stats_state
+{
+	uint32_t polyphony;
+	uint64_t us;
+	uint8_t sounding[MIDI_STATS_CELLS];
+};
+
+
+static inline struct midi_stats *midi_stats_new(struct midi_stats *self)
+{
+	if (!self)
+		self = (struct midi_stats *) malloc(sizeof(struct midi_stats));
+
+	memset(self, 0, sizeof(struct midi_stats));
+	self->tempo_min = UINT32_MAX;
+
+	return self;
+}
+
+static inline void midi_stats_begin(struct midi_stats *self, struct midi_stats_state *state)
+{
+	++self->files;
+	memset(state, 0, sizeof(struct midi_stats_state));
+}
+
+static inline void midi_stats_end(struct midi_stats *self, const struct midi_stats_state *state)
+{
+	self->duration_us += state->us;
+}
+
+static inline void midi_stats_name(struct midi_stats *self, const uint8_t *name, size_t size)
+{
+	if (self->track_name_count == MIDI_STATS_NAMES)
+		return;
+
+	size = MIDI_MIN(size, MIDI_STATS_NAME_SIZE - 1);
+	memcpy(self->track_names[self->track_name_count], name, size);
+	self->track_names[self->track_name_count++][size] = '\0';
+}
+
+static inline void midi_stats_tempo(struct midi_stats *self, uint32_t tempo)
+{
+	self->tempo_min = MIDI_MIN(self->tempo_min, tempo);
+	self->tempo_max = MIDI_MAX(self->tempo_max, tempo);
+}
+
+/// Count the note starting or ending in `cell`, note on events with a zero velocity ending it.
+static inline void midi_stats_note(struct midi_stats *self, struct midi_stats_state *state, uint8_t status, size_t cell, uint8_t velocity)
+{
+	uint8_t on = (status & 0xF0) == EventNoteOn && velocity;
+
+	if (on != state->sounding[cell]) {
+		state->sounding[cell] = on;
+		state->polyphony += on ? 1 : -1;
+		self->max_polyphony = MIDI_MAX(self->max_polyphony, state->polyphony);
+	}
+}
+
+/**
+Account for `message` happening at `us`, in the decode loop.
+Messages must come in time order for the polyphony to be right, as `midi_merge_next` returns them.
+*/
+static inline void midi_stats_message(struct midi_stats *self, struct midi_stats_state *state, const struct midi_message *message, uint64_t us)
+{
+	uint8_t status = message->status;
+
+	++self->events;
+	state->us = us;
+
+	if (status < 0xF0) {
+		++self->channel_events[(status >> 4) - 8][status & 0x0F];
+
+		if ((status & 0xE0) == EventNoteOff) {
+			uint8_t pitch = message->data[0] & 0x7F, velocity = message->data[1] & 0x7F;
+
+			if ((status & 0xF0) == EventNoteOn && velocity) {
+				++self->pitches[pitch];
+				++self->velocities[velocity];
+			}
+			midi_stats_note(self, state, status, (status & 0x0F) * 128 + pitch, velocity);
+		}
+		return;
+	}
+
+	if (status != 0xFF) {
+		++self->sysex_events;
+		return;
+	}
+
+	++self->meta_events[message->meta_type & 0x7F];
+
+	if (message->meta_type == MetaTrackName)
+		midi_stats_name(self, message->data, message->size);
+	else if (message->meta_type == MetaSetTempo && message->size >= 3)
+		midi_stats_tempo(self, message->data[0] << 16 | message->data[1] << 8 | message->data[2]);
+}
+
+/**
+Add the statistics of the MIDI file in `data`, decoded once with the tracks merged.
+Return `MIDI_Success` or the error that stopped decoding.
+*/
+static inline int midi_stats_file(struct midi_stats *self, const uint8_t *data, size_t size)
+{
+	struct midi_stats_state state;
+	struct midi_merge merge;
+	struct midi_message message;
+
+	if (!midi_merge_new(&merge, data, size))
+		return midi_status;
+
+	midi_stats_begin(self, &state);
+
+	while (midi_merge_next(&merge, &message))
+		midi_stats_message(self, &state, &message, merge.us);
+
+	midi_stats_end(self, &state);
+	midi_merge_free(&merge);
+
+	return midi_status;
+}
+
+/**
+Add the statistics of a `.midx` file, scanning its columns.
+Status bytes, pitches and velocities are counted in 4 interleaved histograms,
+so that runs of equal values do not serialize on the same counter.
+*/
+static inline void midi_stats_index(struct midi_stats *self, const struct midi_index *index)
+{
+	struct midi_stats_state state;
+	uint64_t count = index->header->event_count;
+	uint32_t (*statuses)[256] = (uint32_t (*)[256]) calloc(4 * 3, 256 * sizeof(uint32_t));
+	uint32_t (*pitches)[256] = statuses + 4, (*velocities)[256] = statuses + 8;
+	uint64_t i = 0;
+
+	if (!statuses) {
+		midi_status = MIDI_OutOfMemory;
+		return;
+	}
+
+	midi_stats_begin(self, &state);
+
+	// Histograms are flushed to the 64 bit totals before a 32 bit counter can overflow.
+	while (i < count) {
+		uint64_t end = MIDI_MIN(count, i + ((uint64_t) 1 << 31));
+
+		for (; i < end; ++i) {
+			uint8_t status = index->status[i];
+			uint32_t data = index->data[i];
+			uint32_t on = (status & 0xF0) == EventNoteOn && data >> 8 & 0x7F;
+
+			++statuses[i & 3][status];
+			pitches[i & 3][data & 0x7F] += on;
+			velocities[i & 3][data >> 8 & 0x7F] += on;
+
+			if ((status & 0xE0) == EventNoteOff)
+				midi_stats_note(self, &state, status, (status & 0x0F) * 128 + (data & 0x7F), data >> 8 & 0x7F);
+		}
+
+		for (size_t lane = 0; lane < 4; ++lane) {
+			for (size_t value = 0; value < 256; ++value) {
+				uint8_t status = value;
+
+				if (status >= 0x80 && status < 0xF0)
+					self->channel_events[(status >> 4) - 8][status & 0x0F] += statuses[lane][value];
+				else if (status == 0xF0 || status == 0xF7)
+					self->sysex_events += statuses[lane][value];
+
+				if (value < 128) {
+					self->pitches[value] += pitches[lane][value];
+					self->velocities[value] += velocities[lane][value];
+				}
+			}
+		}
+
+		memset(statuses, 0, 4 * 3 * 256 * sizeof(uint32_t));
+	}
+
+	// Meta events are few, they are looked at one by one.
+	for (i = 0; i < count; ++i) {
+		if (index->status[i] != 0xFF)
+			continue;
+
+		++self->meta_events[index->meta_type[i] & 0x7F];
+		if (index->meta_type[i] == MetaTrackName)
+			midi_stats_name(self, midi_index_payload(index, i), index->size_column[i]);
+	}
+
+	for (i = 0; i < index->header->tempo_count; ++i)
+		midi_stats_tempo(self, index->tempo[i].tempo);
+
+	self->events += count;
+	state.us = count ? index->us[count - 1] : 0;
+	midi_stats_end(self, &state);
+
+	free(statuses);
+	midi_status = MIDI_Success;
+}
+
+/// Add the partial result `other` to `self`.
+static inline void midi_stats_merge(struct midi_stats *self, const struct midi_stats *other)
+{
+	self->files += other->files;
+	self->events += other->events;
+	self->duration_us += other->duration_us;
+	self->max_polyphony = MIDI_MAX(self->max_polyphony, other->max_polyphony);
+	self->tempo_min = MIDI_MIN(self->tempo_min, other->tempo_min);
+	self->tempo_max = MIDI_MAX(self->tempo_max, other->tempo_max);
+
+	for (size_t type = 0; type < 7; ++type)
+		for (size_t channel = 0; channel < 16; ++channel)
+			self->channel_events[type][channel] += other->channel_events[type][channel];
+
+	self->sysex_events += other->sysex_events;
+
+	for (size_t i = 0; i < 128; ++i) {
+		self->meta_events[i] += other->meta_events[i];
+		self->pitches[i] += other->pitches[i];
+		self->velocities[i] += other->velocities[i];
+	}
+
+	for (size_t i = 0; i < other->track_name_count; ++i)
+		midi_stats_name(self, (const uint8_t *) other->track_names[i], strlen(other->track_names[i]));
+}
+
+static inline void midi_stats_print(const struct midi_stats *self, FILE *output)
+{
+	static const char *types[7] = {
+		"note off", "note on", "key pressure", "controller", "program", "channel pressure", "pitch bend"
+	};
+
+	fprintf(output, "files\t%" PRIu64 "\nevents\t%" PRIu64 "\nduration\t%.3f s\nmax polyphony\t%u\n",
+		self->files, self->events, self->duration_us / 1E6, self->max_polyphony);
+
+	if (self->tempo_max)
+		fprintf(output, "tempo\t%u - %u us per quarter note\n", self->tempo_min, self->tempo_max);
+
+	for (size_t type = 0; type < 7; ++type) {
+		uint64_t total = 0;
+		for (size_t channel = 0; channel < 16; ++channel)
+			total += self->channel_events[type][channel];
+
+		if (!total)
+			continue;
+
+		fprintf(output, "%s\t%" PRIu64 "\t", types[type], total);
+		for (size_t channel = 0; channel < 16; ++channel)
+			fprintf(output, " %" PRIu64, self->channel_events[type][channel]);
+		putc('\n', output);
+	}
+
+	fprintf(output, "sysex\t%" PRIu64 "\nmeta", self->sysex_events);
+	for (size_t i = 0; i < 128; ++i)
+		if (self->meta_events[i])
+			fprintf(output, " %zx:%" PRIu64, i, self->meta_events[i]);
+
+	fprintf(output, "\npitches");
+	for (size_t i = 0; i < 128; ++i)
+		if (self->pitches[i])
+			fprintf(output, " %zu:%" PRIu64, i, self->pitches[i]);
+
+	fprintf(output, "\nvelocities");
+	for (size_t i = 0; i < 128; ++i)
+		if (self->velocities[i])
+			fprintf(output, " %zu:%" PRIu64, i, self->velocities[i]);
+	putc('\n', output);
+
+	for (size_t i = 0; i < self->track_name_count; ++i)
+		fprintf(output, "track name\t%s\n", self->track_names[i]);
+}
+
+
+#endif /* MIDI_STATS_H */
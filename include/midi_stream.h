@@ -0,0 +1,545 @@
+#ifndef MIDI_STREAM_H
+#define MIDI_STREAM_H
+
+
+#include <stdio.h>
+#include <string.h>
+
+#include "midi_parser.h"
+
+
+/// Size of the scratch buffer holding meta event payloads, larger payloads are truncated.
+#define MIDI_STREAM_PAYLOAD_SIZE 128
+
+/// Bytes read from the file at a time by `midi_follow_poll`.
+#define MIDI_FOLLOW_BUFFER_SIZE (1 << 16)
+
+
+enum MIDI_StreamMode
+{
+	// Bytes start with the `MThd` chunk of a standard MIDI file.
+	StreamFile,
+	// Bytes are the body of a single track chunk of unknown length.
+	StreamTrack,
+	// Bytes start with the `MThd` chunk of a file still being written:
+	// track chunk lengths may not be final, tracks end with their end of track meta event.
+	StreamFollow
+};
+
+enum MIDI_StreamState
+{
+	StreamChunkHeader,
+	StreamHeader,
+	StreamSkip,
+	StreamDone,
+	StreamError,
+
+	// Every state from here on decodes bytes belonging to a track.
+	StreamDeltaTime,
+	StreamStatus,
+	StreamData,
+	StreamMetaType,
+	StreamLength,
+	StreamPayload
+};
+
+
+struct midi_stream_event
+{
+	uint16_t track;
+	// Absolute timestamp in ticks from the start of the track.
+	uint32_t timestamp;
+	struct midi_event event;
+};
+
+
+/**
+Resumable push parser.
+Bytes are fed in chunks of any size and a VLQ, sysex or meta event may be split
+between them. It never blocks, never seeks and never allocates.
+*/
+struct midi_stream
+{
+	// Either `callback` is called for every event, or events are stored in `events`.
+	void (*callback)(void *context, struct midi_stream_event *event);
+	void *context;
+
+	struct midi_stream_event *events;
+	size_t event_capacity, event_count;
+
+	struct midi_header header;
+
+	uint8_t mode;
+	uint8_t state;
+	// Ignore the chunk length, tracks end with their end of track meta event.
+	uint8_t unbounded;
+	uint8_t running_status;
+	uint8_t count;
+
+	uint16_t track;
+	// VLQ being accumulated.
+	uint32_t value;
+	// Bytes left in the current chunk.
+	uint32_t remaining;
+	// Bytes of the current data, payload or chunk header received so far.
+	uint32_t position;
+
+	uint8_t chunk[8];
+	uint8_t payload[MIDI_STREAM_PAYLOAD_SIZE];
+
+	struct midi_stream_event current;
+};
+
+
+static inline struct midi_stream *midi_stream_new(struct midi_stream *self, uint8_t mode)
+{
+	if (!self)
+		self = (struct midi_stream *) malloc(sizeof(struct midi_stream));
+
+	memset(self, 0, sizeof(struct midi_stream));
+	self->mode = mode;
+	self->unbounded = mode != StreamFile;
+
+	if (mode == StreamTrack) {
+		self->state = StreamDeltaTime;
+	} else {
+		self->state = StreamChunkHeader;
+	}
+
+	midi_status = MIDI_Success;
+	return self;
+}
+
+/// Store events in `events` instead of calling a callback, `midi_stream_feed` stops when it is full.
+static inline void midi_stream_output(struct midi_stream *self, struct midi_stream_event *events, size_t capacity)
+{
+	self->callback = NULL;
+	self->events = events;
+	self->event_capacity = capacity;
+	self->event_count = 0;
+}
+
+static inline uint8_t midi_stream_over(struct midi_stream *self)
+{
+	return self->state == StreamDone || self->state == StreamError;
+}
+
+
+/**
+Fill meta data of `self` from the complete payload in `data`, the same way `midi_event_meta_new` does.
+*/
+static inline void midi_event_meta_decode(struct midi_event *self, const uint8_t *data, size_t size)
+{
+	switch (self->meta_type) {
+	#if MIDI_META_EVENT >= 1
+		case MetaSetTempo:
+			if (size >= 3)
+				self->meta_data.tempo = data[0] << 16 | data[1] << 8 | data[2];
+			break;
+	#endif
+	#if MIDI_META_EVENT >= 2
+		case MetaSequence:
+			if (size >= 2)
+				self->meta_data.sequence_number = data[0] << 8 | data[1];
+			break;
+		case MetaChannelPrefix:
+			if (size >= 1)
+				self->meta_data.channel_prefix = data[0];
+			break;
+		case MetaTimeSignature:
+			memcpy(self->meta_data.time_signature, data, MIDI_MIN(size, 4));
+			break;
+		case MetaKeySignature:
+			memcpy(self->meta_data.key_signature, data, MIDI_MIN(size, 2));
+			break;
+	#endif
+	#if MIDI_META_EVENT >= 3
+		case MetaSMPTEOffset:
+			memcpy(self->meta_data.SMPTE_offset, data, MIDI_MIN(size, 5));
+			break;
+
+		case MetaSequencerSpecific:
+			memcpy(self->meta_data.sequencer_specific, data, MIDI_MIN(size, sizeof(self->meta_data.sequencer_specific)));
+			break;
+
+		case MetaText:
+		case MetaCopyright:
+		case MetaTrackName:
+		case MetaInstrumentName:
+		case MetaLyrics:
+		case MetaMarker:
+		case MetaCuePoint: {
+			size_t read_size = MIDI_MIN(size, sizeof(self->meta_data.text) - 1);
+			memcpy(self->meta_data.text, data, read_size);
+			self->meta_data.text[read_size] = 0;
+			break;
+		}
+	#endif
+	}
+}
+
+/// Move on to the next chunk, or finish once every track has been read.
+static inline void midi_stream_track_end(struct midi_stream *self)
+{
+	if (self->mode == StreamTrack || self->track >= self->header.track_count)
+		self->state = StreamDone;
+	else
+		self->state = StreamChunkHeader;
+}
+
+/// Hand the completed event out, return 0 if the output array is full.
+static inline uint8_t midi_stream_emit(struct midi_stream *self)
+{
+	struct midi_stream_event *current = &self->current;
+	struct midi_event *event = &current->event;
+
+	if (event->status == 0xFF)
+		midi_event_meta_decode(event, self->payload, MIDI_MIN(event->size, MIDI_STREAM_PAYLOAD_SIZE));
+
+	// `midi_stream_feed` consumes nothing while the array is full, there is room for this one.
+	if (self->callback)
+		self->callback(self->context, current);
+	else
+		self->events[self->event_count++] = *current;
+
+	if (event->status == 0xFF && event->meta_type == MetaEndOfTrack) {
+		if (!self->unbounded && self->remaining)
+			self->state = StreamSkip;
+		else
+			midi_stream_track_end(self);
+	} else {
+		self->state = StreamDeltaTime;
+	}
+
+	return self->callback || self->event_count < self->event_capacity;
+}
+
+/// Accumulate one byte of a VLQ, return 1 once it is complete.
+static inline uint8_t midi_stream_value(struct midi_stream *self, uint8_t byte)
+{
+	self->value = self->value << 7 | (byte & 0x7F);
+
+	if (++self->count > 4) {
+		midi_status = MIDI_PotentialBufferOverflow;
+		self->state = StreamError;
+		return 0;
+	}
+
+	return !(byte & 0x80);
+}
+
+/// Act on a complete delta time or length, return 0 if the output array is full.
+static inline uint8_t midi_stream_value_end(struct midi_stream *self)
+{
+	struct midi_event *event = &self->current.event;
+	uint32_t value = self->value;
+
+	self->value = self->count = 0;
+
+	if (self->state == StreamDeltaTime) {
+		event->dtime = value;
+		self->current.timestamp += value;
+		self->state = StreamStatus;
+		return 1;
+	}
+
+	event->size = value;
+	self->position = 0;
+	self->state = StreamPayload;
+
+	return event->size || midi_stream_emit(self);
+}
+
+static inline void midi_stream_chunk(struct midi_stream *self)
+{
+	uint32_t size = self->chunk[4] << 24 | self->chunk[5] << 16 | self->chunk[6] << 8 | self->chunk[7];
+
+	self->remaining = size;
+	self->position = 0;
+
+	if (!memcmp(self->chunk, "MThd", 4)) {
+		// The header counts its 6 bytes down from `remaining`.
+		if (size < 6) {
+			midi_status = MIDI_InvalidHeaderChunk;
+			self->state = StreamError;
+			return;
+		}
+		self->state = StreamHeader;
+	} else if (!memcmp(self->chunk, "MTrk", 4)) {
+		if (self->track >= self->header.track_count) {
+			self->state = StreamSkip;
+			return;
+		}
+
+		self->current.track = self->track++;
+		self->current.timestamp = 0;
+		self->running_status = 0;
+		self->state = StreamDeltaTime;
+	} else {
+		// Unknown chunks must be skipped.
+		self->state = StreamSkip;
+	}
+}
+
+/**
+Consume `size` bytes and emit every event completed by them.
+Return the number of bytes consumed, which is less than `size` only when the output array
+filled up or the stream is over. While the array is full no byte is consumed and no event is lost:
+feed the rest again once the events have been drained by resetting `event_count`.
+*/
+static inline size_t midi_stream_feed(struct midi_stream *self, const uint8_t *bytes, size_t size)
+{
+	size_t i = 0;
+	uint8_t byte;
+	struct midi_event *event = &self->current.event;
+
+	midi_status = MIDI_Success;
+
+	while (i < size && !midi_stream_over(self)) {
+		// Stop before the byte that could complete an event with nowhere to store it.
+		if (!self->callback && self->event_count == self->event_capacity)
+			break;
+
+		uint8_t in_track = self->state >= StreamDeltaTime && !self->unbounded;
+
+		if (in_track && !self->remaining) {
+			// A track without an end of track meta event ends with its chunk.
+			if (self->state != StreamDeltaTime || self->count) {
+				midi_status = MIDI_InvalidTrackChunk;
+				self->state = StreamError;
+				break;
+			}
+			midi_stream_track_end(self);
+			continue;
+		}
+
+		switch (self->state) {
+		case StreamDeltaTime:
+		case StreamLength:
+			// Decode the whole value at once unless it was split by the previous chunk.
+			if (!self->count) {
+				const uint8_t *end = bytes + size;
+				if (in_track)
+					end = bytes + i + MIDI_MIN(size - i, self->remaining);
+
+				size_t n = midi_value_decode(bytes + i, end, &self->value);
+				if (n) {
+					i += n;
+					if (in_track)
+						self->remaining -= n;
+					if (!midi_stream_value_end(self))
+						return i;
+					continue;
+				}
+			}
+			break;
+
+		case StreamSkip: {
+			size_t skip = MIDI_MIN(size - i, self->remaining);
+			i += skip;
+			self->remaining -= skip;
+			if (!self->remaining)
+				midi_stream_track_end(self);
+			continue;
+		}
+
+		case StreamPayload: {
+			size_t available = size - i;
+			if (in_track)
+				available = MIDI_MIN(available, self->remaining);
+
+			size_t n = MIDI_MIN(available, event->size - self->position);
+			uint8_t *buffer = self->payload;
+			size_t capacity = MIDI_STREAM_PAYLOAD_SIZE;
+
+			#ifdef MIDI_SYSEX_EVENT
+				if (event->status != 0xFF) {
+					buffer = event->sysex_data;
+					capacity = sizeof(event->sysex_data);
+				}
+			#endif
+
+			if (self->position < capacity)
+				memcpy(buffer + self->position, bytes + i, MIDI_MIN(n, capacity - self->position));
+
+			i += n;
+			self->position += n;
+			if (in_track)
+				self->remaining -= n;
+
+			if (self->position == event->size && !midi_stream_emit(self))
+				return i;
+			continue;
+		}
+		}
+
+		byte = bytes[i++];
+		if (in_track)
+			--self->remaining;
+
+		switch (self->state) {
+		case StreamChunkHeader:
+			self->chunk[self->position++] = byte;
+			if (self->position == sizeof(self->chunk))
+				midi_stream_chunk(self);
+			break;
+
+		case StreamHeader:
+			// Collect the 6 bytes we know of in `chunk` and skip any extension.
+			self->chunk[self->position++] = byte;
+			--self->remaining;
+
+			if (self->position == 6) {
+				self->header.format = self->chunk[0] << 8 | self->chunk[1];
+				self->header.track_count = self->chunk[2] << 8 | self->chunk[3];
+				self->header.time_division = self->chunk[4] << 8 | self->chunk[5];
+				self->position = 0;
+				self->state = self->remaining ? StreamSkip : StreamChunkHeader;
+			}
+			break;
+
+		case StreamDeltaTime:
+		case StreamLength:
+			if (midi_stream_value(self, byte) && !midi_stream_value_end(self))
+				return i;
+			break;
+
+		case StreamStatus:
+			if (byte < 0x80) {
+				// Running status, `byte` is the first data byte.
+				if (!self->running_status) {
+					midi_status = MIDI_NoCaseMatch;
+					self->state = StreamError;
+					break;
+				}
+				event->status = self->running_status;
+			} else {
+				event->status = byte;
+			}
+
+			switch (event->status & 0xF0) {
+			case EventNoteOff:
+			case EventNoteOn:
+			case EventKeyPressure:
+			case EventControllerChange:
+			case EventPitchBend:
+				event->size = 2;
+				break;
+			case EventProgramChange:
+			case EventChannelPressure:
+				event->size = 1;
+				break;
+
+			case EventSystemExclusive:
+				// SystemExclusive events and meta events cancel any running status which was in effect.
+				self->running_status = 0;
+
+				switch (event->status) {
+				case 0xF0: // System exclusive message begin
+				case 0xF7: // System exclusive message end or continuation packet
+					self->state = StreamLength;
+					break;
+				case 0xFF:
+					self->state = StreamMetaType;
+					break;
+				default:
+					midi_status = MIDI_NoCaseMatch;
+					self->state = StreamError;
+				}
+				continue;
+			}
+
+			self->running_status = event->status;
+			self->position = 0;
+
+			if (byte >= 0x80) {
+				self->state = StreamData;
+				break;
+			}
+
+			event->midi_data[self->position++] = byte;
+			// fallthrough
+		case StreamData:
+			if (self->state == StreamData)
+				event->midi_data[self->position++] = byte;
+
+			if (self->position == event->size && !midi_stream_emit(self))
+				return i;
+			else if (self->position < event->size)
+				self->state = StreamData;
+			break;
+
+		case StreamMetaType:
+			event->meta_type = byte;
+			self->state = StreamLength;
+			break;
+
+		}
+	}
+
+	return i;
+}
+
+
+/**
+Tail follower of a MIDI file still being written, such as a live capture.
+The push parser keeps the state of the track being decoded between polls,
+so each poll decodes only the bytes appended since the previous one.
+*/
+struct midi_follow
+{
+	struct midi_stream stream;
+
+	// Bytes of the file decoded so far, where the next poll starts reading.
+	uint64_t offset;
+
+	uint8_t buffer[MIDI_FOLLOW_BUFFER_SIZE];
+};
+
+
+/// Follow a file from its start, `callback` is called for every event.
+static inline struct midi_follow *midi_follow_new(
+	struct midi_follow *self, void *context, void (*callback)(void *context, struct midi_stream_event *event)
+)
+{
+	if (!self)
+		self = (struct midi_follow *) malloc(sizeof(struct midi_follow));
+
+	midi_stream_new(&self->stream, StreamFollow);
+	self->stream.callback = callback;
+	self->stream.context = context;
+	self->offset = 0;
+
+	return self;
+}
+
+/**
+Decode whatever was appended to `file` since the last poll.
+An event cut by the end of the file is completed by a later poll.
+Return the number of bytes decoded, with `midi_status` set if the file is malformed.
+*/
+static inline size_t midi_follow_poll(struct midi_follow *self, FILE *file)
+{
+	size_t total = 0, size;
+
+	midi_status = MIDI_Success;
+
+	// Seeking also clears the end of file indicator left by the previous poll.
+	if (midi_stream_over(&self->stream) || fseek(file, (long) self->offset, SEEK_SET))
+		return 0;
+
+	while ((size = fread(self->buffer, 1, sizeof(self->buffer), file))) {
+		size_t used = midi_stream_feed(&self->stream, self->buffer, size);
+
+		self->offset += used;
+		total += used;
+
+		if (used < size)
+			break;
+	}
+
+	return total;
+}
+
+
+#endif /* MIDI_STREAM_H */
@@ -0,0 +1,317 @@
+#ifndef MIDI_TRANSFORM_H
+#define MIDI_TRANSFORM_H
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "midi_parser.h"
+#include "midi_writer.h"
+
+
+/// Events decoded, transformed and written at a time.
+#define MIDI_TRANSFORM_BATCH 256
+#define MIDI_TRANSFORM_STAGES 16
+
+/// Channel map entry of a channel whose events are dropped.
+#define MIDI_TRANSFORM_DROP 0xFF
+
+/// Channel 10, percussion, is never transposed.
+#define MIDI_TRANSFORM_DRUMS 9
+
+
+enum MIDI_TransformType
+{
+	// Move notes by `semitones`, notes pushed out of range are dropped.
+	TransformTranspose,
+	// Round every event to the nearest multiple of `grid` ticks.
+	TransformQuantize,
+	// Move the events of channel `i` to `channels[i]`, or drop them.
+	TransformChannels,
+	// Multiply every tempo by `numerator / denominator`, stretching the time of the piece.
+	TransformTempo
+};
+
+struct midi_transform_stage
+{
+	enum MIDI_TransformType type;
+
+	union
+	{
+		int8_t semitones;
+		uint32_t grid;
+		uint8_t channels[16];
+
+		struct
+		{
+			uint32_t numerator, denominator;
+		}
+		tempo;
+	};
+};
+
+/**
+Event of a batch, small enough to be transformed in place.
+Payloads of system exclusive and meta events stay in the input buffer.
+*/
+struct midi_compact_event
+{
+	uint32_t tick;
+	// 0 once a stage dropped the event.
+	uint8_t status;
+	uint8_t meta_type;
+	// Data bytes of channel events, or the payload of a tempo event a stage rewrote.
+	uint8_t data[3];
+	uint32_t size;
+	// NULL when the payload is in `data`.
+	const uint8_t *payload;
+};
+
+/**
+Stages applied in order to fixed size batches of events, one track at a time,
+between a cursor over the input buffer and a writer.
+Nothing is allocated per event and the batch has a fixed size. The output tracks stay under
+`spill_size` bytes each, so with an input mapped rather than loaded, memory does not depend on the file.
+*/
+struct midi_transform
+{
+	uint32_t stage_count;
+	struct midi_transform_stage stages[MIDI_TRANSFORM_STAGES];
+
+	// `spill_size` of the writer, bytes an output track keeps in memory, 0 for no limit.
+	size_t spill_size;
+
+	uint32_t count;
+	struct midi_compact_event batch[MIDI_TRANSFORM_BATCH];
+};
+
+
+static inline struct midi_transform *midi_transform_new(struct midi_transform *self)
+{
+	if (!self)
+		self = (struct midi_transform *) malloc(sizeof(struct midi_transform));
+
+	self->stage_count = 0;
+	self->spill_size = 0;
+	self->count = 0;
+
+	return self;
+}
+
+/// Append `stage` to the pipeline, return NULL if there is no room left.
+static inline struct midi_transform *midi_transform_add(struct midi_transform *self, const struct midi_transform_stage *stage)
+{
+	if (self->stage_count == MIDI_TRANSFORM_STAGES || (stage->type == TransformQuantize && !stage->grid)
+	|| (stage->type == TransformTempo && (!stage->tempo.numerator || !stage->tempo.denominator))) {
+		midi_status = MIDI_PotentialBufferOverflow;
+		return NULL;
+	}
+
+	self->stages[self->stage_count++] = *stage;
+
+	midi_status = MIDI_Success;
+	return self;
+}
+
+static inline uint8_t midi_transform_has(const struct midi_transform *self, enum MIDI_TransformType type)
+{
+	for (uint32_t i = 0; i < self->stage_count; ++i)
+		if (self->stages[i].type == type)
+			return 1;
+
+	return 0;
+}
+
+/// Store `tempo` multiplied by the ratio of `stage` in the payload of `event`.
+static inline void midi_transform_tempo(const struct midi_transform_stage *stage, struct midi_compact_event *event, uint32_t tempo)
+{
+	uint64_t scaled = ((uint64_t) tempo * stage->tempo.numerator + stage->tempo.denominator / 2) / stage->tempo.denominator;
+
+	scaled = MIDI_MAX(MIDI_MIN(scaled, 0xFFFFFF), 1);
+
+	event->data[0] = (uint8_t) (scaled >> 16);
+	event->data[1] = (uint8_t) (scaled >> 8);
+	event->data[2] = (uint8_t) scaled;
+	event->payload = NULL;
+	event->size = 3;
+}
+
+/// Run one stage over the batch.
+static inline void midi_transform_stage_apply(const struct midi_transform_stage *stage, struct midi_compact_event *events, uint32_t count)
+{
+	switch (stage->type) {
+	case TransformTranspose:
+		for (uint32_t i = 0; i < count; ++i) {
+			struct midi_compact_event *event = events + i;
+			uint8_t type = event->status & 0xF0;
+
+			if ((type != EventNoteOff && type != EventNoteOn && type != EventKeyPressure)
+			|| (event->status & 0x0F) == MIDI_TRANSFORM_DRUMS)
+				continue;
+
+			int pitch = event->data[0] + stage->semitones;
+			if (pitch < 0 || pitch > 127)
+				event->status = 0;
+			else
+				event->data[0] = (uint8_t) pitch;
+		}
+		break;
+
+	case TransformQuantize:
+		// Rounding keeps the order of the events, so tracks stay sorted.
+		for (uint32_t i = 0; i < count; ++i)
+			events[i].tick = (uint32_t) (((uint64_t) events[i].tick + stage->grid / 2) / stage->grid * stage->grid);
+		break;
+
+	case TransformChannels:
+		for (uint32_t i = 0; i < count; ++i) {
+			struct midi_compact_event *event = events + i;
+			uint8_t channel;
+
+			if (!event->status || event->status >= 0xF0)
+				continue;
+
+			channel = stage->channels[event->status & 0x0F];
+			event->status = channel == MIDI_TRANSFORM_DROP ? 0 : (event->status & 0xF0) | (channel & 0x0F);
+		}
+		break;
+
+	case TransformTempo:
+		for (uint32_t i = 0; i < count; ++i) {
+			struct midi_compact_event *event = events + i;
+			const uint8_t *data = event->payload ? event->payload : event->data;
+
+			if (event->status == 0xFF && event->meta_type == MetaSetTempo && event->size >= 3)
+				midi_transform_tempo(stage, event, data[0] << 16 | data[1] << 8 | data[2]);
+		}
+		break;
+	}
+}
+
+/// Run every stage over the batch, then add what is left of it to `track` of `writer`.
+static inline int midi_transform_flush(struct midi_transform *self, struct midi_writer *writer, uint16_t track)
+{
+	for (uint32_t i = 0; i < self->stage_count; ++i)
+		midi_transform_stage_apply(self->stages + i, self->batch, self->count);
+
+	for (uint32_t i = 0; i < self->count; ++i) {
+		const struct midi_compact_event *event = self->batch + i;
+
+		if (!event->status)
+			continue;
+
+		if (event->status < 0xF0) {
+			if (!midi_writer_event(writer, track, event->tick, event->status, event->data[0], event->data[1]))
+				return midi_status;
+		} else if (!midi_writer_payload(writer, track, event->tick, event->status, event->meta_type,
+			event->payload ? event->payload : event->data, event->size)) {
+			return midi_status;
+		}
+	}
+
+	self->count = 0;
+	return midi_status = MIDI_Success;
+}
+
+/// Append `message` to the batch, flushing it first when full.
+static inline int midi_transform_push(struct midi_transform *self, struct midi_writer *writer, const struct midi_message *message)
+{
+	struct midi_compact_event *event;
+
+	if (self->count == MIDI_TRANSFORM_BATCH && midi_transform_flush(self, writer, message->track))
+		return midi_status;
+
+	event = self->batch + self->count++;
+	event->tick = message->timestamp;
+	event->status = message->status;
+	event->meta_type = message->meta_type;
+	event->size = message->size;
+
+	if (message->status < 0xF0) {
+		event->data[0] = message->data[0];
+		event->data[1] = message->size > 1 ? message->data[1] : 0;
+		event->payload = NULL;
+	} else {
+		event->payload = message->data;
+	}
+
+	return MIDI_Success;
+}
+
+/**
+The tempo stretch must apply to the default tempo of files that never set it at the start:
+add a tempo event of 120 BPM at tick 0 of the first track unless it has one at that tick.
+*/
+static inline void midi_transform_default_tempo(struct midi_transform *self, const struct midi_cursor *cursor)
+{
+	struct midi_cursor ahead = *cursor;
+	struct midi_message message;
+	struct midi_compact_event *event;
+
+	while (midi_cursor_next(&ahead, &message) && !message.timestamp)
+		if (message.status == 0xFF && message.meta_type == MetaSetTempo)
+			return;
+
+	event = self->batch + self->count++;
+	event->tick = 0;
+	event->status = 0xFF;
+	event->meta_type = MetaSetTempo;
+	event->size = 3;
+	event->payload = NULL;
+	event->data[0] = 0x07;
+	event->data[1] = 0xA1;
+	event->data[2] = 0x20;
+}
+
+/**
+Transform the MIDI file in `data` into `writer`, created here with the same header and `spill_size`.
+Tracks are read one after the other, each in batches of `MIDI_TRANSFORM_BATCH` events.
+Return `MIDI_Success` or the error that stopped it. `writer` must be freed either way.
+*/
+static inline int midi_transform_file(struct midi_transform *self, const uint8_t *data, size_t size, struct midi_writer *writer)
+{
+	struct midi_header header;
+	struct midi_cursor cursor;
+	struct midi_message message;
+	const uint8_t *chunk, *end;
+
+	writer->tracks = NULL;
+	writer->header.track_count = 0;
+
+	if (!(data = midi_smf(data, &size)))
+		return midi_status;
+	end = data + size;
+
+	if (!(chunk = midi_header_decode(&header, data, size)))
+		return midi_status;
+
+	if (!midi_writer_new(writer, header.format, header.track_count, header.time_division))
+		return midi_status;
+	writer->spill_size = self->spill_size;
+
+	for (uint16_t track = 0; track < header.track_count; ++track) {
+		if (!(chunk = midi_chunk_track(chunk, end)))
+			return midi_status;
+
+		midi_cursor_new(&cursor, chunk, track);
+		self->count = 0;
+
+		if (!track && midi_transform_has(self, TransformTempo))
+			midi_transform_default_tempo(self, &cursor);
+
+		while (midi_cursor_next(&cursor, &message))
+			if (midi_transform_push(self, writer, &message))
+				return midi_status;
+
+		if (midi_status != MIDI_Success || midi_transform_flush(self, writer, track))
+			return midi_status;
+
+		chunk = midi_cursor_chunk_end(&cursor);
+	}
+
+	return midi_status = MIDI_Success;
+}
+
+
+#endif /* MIDI_TRANSFORM_H */
@@ -0,0 +1,341 @@
+#ifndef MIDI_WRITER_H
+#define MIDI_WRITER_H
+
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "midi_parser.h"
+
+
+/// Longest delta time a 4 byte variable length quantity holds.
+#define MIDI_VALUE_MAX 0x0FFFFFFF
+
+/// Channel event with its status and delta time, the most a single event adds besides payloads.
+#define MIDI_WRITER_EVENT_SIZE 8
+
+/// Bytes copied at a time from a spill file to the output.
+#define MIDI_WRITER_COPY_SIZE (1 << 16)
+
+
+/**
+Events of one track, encoded as they are added.
+The buffer starts with its chunk header, the length of which is back patched by `midi_writer_finalize`.
+Events moved out to the spill file come before the ones still in the buffer.
+*/
+struct midi_writer_track
+{
+	uint8_t *data;
+	size_t size, capacity;
+
+	FILE *spill;
+	uint64_t spilled;
+
+	// Absolute tick of the last event, delta times are taken from it.
+	uint32_t tick;
+
+	uint8_t running_status;
+	uint8_t end_of_track;
+};
+
+struct midi_writer
+{
+	struct midi_header header;
+	struct midi_writer_track *tracks;
+
+	// A track buffer about to grow past this many bytes moves its events to a temporary file,
+	// 0 keeps every track in memory.
+	size_t spill_size;
+};
+
+
+/**
+Encode `value` in as few bytes as possible into `buffer`, which must have room for 4.
+Return the number of bytes written.
+*/
+static inline size_t midi_value_encode(uint8_t *buffer, uint32_t value)
+{
+	if (value < 0x80) {
+		buffer[0] = value;
+		return 1;
+	}
+
+	// Number of 7 bit groups, from the index of the highest set bit.
+	size_t size = (31 - __builtin_clz(value)) / 7 + 1;
+
+	for (size_t i = 0; i < size; ++i)
+		buffer[i] = (value >> 7 * (size - 1 - i) & 0x7F) | 0x80;
+	buffer[size - 1] &= 0x7F;
+
+	return size;
+}
+
+
+static inline void midi_writer_free(struct midi_writer *self)
+{
+	if (self->tracks) {
+		for (size_t i = 0; i < self->header.track_count; ++i) {
+			free(self->tracks[i].data);
+			if (self->tracks[i].spill)
+				fclose(self->tracks[i].spill);
+		}
+		free(self->tracks);
+		self->tracks = NULL;
+	}
+}
+
+static inline struct midi_writer *midi_writer_new(struct midi_writer *self, uint16_t format, uint16_t track_count, uint16_t time_division)
+{
+	if (!self)
+		self = (struct midi_writer *) malloc(sizeof(struct midi_writer));
+
+	self->header.format = format;
+	self->header.track_count = track_count;
+	self->header.time_division = time_division;
+	self->spill_size = 0;
+
+	if (!(self->tracks = (struct midi_writer_track *) calloc(track_count ? track_count : 1, sizeof(struct midi_writer_track)))) {
+		midi_status = MIDI_OutOfMemory;
+		return NULL;
+	}
+
+	midi_status = MIDI_Success;
+	return self;
+}
+
+/// Make room for `n` more bytes, growing the buffer geometrically. Return where they go.
+static inline uint8_t *midi_writer_reserve(struct midi_writer_track *self, size_t n)
+{
+	if (self->size + n > self->capacity) {
+		size_t capacity = self->capacity ? self->capacity : 1 << 12;
+		uint8_t *data;
+
+		while (self->size + n > capacity)
+			capacity *= 2;
+
+		if (!(data = (uint8_t *) realloc(self->data, capacity))) {
+			midi_status = MIDI_OutOfMemory;
+			return NULL;
+		}
+
+		self->data = data;
+		self->capacity = capacity;
+	}
+
+	return self->data + self->size;
+}
+
+/// Move the events in the buffer of `self` to its spill file, keeping the chunk header.
+static inline struct midi_writer_track *midi_writer_spill(struct midi_writer_track *self)
+{
+	size_t size = self->size - MIDI_TRACK_HEADER_SIZE;
+
+	if ((!self->spill && !(self->spill = tmpfile()))
+	|| fwrite(self->data + MIDI_TRACK_HEADER_SIZE, 1, size, self->spill) != size) {
+		midi_status = MIDI_WriteFailed;
+		return NULL;
+	}
+
+	self->spilled += size;
+	self->size = MIDI_TRACK_HEADER_SIZE;
+	return self;
+}
+
+/**
+Check `tick` against the track and reserve the delta time and `n` bytes after it.
+Return where the delta time goes.
+*/
+static inline uint8_t *midi_writer_begin(struct midi_writer *self, uint16_t track, uint32_t tick, size_t n)
+{
+	struct midi_writer_track *writer_track;
+
+	if (track >= self->header.track_count) {
+		midi_status = MIDI_InvalidTrackChunk;
+		return NULL;
+	}
+
+	writer_track = self->tracks + track;
+
+	if (writer_track->end_of_track || tick < writer_track->tick || tick - writer_track->tick > MIDI_VALUE_MAX) {
+		midi_status = MIDI_InvalidEvent;
+		return NULL;
+	}
+
+	// Leave room for the chunk header in front of the first event.
+	if (!writer_track->size) {
+		if (!midi_writer_reserve(writer_track, MIDI_TRACK_HEADER_SIZE))
+			return NULL;
+		memcpy(writer_track->data, "MTrk", 4);
+		writer_track->size = MIDI_TRACK_HEADER_SIZE;
+	}
+
+	if (self->spill_size && writer_track->size + 4 + n > self->spill_size
+	&& writer_track->size > MIDI_TRACK_HEADER_SIZE && !midi_writer_spill(writer_track))
+		return NULL;
+
+	if (!midi_writer_reserve(writer_track, 4 + n))
+		return NULL;
+
+	midi_status = MIDI_Success;
+	return writer_track->data + writer_track->size;
+}
+
+/**
+Add a channel event at the absolute `tick`.
+The status byte is left out whenever running status allows it.
+*/
+static inline struct midi_writer *midi_writer_event(struct midi_writer *self, uint16_t track, uint32_t tick, uint8_t status, uint8_t data1, uint8_t data2)
+{
+	struct midi_writer_track *writer_track;
+	uint8_t *buffer;
+
+	if (status < 0x80 || status >= 0xF0) {
+		midi_status = MIDI_InvalidEvent;
+		return NULL;
+	}
+
+	if (!(buffer = midi_writer_begin(self, track, tick, 3)))
+		return NULL;
+
+	writer_track = self->tracks + track;
+
+	buffer += midi_value_encode(buffer, tick - writer_track->tick);
+
+	if (status != writer_track->running_status)
+		*buffer++ = writer_track->running_status = status;
+
+	*buffer++ = data1 & 0x7F;
+	if ((status & 0xF0) != EventProgramChange && (status & 0xF0) != EventChannelPressure)
+		*buffer++ = data2 & 0x7F;
+
+	writer_track->size = buffer - writer_track->data;
+	writer_track->tick = tick;
+	return self;
+}
+
+/**
+Add an event with a length prefixed payload of `size` bytes at the absolute `tick`:
+a meta event of `type` for `status` 0xFF, otherwise a system exclusive message or packet.
+The payload is copied from `data` if it is not NULL.
+Return where the payload goes in the track, so it can be written in place, or NULL on failure.
+*/
+static inline uint8_t *midi_writer_payload(struct midi_writer *self, uint16_t track, uint32_t tick, uint8_t status, uint8_t type, const uint8_t *data, uint32_t size)
+{
+	struct midi_writer_track *writer_track;
+	uint8_t *buffer;
+
+	if ((status != 0xFF && status != 0xF0 && status != 0xF7) || type >= 0x80) {
+		midi_status = MIDI_InvalidEvent;
+		return NULL;
+	}
+
+	if (!(buffer = midi_writer_begin(self, track, tick, 2 + 4 + (size_t) size)))
+		return NULL;
+
+	writer_track = self->tracks + track;
+
+	buffer += midi_value_encode(buffer, tick - writer_track->tick);
+	*buffer++ = status;
+	if (status == 0xFF)
+		*buffer++ = type;
+	buffer += midi_value_encode(buffer, size);
+
+	if (data)
+		memcpy(buffer, data, size);
+
+	// System exclusive and meta events cancel any running status.
+	writer_track->running_status = 0;
+	writer_track->end_of_track = status == 0xFF && type == MetaEndOfTrack;
+	writer_track->size = buffer + size - writer_track->data;
+	writer_track->tick = tick;
+	return buffer;
+}
+
+static inline uint8_t *midi_writer_meta(struct midi_writer *self, uint16_t track, uint32_t tick, uint8_t type, const uint8_t *data, uint32_t size)
+{
+	return midi_writer_payload(self, track, tick, 0xFF, type, data, size);
+}
+
+static inline uint8_t *midi_writer_sysex(struct midi_writer *self, uint16_t track, uint32_t tick, uint8_t status, const uint8_t *data, uint32_t size)
+{
+	return midi_writer_payload(self, track, tick, status, 0, data, size);
+}
+
+/// Add a message decoded by `midi_cursor_next`, at its own timestamp.
+static inline struct midi_writer *midi_writer_message(struct midi_writer *self, const struct midi_message *message)
+{
+	if (message->status < 0xF0)
+		return midi_writer_event(self, message->track, message->timestamp, message->status, message->data[0], message->size > 1 ? message->data[1] : 0);
+
+	return midi_writer_payload(self, message->track, message->timestamp, message->status, message->meta_type, message->data, message->size) ? self : NULL;
+}
+
+/// Copy the spill file of `self` to `file`, return the number of bytes written.
+static inline size_t midi_writer_unspill(struct midi_writer_track *self, FILE *file)
+{
+	uint8_t buffer[MIDI_WRITER_COPY_SIZE];
+	size_t written = 0, size;
+
+	rewind(self->spill);
+	while ((size = fread(buffer, 1, sizeof(buffer), self->spill)))
+		written += fwrite(buffer, 1, size, file);
+
+	return written;
+}
+
+/**
+End every track that was not, back patch the chunk lengths and write the file.
+Return the number of bytes written, 0 on failure.
+*/
+static inline size_t midi_writer_finalize(struct midi_writer *self, FILE *file)
+{
+	const struct midi_header *header = &self->header;
+	const uint16_t fields[3] = { header->format, header->track_count, header->time_division };
+	uint8_t buffer[MIDI_HEADER_SIZE] = { 'M', 'T', 'h', 'd', 0, 0, 0, 6 };
+
+	for (size_t i = 0; i < 3; ++i) {
+		buffer[8 + 2 * i] = (uint8_t) (fields[i] >> 8);
+		buffer[9 + 2 * i] = (uint8_t) fields[i];
+	}
+
+	size_t written = fwrite(buffer, 1, sizeof(buffer), file);
+
+	for (uint16_t i = 0; i < header->track_count; ++i) {
+		struct midi_writer_track *track = self->tracks + i;
+
+		if (!track->end_of_track && !midi_writer_meta(self, i, track->tick, MetaEndOfTrack, NULL, 0))
+			return 0;
+
+		uint32_t length = (uint32_t) (track->spilled + track->size - MIDI_TRACK_HEADER_SIZE);
+		track->data[4] = (uint8_t) (length >> 24);
+		track->data[5] = (uint8_t) (length >> 16);
+		track->data[6] = (uint8_t) (length >> 8);
+		track->data[7] = (uint8_t) length;
+
+		if (!track->spill) {
+			written += fwrite(track->data, 1, track->size, file);
+			continue;
+		}
+
+		written += fwrite(track->data, 1, MIDI_TRACK_HEADER_SIZE, file);
+		if (midi_writer_unspill(track, file) != track->spilled) {
+			midi_status = MIDI_WriteFailed;
+			return 0;
+		}
+		written += track->spilled;
+		written += fwrite(track->data + MIDI_TRACK_HEADER_SIZE, 1, track->size - MIDI_TRACK_HEADER_SIZE, file);
+	}
+
+	if (ferror(file)) {
+		midi_status = MIDI_WriteFailed;
+		return 0;
+	}
+
+	midi_status = MIDI_Success;
+	return written;
+}
+
+
+#endif /* MIDI_WRITER_H */
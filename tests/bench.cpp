@@ -0,0 +1,292 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "midi_parser.hpp"
+#include "midi_writer.h"
+
+
+#define REPEAT 20
+#define VALUE_COUNT (1 << 20)
+
+
+struct result
+{
+	uint64_t checksum;
+	uint64_t events;
+};
+
+
+static result hand_written(FILE *midi)
+{
+	result total = { 0, 0 };
+	struct midi_event event;
+
+	fseek(midi, 0, SEEK_SET);
+	struct midi_parser *parser = midi_parser_new(NULL, midi);
+
+	for (; !parser->end_of_file; parser->timestamp += parser->dtime) {
+		midi_parser_next(parser, midi, &event);
+		if (parser->end_of_file)
+			break;
+
+		total.checksum += event.status ^ parser->timestamp ^ MIDI_TIME(parser);
+		++total.events;
+	}
+
+	free(parser);
+	return total;
+}
+
+template <class Policy>
+static result range_for(FILE *midi)
+{
+	result total = { 0, 0 };
+
+	fseek(midi, 0, SEEK_SET);
+
+	for (auto event : midi::basic_parser<Policy>(midi)) {
+		total.checksum += event.status() ^ event.timestamp ^ event.time_us;
+		++total.events;
+	}
+
+	return total;
+}
+
+#ifdef MIDI_COROUTINE
+static result coroutine(FILE *midi)
+{
+	result total = { 0, 0 };
+
+	fseek(midi, 0, SEEK_SET);
+
+	for (const midi::event_view &event : midi::events(midi)) {
+		total.checksum += event.status() ^ event.timestamp ^ event.time_us;
+		++total.events;
+	}
+
+	return total;
+}
+#endif
+
+template <class Function>
+static void measure(const char *name, FILE *midi, Function function)
+{
+	result total = { 0, 0 };
+	auto start = std::chrono::steady_clock::now();
+
+	for (size_t i = 0; i < REPEAT; ++i) {
+		result once = function(midi);
+		total.checksum += once.checksum;
+		total.events += once.events;
+	}
+
+	std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+	printf("%-16s%10lu events%10.1f ns/event\tchecksum %lx\n", name, total.events, elapsed.count() / total.events, total.checksum);
+}
+
+/// Delta time heavy synthetic track: mostly 1 byte values, some 2 and 3 byte ones.
+static uint8_t *synthetic_values(size_t *size)
+{
+	uint8_t *data = (uint8_t *) malloc(VALUE_COUNT * 4 + 8);
+	uint32_t seed = 1;
+	size_t position = 0;
+
+	for (size_t i = 0; i < VALUE_COUNT; ++i) {
+		seed = seed * 1103515245 + 12345;
+		uint32_t bits = seed >> 16 & 0x3F;
+		uint32_t value = (seed >> 8) & (bits < 44 ? 0x7F : bits < 60 ? 0x3FFF : 0x1FFFFF);
+
+		uint8_t groups[4];
+		size_t count = 0;
+		do {
+			groups[count++] = value & 0x7F;
+			value >>= 7;
+		} while (value);
+
+		while (count--)
+			data[position++] = groups[count] | (count ? 0x80 : 0);
+	}
+
+	*size = position;
+	return data;
+}
+
+template <class Decode>
+static void measure_values(const char *name, const uint8_t *data, size_t size, Decode decode)
+{
+	uint64_t checksum = 0;
+	auto start = std::chrono::steady_clock::now();
+
+	for (size_t i = 0; i < REPEAT; ++i) {
+		const uint8_t *position = data, *end = data + size;
+		uint32_t value = 0;
+
+		while (position < end) {
+			size_t used = decode(position, end, &value);
+			position += used;
+			checksum += value;
+		}
+	}
+
+	std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+	printf("%-16s%10.2f ns/value\tchecksum %lx\n", name, elapsed.count() / (REPEAT * (double) VALUE_COUNT), checksum);
+}
+
+/// `midi_value_read` from a memory stream, the path the `FILE` based decoder takes.
+static void measure_getc(const uint8_t *data, size_t size)
+{
+	uint64_t checksum = 0;
+	auto start = std::chrono::steady_clock::now();
+
+	for (size_t i = 0; i < REPEAT; ++i) {
+		FILE *memory = fmemopen((void *) data, size, "rb");
+
+		for (size_t j = 0; j < VALUE_COUNT; ++j)
+			checksum += midi_value_read(memory);
+
+		fclose(memory);
+	}
+
+	std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+	printf("%-16s%10.2f ns/value\tchecksum %lx\n", "getc", elapsed.count() / (REPEAT * (double) VALUE_COUNT), checksum);
+}
+
+/// Encode every message of `midi` again, decoded up front so only the writer is timed.
+static void measure_writer(FILE *midi)
+{
+	std::vector<midi_message> messages;
+	midi_header header = { 0, 0, 0 };
+	midi_cursor cursor;
+	midi_message message;
+	size_t size = 0, written = 0;
+
+	fseek(midi, 0, SEEK_SET);
+	uint8_t *data = midi_load(midi, &size);
+	const uint8_t *chunk = data ? midi_header_decode(&header, data, size) : NULL;
+
+	if (!chunk) {
+		free(data);
+		return;
+	}
+
+	for (uint16_t track = 0; track < header.track_count; ++track) {
+		if (!(chunk = midi_chunk_track(chunk, data + size)))
+			break;
+
+		midi_cursor_new(&cursor, chunk, track);
+		while (midi_cursor_next(&cursor, &message))
+			messages.push_back(message);
+		chunk = midi_cursor_chunk_end(&cursor);
+	}
+
+	FILE *sink = fopen("/dev/null", "wb");
+	auto start = std::chrono::steady_clock::now();
+
+	for (size_t i = 0; i < REPEAT; ++i) {
+		midi_writer writer;
+		midi_writer_new(&writer, header.format, header.track_count, header.time_division);
+
+		for (const midi_message &each : messages)
+			midi_writer_message(&writer, &each);
+
+		written = midi_writer_finalize(&writer, sink);
+		midi_writer_free(&writer);
+	}
+
+	std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+	printf("%-16s%10lu events%10.1f ns/event\t%lu -> %lu bytes\n", "writer", REPEAT * messages.size(), elapsed.count() / (REPEAT * messages.size()), size, written);
+
+	fclose(sink);
+	free(data);
+}
+
+/// Decode every track of `midi` with `next`, after validating it once outside the timing when `validate` is set.
+template <typename Next>
+static void measure_cursor(const char *name, FILE *midi, Next next, bool validate)
+{
+	midi_header header = { 0, 0, 0 };
+	midi_cursor cursor;
+	midi_message message;
+	uint64_t checksum = 0, events = 0;
+	size_t size = 0;
+
+	fseek(midi, 0, SEEK_SET);
+	uint8_t *data = midi_load(midi, &size);
+	const uint8_t *first = data ? midi_header_decode(&header, data, size) : NULL;
+
+	if (!first || (validate && midi_validate(data, size) != MIDI_Success)) {
+		free(data);
+		return;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+
+	for (size_t i = 0; i < REPEAT; ++i) {
+		const uint8_t *chunk = first;
+
+		for (uint16_t track = 0; track < header.track_count; ++track) {
+			if (!(chunk = midi_chunk_track(chunk, data + size)))
+				break;
+
+			midi_cursor_new(&cursor, chunk, track);
+			while (next(&cursor, &message)) {
+				checksum += message.timestamp + message.status;
+				++events;
+			}
+			chunk = midi_cursor_chunk_end(&cursor);
+		}
+	}
+
+	std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+	printf("%-16s%10lu events%10.1f ns/event\tchecksum %lx\n", name, events, elapsed.count() / (events ? events : 1), checksum);
+
+	free(data);
+}
+
+int main(int argc, char **argv)
+{
+	printf(
+		"event sizes: native %lu, realtime %lu, archival %lu bytes\n", sizeof(midi_event),
+		sizeof(midi::basic_event<midi::realtime>), sizeof(midi::basic_event<midi::archival>)
+	);
+
+	size_t size;
+	uint8_t *values = synthetic_values(&size);
+
+	printf("variable length values, %lu bytes\n", size);
+	measure_getc(values, size);
+	measure_values("scalar", values, size, [](const uint8_t *data, const uint8_t *end, uint32_t *value) {
+		return midi_value_decode_scalar(data, end, value);
+	});
+	measure_values("branchless", values, size, [](const uint8_t *data, const uint8_t *end, uint32_t *value) {
+		return midi_value_decode_branchless(data, end, value);
+	});
+
+	free(values);
+
+	for (int i = 1; i < argc; ++i) {
+		FILE *midi = fopen(argv[i], "rb");
+		if (!midi) {
+			perror(argv[i]);
+			continue;
+		}
+
+		printf("%s\n", argv[i]);
+		measure("hand written", midi, hand_written);
+		measure("range for", midi, range_for<midi::native>);
+		measure("realtime", midi, range_for<midi::realtime>);
+		measure("archival", midi, range_for<midi::archival>);
+		#ifdef MIDI_COROUTINE
+			measure("coroutine", midi, coroutine);
+		#endif
+		measure_cursor("checked", midi, midi_cursor_next, false);
+		measure_cursor("trusted", midi, midi_cursor_next_trusted, true);
+		measure_writer(midi);
+
+		fclose(midi);
+	}
+
+	return 0;
+}
@@ -0,0 +1,1204 @@
+/*
+Checks of the decoders on small files built here and on the files of `data/`,
+malformed ones included: every decoder must stop on them with an error, never hang.
+
+Usage:
+make check
+*/
+
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "midi_parser.h"
+#include "midi_stream.h"
+#include "midi_writer.h"
+#include "midi_transform.h"
+#include "midi_ngram.h"
+#include "midi_index.h"
+#include "midi_extract.h"
+#include "midi_stats.h"
+#include "midi_scheduler.h"
+#include "midi_fingerprint.h"
+#include "midi_roll.h"
+
+
+/// More events than any file checked here holds, a decoder going past it is looping.
+#define EVENT_LIMIT (1 << 16)
+
+#define CHECK(condition) check(condition, #condition, __FILE__, __LINE__)
+
+
+static int failures;
+
+static const char *files[] = { "data/moon.mid", "data/senbonzakura.mid", "data/turkish.mid" };
+
+/// Format 0 file of one track holding `events`, the chunk length taken from `size`.
+static const uint8_t *smf(const char *events, size_t size, size_t *file_size)
+{
+	static uint8_t data[256];
+
+	memcpy(data, "MThd\0\0\0\6\0\0\0\1\0\140MTrk", 18);
+	data[18] = (uint8_t) (size >> 24);
+	data[19] = (uint8_t) (size >> 16);
+	data[20] = (uint8_t) (size >> 8);
+	data[21] = (uint8_t) size;
+	memcpy(data + 22, events, size);
+
+	*file_size = 22 + size;
+	return data;
+}
+
+#define SMF(events, size) smf(events, sizeof(events) - 1, size)
+#define VALIDATE(events) validate_smf(events, sizeof(events) - 1)
+#define PARSE(events, status) parse_smf(events, sizeof(events) - 1, status)
+
+
+static void check(int condition, const char *expression, const char *file, int line)
+{
+	if (!condition) {
+		fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expression);
+		++failures;
+	}
+}
+
+static uint8_t *load(const char *path, size_t *size)
+{
+	FILE *midi = fopen(path, "rb");
+	uint8_t *data;
+
+	if (!midi) {
+		perror(path);
+		exit(1);
+	}
+
+	data = midi_load(midi, size);
+	fclose(midi);
+	return data;
+}
+
+/// Write `writer` out and read the file back, to be freed, NULL if it could not be written.
+static uint8_t *written(struct midi_writer *writer, size_t *size)
+{
+	FILE *file = tmpfile();
+	uint8_t *data = NULL;
+
+	if (midi_writer_finalize(writer, file)) {
+		rewind(file);
+		data = midi_load(file, size);
+	}
+
+	fclose(file);
+	return data;
+}
+
+/// Map the `.midx` sidecar of `data`, written to a temporary file removed once mapped.
+static struct midi_index *index_of(struct midi_index *index, const uint8_t *data, size_t size)
+{
+	char path[] = "/tmp/midi_checkXXXXXX";
+	FILE *file = fdopen(mkstemp(path), "wb");
+
+	if (!midi_index_write(data, size, file))
+		index = NULL;
+	fclose(file);
+
+	if (index)
+		index = midi_index_open(index, path);
+	unlink(path);
+	return index;
+}
+
+/**
+Decode `size` bytes of `data` with the FILE parser, return the events read or -1 if it did not stop.
+The bytes go through a temporary file, memory streams do not seek past their end as files do.
+*/
+static long parse(const uint8_t *data, size_t size, int *status)
+{
+	FILE *midi = tmpfile();
+	struct midi_parser *parser;
+	struct midi_event event;
+	long events = 0;
+
+	fwrite(data, 1, size, midi);
+	rewind(midi);
+
+	if (!(parser = midi_parser_new(NULL, midi))) {
+		*status = midi_status;
+		fclose(midi);
+		return 0;
+	}
+
+	*status = MIDI_Success;
+	for (; !parser->end_of_file && events < EVENT_LIMIT; parser->timestamp += parser->dtime) {
+		if (!midi_parser_next(parser, midi, &event)) {
+			*status = midi_status;
+			break;
+		}
+		if (!parser->end_of_file)
+			++events;
+	}
+
+	free(parser);
+	fclose(midi);
+	return events < EVENT_LIMIT ? events : -1;
+}
+
+/// Decode `data` with the checked cursor and then the trusted one, return 1 if they agree.
+static int trusted_agrees(const uint8_t *data, size_t size)
+{
+	struct midi_merge checked, trusted;
+	struct midi_message a, b;
+	int same = 1;
+
+	if (!midi_merge_new(&checked, data, size))
+		return 0;
+	midi_merge_new(&trusted, data, size);
+	trusted.trusted = 1;
+
+	while (same && midi_merge_next(&checked, &a)) {
+		same = midi_merge_next(&trusted, &b) && a.timestamp == b.timestamp && a.status == b.status
+		&& a.size == b.size && !memcmp(a.data, b.data, a.size);
+	}
+	same = same && !midi_merge_next(&trusted, &b);
+
+	midi_merge_free(&checked);
+	midi_merge_free(&trusted);
+	return same;
+}
+
+static int validate_smf(const char *events, size_t size)
+{
+	const uint8_t *data = smf(events, size, &size);
+
+	return midi_validate(data, size);
+}
+
+static long parse_smf(const char *events, size_t size, int *status)
+{
+	const uint8_t *data = smf(events, size, &size);
+
+	return parse(data, size, status);
+}
+
+static void check_validate(void)
+{
+	size_t size;
+	int status;
+
+	CHECK(VALIDATE("\0\x90\x3C\x40\x60\x80\x3C\0\0\xFF\x2F\0") == MIDI_Success);
+	CHECK(PARSE("\0\x90\x3C\x40\x60\x80\x3C\0\0\xFF\x2F\0", &status) == 3 && status == MIDI_Success);
+
+	// Running status carries the note on to the second note.
+	CHECK(VALIDATE("\0\x90\x3C\x40\x60\x3C\0\0\xFF\x2F\0") == MIDI_Success);
+
+	// The chunk claims more bytes than the file has.
+	const uint8_t *data = SMF("\0\x90\x3C\x40\0\xFF\x2F\0", &size);
+	CHECK(midi_validate(data, size - 3) == MIDI_InvalidTrackChunk);
+
+	// Variable length values of 5 bytes.
+	CHECK(VALIDATE("\x81\x80\x80\x80\0\x90\x3C\x40\0\xFF\x2F\0") == MIDI_PotentialBufferOverflow);
+	CHECK(VALIDATE("\0\xFF\x01\x81\x80\x80\x80\0\0\xFF\x2F\0") == MIDI_PotentialBufferOverflow);
+	CHECK(PARSE("\x81\x80\x80\x80\0\x90\x3C\x40\0\xFF\x2F\0", &status) >= 0 && status == MIDI_PotentialBufferOverflow);
+
+	// Events running past the end of the chunk.
+	CHECK(VALIDATE("\0\xFF\x2F\0\0\x90\x3C") == MIDI_Success);
+	CHECK(VALIDATE("\0\x90\x3C") == MIDI_PotentialBufferOverflow);
+	CHECK(VALIDATE("\0\xFF\x01\x10text") == MIDI_PotentialBufferOverflow);
+	CHECK(PARSE("\0\x90\x3C", &status) == 0 && status == MIDI_PotentialBufferOverflow);
+	CHECK(PARSE("\0\xFF\x01\x10text", &status) == 0 && status == MIDI_PotentialBufferOverflow);
+
+	// No end of track event.
+	CHECK(VALIDATE("\0\x90\x3C\x40\x60\x80\x3C\0") == MIDI_InvalidTrackChunk);
+
+	// Running status before any status, and undefined status bytes.
+	CHECK(VALIDATE("\0\x3C\x40\0\xFF\x2F\0") == MIDI_NoCaseMatch);
+	CHECK(PARSE("\0\x3C\x40\0\xFF\x2F\0", &status) == 0 && status == MIDI_NoCaseMatch);
+	CHECK(VALIDATE("\0\xF4\0\xFF\x2F\0") == MIDI_NoCaseMatch);
+	CHECK(PARSE("\0\xF4\0\xFF\x2F\0", &status) == 0 && status == MIDI_NoCaseMatch);
+
+	// A header announcing a track that is not there.
+	data = SMF("\0\xFF\x2F\0", &size);
+	((uint8_t *) data)[11] = 2;
+	CHECK(midi_validate(data, size) == MIDI_InvalidTrackChunk);
+	CHECK(parse(data, size, &status) == 0 && status == MIDI_InvalidTrackChunk);
+}
+
+/// Delays between the events of a file, none after the last one, whose `dtime` is `~0`.
+static void check_delay(void)
+{
+	size_t size;
+	const uint8_t *data = SMF("\0\x90\x3C\x40\x60\x80\x3C\0\0\xFF\x2F\0", &size);
+	static const uint64_t delays[] = { 500000, 0, 0, 0 };
+	struct midi_parser *parser;
+	struct midi_event event;
+	FILE *midi = tmpfile();
+	size_t count = 0;
+
+	fwrite(data, 1, size, midi);
+	rewind(midi);
+
+	if (!(parser = midi_parser_new(NULL, midi))) {
+		CHECK(!"parser of a valid file");
+		fclose(midi);
+		return;
+	}
+
+	for (; !parser->end_of_file && count < 5; parser->timestamp += parser->dtime, ++count) {
+		CHECK(midi_parser_next(parser, midi, &event) != NULL);
+		CHECK(count < 4 && MIDI_DELAY(parser) == delays[count]);
+	}
+	CHECK(count == 4 && parser->dtime == (uint32_t) ~0 && MIDI_DELAY(parser) == 0);
+
+	free(parser);
+	fclose(midi);
+}
+
+/**
+Times of the events of a one track file with `time_division`, with the FILE parser.
+Return the number of events, their `MIDI_TIME` in `times` and their `MIDI_DELAY` in `delays`.
+*/
+static size_t event_times(const char *events, size_t size, uint16_t time_division, uint64_t *times, uint64_t *delays, size_t limit)
+{
+	uint8_t *data = (uint8_t *) smf(events, size, &size);
+	struct midi_parser *parser;
+	struct midi_event event;
+	FILE *midi = tmpfile();
+	size_t count = 0;
+
+	data[12] = (uint8_t) (time_division >> 8);
+	data[13] = (uint8_t) time_division;
+	fwrite(data, 1, size, midi);
+	rewind(midi);
+
+	if ((parser = midi_parser_new(NULL, midi))) {
+		for (; !parser->end_of_file && count < limit; parser->timestamp += parser->dtime, ++count) {
+			if (!midi_parser_next(parser, midi, &event))
+				break;
+			times[count] = MIDI_TIME(parser);
+			delays[count] = MIDI_DELAY(parser);
+		}
+		free(parser);
+	}
+
+	fclose(midi);
+	return count;
+}
+
+/// SMPTE time divisions give exact times, whatever the tempo events say.
+static void check_smpte(void)
+{
+	// A note of 1000 ticks after a tempo event, and another one of 3000 ticks.
+	static const char events[] = "\0\xFF\x51\3\x03\x0D\x40" "\0\x90\x3C\x40" "\x87\x68\x80\x3C\0" "\x97\x38\x80\x3C\0" "\0\xFF\x2F\0";
+	uint64_t times[8], delays[8];
+	struct midi_clock clock;
+	size_t size;
+
+	// 25 frames of 40 ticks, 1000 micro seconds per tick.
+	CHECK(event_times(events, sizeof(events) - 1, 0xE728, times, delays, 8) == 6);
+	CHECK(times[1] == 0 && delays[1] == 1000000 && times[2] == 1000000 && delays[2] == 3000000 && times[3] == 4000000);
+
+	// 29.97 drop frame, 30000 / 1001 frames of 100 ticks, 1001 / 3 micro seconds per tick rounded down from the start.
+	CHECK(event_times(events, sizeof(events) - 1, 0xE364, times, delays, 8) == 6);
+	CHECK(times[1] == 0 && delays[1] == 333666 && times[2] == 333666 && delays[2] == 1001000 && times[3] == 1334666);
+
+	// The sidecar keeps the tempo the event tells, the clock ignores it.
+	uint8_t *data = (uint8_t *) SMF(events, &size);
+	struct midi_index index;
+
+	data[12] = 0xE7;
+	data[13] = 0x28;
+	if (!index_of(&index, data, size)) {
+		CHECK(!"index of an SMPTE file");
+	} else {
+		CHECK(index.header->tempo_count == 1 && index.tempo[0].tempo == 200000 && index.us[index.header->event_count - 1] == 4000000);
+		midi_index_close(&index);
+	}
+
+	// Frame rates other than 24, 25, 29.97 and 30.
+	CHECK(midi_clock_new(&clock, 0xE628) == NULL && midi_clock_new(&clock, 0xFF28) == NULL);
+	CHECK(midi_clock_new(&clock, 0xE800 | 40) != NULL && midi_clock_new(&clock, 0xE200 | 40) != NULL);
+}
+
+/// Every prefix of the files of `data/` is rejected by `midi_validate` and stops the FILE parser.
+static void check_truncated(void)
+{
+	for (size_t i = 0; i < sizeof(files) / sizeof(*files); ++i) {
+		size_t size;
+		uint8_t *data = load(files[i], &size);
+		int status;
+		long events = parse(data, size, &status);
+
+		CHECK(midi_validate(data, size) == MIDI_Success);
+		CHECK(events > 0 && status == MIDI_Success);
+		CHECK(trusted_agrees(data, size));
+
+		// The sample files end with padding past their last chunk, cut inside the chunks.
+		const uint8_t *chunk = midi_header_decode(&(struct midi_header) { 0 }, data, size);
+		size_t end = chunk - data;
+		while ((chunk = midi_chunk_track(data + end, data + size)))
+			end = chunk - data + MIDI_TRACK_HEADER_SIZE + midi_read32(chunk + 4);
+
+		for (size_t cut = 1; cut < end; cut += 1 + cut / 64) {
+			CHECK(midi_validate(data, cut) != MIDI_Success);
+			CHECK(parse(data, cut, &status) >= 0);
+			CHECK(status != MIDI_Success);
+		}
+
+		free(data);
+	}
+}
+
+/// Tracks are found from the header wherever the stream is, in RIFF containers too.
+static void check_track_position(void)
+{
+	static uint8_t riff[256];
+	size_t size;
+	int status;
+	const uint8_t *data = SMF("\0\x90\x3C\x40\x60\x80\x3C\0\0\xFF\x2F\0", &size);
+	struct midi_track first, moved;
+	FILE *midi = tmpfile();
+
+	fwrite(data, 1, size, midi);
+	fseek(midi, 14, SEEK_SET);
+	CHECK(midi_track_new(&first, midi, 0) && ftell(midi) == 14);
+	fseek(midi, 0, SEEK_END);
+	CHECK(midi_track_new(&moved, midi, 0) && ftell(midi) == (long) size);
+	CHECK(first.start_position == 14 && moved.start_position == 14 && moved.size == first.size);
+	CHECK(!midi_track_new(&moved, midi, 1) && midi_status == MIDI_InvalidTrackChunk);
+	fclose(midi);
+
+	// RIFF sizes are little endian.
+	memcpy(riff, "RIFF\0\0\0\0RMIDdata", 16);
+	riff[4] = (uint8_t) (size + 12);
+	riff[16] = (uint8_t) size;
+	memcpy(riff + 20, data, size);
+	CHECK(parse(riff, size + 20, &status) == 3 && status == MIDI_Success);
+}
+
+/**
+Two independent sequences of a format 2 file: the first one doubles its tempo,
+the second one keeps the default, each message timed by its own sequence.
+*/
+static void check_format2(void)
+{
+	static const uint8_t data[] =
+		"MThd\0\0\0\6\0\2\0\2\0\140"
+		"MTrk\0\0\0\x13" "\0\xFF\x51\3\x03\xD0\x90" "\x60\x90\x3C\x40" "\x60\x80\x3C\0" "\0\xFF\x2F\0"
+		"MTrk\0\0\0\x0B" "\x60\x90\x40\x40" "\x60\x40\0" "\0\xFF\x2F\0";
+	static const uint64_t us[2][5] = { { 0, 250000, 500000, 500000 }, { 500000, 1000000, 1000000 } };
+	static const size_t counts[2] = { 4, 3 };
+	struct midi_header header;
+	struct midi_sequence *sequences = midi_sequences_new(data, sizeof(data) - 1, &header);
+	struct midi_merge merge;
+	struct midi_message message, merged;
+
+	if (!sequences) {
+		CHECK(!"format 2 sequences");
+		return;
+	}
+	CHECK(header.format == 2 && header.track_count == 2);
+	CHECK(midi_merge_new(&merge, data, sizeof(data) - 1) != NULL);
+
+	// The second sequence first, nothing of the first one may leak into it.
+	for (int track = 1; track >= 0; --track) {
+		size_t count = 0;
+
+		for (; midi_sequence_next(sequences + track, &message); ++count)
+			CHECK(count < counts[track] && sequences[track].us == us[track][count] && message.track == track);
+		CHECK(midi_status == MIDI_Success && count == counts[track]);
+	}
+
+	// The merge plays the same sequences one after the other.
+	free(sequences);
+	sequences = midi_sequences_new(data, sizeof(data) - 1, &header);
+	for (int track = 0; track < 2; ++track) {
+		while (midi_sequence_next(sequences + track, &message)) {
+			CHECK(midi_merge_next(&merge, &merged) && merged.track == track && merge.us == sequences[track].us);
+			CHECK(merged.timestamp == message.timestamp && merged.status == message.status && merged.size == message.size);
+		}
+	}
+	CHECK(!midi_merge_next(&merge, &merged));
+
+	midi_merge_free(&merge);
+	free(sequences);
+}
+
+/// Messages of a file in the order `midi_visit` hands them out, to compare the push parser with.
+struct messages
+{
+	struct midi_message *messages;
+	size_t count, next;
+};
+
+static int collect_message(void *context, const struct midi_message *message)
+{
+	struct messages *self = (struct messages *) context;
+
+	if (self->count < EVENT_LIMIT)
+		self->messages[self->count++] = *message;
+	return 0;
+}
+
+/// Compare `stream_event` with the next message of `self`, return 1 if they match.
+static int stream_matches(struct messages *self, const struct midi_stream_event *stream_event)
+{
+	const struct midi_event *event = &stream_event->event;
+	const struct midi_message *message = self->messages + self->next++;
+
+	return self->next <= self->count && message->track == stream_event->track
+	&& message->timestamp == stream_event->timestamp && message->status == event->status && message->size == event->size
+	&& (event->status >= 0xF0 || !memcmp(message->data, event->midi_data, event->size))
+	&& (event->status != 0xFF || message->meta_type == event->meta_type);
+}
+
+static void stream_callback(void *context, struct midi_stream_event *event)
+{
+	CHECK(stream_matches((struct messages *) context, event));
+}
+
+/**
+The push parser decodes the files of `data/` as `midi_visit` does, fed one byte at a time
+with a callback, and in odd chunks into an array smaller than the chunks.
+*/
+static void check_stream(void)
+{
+	static struct midi_stream stream;
+	struct midi_stream_event events[3];
+	struct messages messages = { (struct midi_message *) malloc(EVENT_LIMIT * sizeof(struct midi_message)), 0, 0 };
+	struct midi_visitor visitor = { .context = &messages, .message = collect_message };
+	size_t size;
+
+	for (size_t i = 0; i < sizeof(files) / sizeof(*files); ++i) {
+		size_t chunk_size = 7;
+		uint8_t *data = load(files[i], &size);
+
+		messages.count = 0;
+		CHECK(midi_visit(data, size, &visitor) == MIDI_Success && messages.count > 0);
+
+		messages.next = 0;
+		midi_stream_new(&stream, StreamFile);
+		stream.callback = stream_callback;
+		stream.context = &messages;
+		for (size_t offset = 0; offset < size && !midi_stream_over(&stream); ++offset)
+			CHECK(midi_stream_feed(&stream, data + offset, 1) == 1);
+		CHECK(stream.state == StreamDone && messages.next == messages.count);
+
+		messages.next = 0;
+		midi_stream_new(&stream, StreamFile);
+		midi_stream_output(&stream, events, sizeof(events) / sizeof(*events));
+		for (size_t offset = 0; offset < size && !midi_stream_over(&stream);) {
+			offset += midi_stream_feed(&stream, data + offset, MIDI_MIN(chunk_size, size - offset));
+			CHECK(midi_status == MIDI_Success);
+
+			// Feeding again before draining must neither consume nor lose anything.
+			if (stream.event_count == stream.event_capacity)
+				CHECK(midi_stream_feed(&stream, data + offset, MIDI_MIN(chunk_size, size - offset)) == 0);
+
+			for (size_t j = 0; j < stream.event_count; ++j)
+				CHECK(stream_matches(&messages, events + j));
+			stream.event_count = 0;
+		}
+		CHECK(stream.state == StreamDone && messages.next == messages.count);
+
+		free(data);
+	}
+
+	// A header shorter than its 6 bytes is an error, not a skip of 4 GiB.
+	const uint8_t *data = SMF("\0\xFF\x2F\0", &size);
+	((uint8_t *) data)[7] = 4;
+	midi_stream_new(&stream, StreamFile);
+	midi_stream_output(&stream, events, sizeof(events) / sizeof(*events));
+	CHECK(midi_stream_feed(&stream, data, size) < size && midi_status == MIDI_InvalidHeaderChunk && stream.state == StreamError);
+
+	free(messages.messages);
+}
+
+/**
+A file being written is followed as it grows, its track chunk lengths not written yet,
+every event coming out once however the writes cut it.
+*/
+static void check_follow(void)
+{
+	static struct midi_follow follow;
+	struct messages messages = { (struct midi_message *) malloc(EVENT_LIMIT * sizeof(struct midi_message)), 0, 0 };
+	struct midi_visitor visitor = { .context = &messages, .message = collect_message };
+	size_t size;
+
+	for (size_t i = 0; i < sizeof(files) / sizeof(*files); ++i) {
+		uint8_t *data = load(files[i], &size);
+		FILE *file = tmpfile();
+
+		messages.count = messages.next = 0;
+		CHECK(midi_visit(data, size, &visitor) == MIDI_Success && messages.count > 0);
+
+		// Placeholder lengths, as a capture writes them before it knows the real ones.
+		for (size_t offset = MIDI_HEADER_SIZE; offset + 8 <= size;) {
+			size_t length = (size_t) data[offset + 4] << 24 | data[offset + 5] << 16 | data[offset + 6] << 8 | data[offset + 7];
+
+			memset(data + offset + 4, 0, 4);
+			offset += 8 + length;
+		}
+
+		midi_follow_new(&follow, &messages, stream_callback);
+		for (size_t offset = 0, piece = 1; offset < size; offset += piece, piece = piece % 97 + 1) {
+			piece = MIDI_MIN(piece, size - offset);
+			fseek(file, 0, SEEK_END);
+			fwrite(data + offset, 1, piece, file);
+			fflush(file);
+
+			midi_follow_poll(&follow, file);
+			CHECK(midi_status == MIDI_Success && follow.offset <= offset + piece);
+		}
+
+		// Nothing left to read decodes nothing more.
+		CHECK(midi_follow_poll(&follow, file) == 0);
+		CHECK(follow.stream.state == StreamDone && follow.offset == size && messages.next == messages.count);
+
+		fclose(file);
+		free(data);
+	}
+
+	free(messages.messages);
+}
+
+/// An index is mapped in the byte order it was written in, the other one is rejected.
+static void check_index_byte_order(void)
+{
+	char path[] = "/tmp/midi_checkXXXXXX";
+	struct midi_index index;
+	size_t size;
+	uint8_t *data = load(files[0], &size), version[4];
+	FILE *file = fdopen(mkstemp(path), "w+b");
+
+	CHECK(midi_index_write(data, size, file) > 0);
+	fflush(file);
+	if (!midi_index_open(&index, path))
+		CHECK(!"index of a valid file");
+	else
+		midi_index_close(&index);
+
+	// The version as a host of the other byte order writes it.
+	fseek(file, 4, SEEK_SET);
+	CHECK(fread(version, 1, 4, file) == 4);
+	for (size_t i = 0; i < 2; ++i) {
+		uint8_t byte = version[i];
+		version[i] = version[3 - i];
+		version[3 - i] = byte;
+	}
+	fseek(file, 4, SEEK_SET);
+	fwrite(version, 1, 4, file);
+	fflush(file);
+	CHECK(!midi_index_open(&index, path) && midi_status == MIDI_InvalidHeaderChunk);
+
+	fclose(file);
+	unlink(path);
+	free(data);
+}
+
+/// Merged messages of `data` into `messages`, return their number. Payloads point into `data`.
+static size_t messages_of(const uint8_t *data, size_t size, struct midi_message *messages, size_t limit)
+{
+	struct midi_merge merge;
+	size_t count = 0;
+
+	if (!midi_merge_new(&merge, data, size))
+		return 0;
+
+	while (count < limit && midi_merge_next(&merge, messages + count))
+		++count;
+
+	midi_merge_free(&merge);
+	return count;
+}
+
+/// Cut `start_us` to `end_us` out of `data`, or out of `index` when given, return the clip to be freed.
+static uint8_t *clip(const uint8_t *data, size_t size, const struct midi_index *index, uint64_t start_us, uint64_t end_us, size_t *clip_size)
+{
+	static struct midi_extract extract;
+	struct midi_writer writer;
+	uint8_t *clipped = NULL;
+	int status;
+
+	midi_extract_new(&extract, start_us, end_us);
+	status = index ? midi_extract_index(&extract, index, &writer) : midi_extract_file(&extract, data, size, &writer);
+	CHECK(status == MIDI_Success);
+
+	if (status == MIDI_Success)
+		clipped = written(&writer, clip_size);
+	midi_writer_free(&writer);
+	return clipped;
+}
+
+/// Both paths cut the same bytes, the same clip for the same range.
+static void clips_agree(const uint8_t *data, size_t size, const struct midi_index *index, uint64_t start_us, uint64_t end_us)
+{
+	size_t file_size, index_size;
+	uint8_t *from_file = clip(data, size, NULL, start_us, end_us, &file_size);
+	uint8_t *from_index = clip(NULL, 0, index, start_us, end_us, &index_size);
+
+	CHECK(from_file && from_index && file_size == index_size && !memcmp(from_file, from_index, file_size));
+	free(from_file);
+	free(from_index);
+}
+
+/**
+A tempo of 0 neither stops the clock nor divides by zero, from the file or from its sidecar.
+The state before the cut is chased to tick 0 and the notes sounding at the end are ended there,
+the same way from both.
+*/
+static void check_extract(void)
+{
+	static const uint64_t ranges[][2] = { { 0, 3000000 }, { 1000000, 5000000 }, { 2500000, 2500001 }, { 10000000, UINT64_MAX } };
+	// 500000 then 600000 micro seconds per quarter note from tick 96, at 500000 micro seconds,
+	// a note sounding across the start of the cut, another one across its end.
+	static const char events[] = "\0\xFF\x51\3\x07\xA1\x20" "\0\xC0\x05" "\0\xB0\x07\x64" "\0\xB0\x00\x01" "\0\x90\x3C\x40"
+		"\x60\xFF\x51\3\x09\x27\xC0" "\0\xB0\x07\x50" "\x60\x90\x40\x40" "\x60\x80\x3C\0" "\x60\x80\x40\0" "\x60\xFF\x2F\0";
+	struct midi_message messages[16];
+	struct midi_index index;
+	size_t size, clip_size;
+	uint8_t *clipped;
+	const uint8_t *data = SMF("\0\xFF\x51\3\0\0\0\0\x90\x3C\x40\x60\x80\x3C\0\0\xFF\x2F\0", &size);
+
+	free(clip(data, size, NULL, 1000, UINT64_MAX, &clip_size));
+
+	if (!index_of(&index, data, size)) {
+		CHECK(!"index of a tempo 0 file");
+	} else {
+		CHECK(index.header->event_count == 4 && index.header->tempo_count == 1 && index.tempo[0].tempo == 0);
+		CHECK((clipped = clip(NULL, 0, &index, 1000, UINT64_MAX, &clip_size)) != NULL);
+		free(clipped);
+		midi_index_close(&index);
+	}
+
+	// From 1 s, tick 176, to 2 s, tick 336: the chased state, the note started inside and its end.
+	data = SMF(events, &size);
+	if (!index_of(&index, data, size)) {
+		CHECK(!"index of a valid file");
+	} else {
+		clips_agree(data, size, &index, 1000000, 2000000);
+		midi_index_close(&index);
+	}
+
+	clipped = clip(data, size, NULL, 1000000, 2000000, &clip_size);
+	CHECK(clipped && messages_of(clipped, clip_size, messages, 16) == 7);
+	CHECK(messages[0].timestamp == 0 && messages[0].status == 0xFF && messages[0].meta_type == MetaSetTempo);
+	CHECK((messages[0].data[0] << 16 | messages[0].data[1] << 8 | messages[0].data[2]) == 600000);
+	CHECK(messages[1].timestamp == 0 && messages[1].status == 0xB0 && messages[1].data[0] == 0 && messages[1].data[1] == 1);
+	CHECK(messages[2].timestamp == 0 && messages[2].status == 0xC0 && messages[2].data[0] == 5);
+	CHECK(messages[3].timestamp == 0 && messages[3].status == 0xB0 && messages[3].data[0] == 7 && messages[3].data[1] == 0x50);
+	CHECK(messages[4].timestamp == 16 && messages[4].status == 0x90 && messages[4].data[0] == 0x40);
+	CHECK(messages[5].timestamp == 160 && (messages[5].status & 0xF0) == 0x80 && messages[5].data[0] == 0x40);
+	CHECK(messages[6].timestamp == 160 && messages[6].status == 0xFF && messages[6].meta_type == MetaEndOfTrack);
+	free(clipped);
+
+	for (size_t i = 0; i < sizeof(files) / sizeof(*files); ++i) {
+		uint8_t *file = load(files[i], &size);
+
+		if (!index_of(&index, file, size)) {
+			CHECK(!"index of a valid file");
+		} else {
+			for (size_t j = 0; j < sizeof(ranges) / sizeof(*ranges); ++j)
+				clips_agree(file, size, &index, ranges[j][0], ranges[j][1]);
+			midi_index_close(&index);
+		}
+		free(file);
+	}
+}
+
+/// `data` through the `count` stages of `stages`, output tracks spilling past `spill_size`, to be freed.
+static uint8_t *transformed(const struct midi_transform_stage *stages, size_t count, const uint8_t *data, size_t size, size_t spill_size, size_t *transformed_size)
+{
+	static struct midi_transform transform;
+	struct midi_writer writer;
+	uint8_t *output = NULL;
+
+	midi_transform_new(&transform);
+	transform.spill_size = spill_size;
+	for (size_t i = 0; i < count; ++i)
+		CHECK(midi_transform_add(&transform, stages + i) != NULL);
+
+	CHECK(midi_transform_file(&transform, data, size, &writer) == MIDI_Success);
+	CHECK((output = written(&writer, transformed_size)) != NULL);
+	midi_writer_free(&writer);
+	return output;
+}
+
+/// `data` transposed by `semitones`, to be freed.
+static uint8_t *transpose(const uint8_t *data, size_t size, int8_t semitones, size_t *transposed_size)
+{
+	struct midi_transform_stage stage = { .type = TransformTranspose, .semitones = semitones };
+
+	return transformed(&stage, 1, data, size, 0, transposed_size);
+}
+
+/// Each stage on a small file, then every stage at once on the files of `data/`, spilling or not.
+static void check_transform(void)
+{
+	// Notes on channels 0, 1 and 2 off the grid of 10 ticks, no tempo.
+	static const char events[] = "\0\x90\x3C\x40" "\x07\x91\x40\x40" "\x0B\x92\x43\x40" "\x0A\x80\x3C\0" "\0\xFF\x2F\0";
+	struct midi_transform_stage stages[4] = {
+		{ .type = TransformQuantize, .grid = 10 },
+		{ .type = TransformChannels, .channels = { 0, 3, MIDI_TRANSFORM_DROP, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 } },
+		{ .type = TransformTempo, .tempo = { 3, 2 } },
+		{ .type = TransformTranspose, .semitones = -2 }
+	};
+	struct midi_message messages[8];
+	size_t size, output_size;
+	const uint8_t *data = SMF(events, &size);
+	uint8_t *output;
+
+	output = transformed(stages, 1, data, size, 0, &output_size);
+	CHECK(messages_of(output, output_size, messages, 8) == 5);
+	CHECK(messages[0].timestamp == 0 && messages[1].timestamp == 10 && messages[2].timestamp == 20);
+	CHECK(messages[3].timestamp == 30 && messages[3].status == 0x80 && messages[4].timestamp == 30);
+	free(output);
+
+	// Channel 1 moves to 3 and channel 2 is dropped.
+	output = transformed(stages + 1, 1, data, size, 0, &output_size);
+	CHECK(messages_of(output, output_size, messages, 8) == 4);
+	CHECK(messages[0].status == 0x90 && messages[1].status == 0x93 && messages[1].timestamp == 7);
+	CHECK(messages[2].status == 0x80 && messages[2].timestamp == 28 && messages[3].status == 0xFF);
+	free(output);
+
+	// Without a tempo at tick 0, the default 120 BPM is stretched into a tempo event.
+	output = transformed(stages + 2, 1, data, size, 0, &output_size);
+	CHECK(messages_of(output, output_size, messages, 8) == 6);
+	CHECK(messages[0].status == 0xFF && messages[0].meta_type == MetaSetTempo && messages[0].timestamp == 0);
+	CHECK(messages[0].size == 3 && (messages[0].data[0] << 16 | messages[0].data[1] << 8 | messages[0].data[2]) == 750000);
+	free(output);
+
+	// A tempo at tick 0 is stretched in place, nothing is added.
+	data = SMF("\0\xFF\x51\3\x09\x27\xC0\0\x90\x3C\x40\x60\x80\x3C\0\0\xFF\x2F\0", &size);
+	output = transformed(stages + 2, 1, data, size, 0, &output_size);
+	CHECK(messages_of(output, output_size, messages, 8) == 4);
+	CHECK((messages[0].data[0] << 16 | messages[0].data[1] << 8 | messages[0].data[2]) == 900000);
+	free(output);
+
+	// Spilling output tracks to temporary files changes nothing in the output.
+	for (size_t i = 0; i < sizeof(files) / sizeof(*files); ++i) {
+		size_t spilled_size;
+		uint8_t *file = load(files[i], &size), *spilled;
+
+		output = transformed(stages, 4, file, size, 0, &output_size);
+		spilled = transformed(stages, 4, file, size, 64, &spilled_size);
+		CHECK(output && spilled && output_size == spilled_size && !memcmp(output, spilled, output_size));
+		CHECK(midi_validate(output, output_size) == MIDI_Success);
+
+		free(output);
+		free(spilled);
+		free(file);
+	}
+}
+
+/**
+`data` written again, to be freed: every status byte written out unless `running_status`,
+the tracks in reverse order if `reverse`, and every tick multiplied by `scale`.
+*/
+static uint8_t *recoded(const uint8_t *data, size_t size, int running_status, int reverse, uint16_t scale, size_t *recoded_size)
+{
+	struct midi_writer writer;
+	struct midi_merge merge;
+	struct midi_message message;
+	uint8_t *output = NULL;
+
+	if (!midi_merge_new(&merge, data, size))
+		return NULL;
+
+	if (midi_writer_new(&writer, merge.header.format, merge.header.track_count, merge.header.time_division * scale)) {
+		while (midi_merge_next(&merge, &message)) {
+			if (reverse)
+				message.track = merge.header.track_count - 1 - message.track;
+			message.timestamp *= scale;
+			if (!running_status)
+				writer.tracks[message.track].running_status = 0;
+			CHECK(midi_writer_message(&writer, &message) != NULL);
+		}
+		output = written(&writer, recoded_size);
+		midi_writer_free(&writer);
+	}
+
+	midi_merge_free(&merge);
+	return output;
+}
+
+static uint64_t fingerprint(const uint8_t *data, size_t size, uint8_t flags)
+{
+	uint64_t hash = 0;
+
+	CHECK(data && midi_fingerprint_file(data, size, flags, &hash) == MIDI_Success);
+	return hash;
+}
+
+/// Encodings, track order and resolution leave the fingerprint unchanged, transposition only with `FingerprintTranspose`.
+static void check_fingerprint(void)
+{
+	for (size_t i = 0; i < sizeof(files) / sizeof(*files); ++i) {
+		size_t size, running_size, full_size, reversed_size, scaled_size, transposed_size;
+		uint8_t *data = load(files[i], &size);
+		uint8_t *running = recoded(data, size, 1, 0, 1, &running_size);
+		uint8_t *full = recoded(data, size, 0, 0, 1, &full_size);
+		uint8_t *reversed = recoded(data, size, 1, 1, 1, &reversed_size);
+		uint8_t *scaled = recoded(data, size, 1, 0, 2, &scaled_size);
+		uint8_t *transposed = transpose(data, size, 3, &transposed_size);
+		uint64_t hash = fingerprint(data, size, 0), transposable = fingerprint(data, size, FingerprintTranspose);
+
+		CHECK(running && full && running_size < full_size);
+		CHECK(fingerprint(running, running_size, 0) == hash && fingerprint(full, full_size, 0) == hash);
+		CHECK(fingerprint(reversed, reversed_size, 0) == hash);
+		CHECK(fingerprint(scaled, scaled_size, 0) == hash);
+
+		CHECK(fingerprint(transposed, transposed_size, FingerprintTranspose) == transposable);
+		CHECK(fingerprint(transposed, transposed_size, 0) != hash);
+
+		free(data);
+		free(running);
+		free(full);
+		free(reversed);
+		free(scaled);
+		free(transposed);
+	}
+}
+
+/// Rows handed out by a roll, one after another.
+struct rows
+{
+	uint8_t *data;
+	size_t row_size;
+	uint64_t count;
+};
+
+static int collect_rows(void *context, uint64_t first_row, const uint8_t *rows, uint32_t count)
+{
+	struct rows *self = (struct rows *) context;
+
+	CHECK(first_row == self->count && count > 0);
+	self->data = (uint8_t *) realloc(self->data, (self->count + count) * self->row_size);
+	memcpy(self->data + self->count * self->row_size, rows, count * self->row_size);
+	self->count += count;
+	return 0;
+}
+
+/**
+Roll of `data` built a row at a time, in bytes: the notes sounding as the row starts,
+and the ones starting in it with their last velocity. Return the number of rows.
+*/
+static uint64_t naive_roll(const uint8_t *data, size_t size, enum MIDI_RollTime time, uint32_t step, uint8_t **rows)
+{
+	uint8_t state[MIDI_ROLL_CELLS] = { 0 }, row[MIDI_ROLL_CELLS] = { 0 };
+	struct midi_merge merge;
+	struct midi_message message;
+	uint64_t count = 0;
+
+	*rows = NULL;
+	if (!midi_merge_new(&merge, data, size))
+		return 0;
+
+	while (midi_merge_next(&merge, &message)) {
+		uint8_t type = message.status & 0xF0;
+		size_t cell = (message.status & 0x0F) * MIDI_ROLL_PITCHES + (message.data[0] & 0x7F);
+
+		for (; count < (time == RollTicks ? message.timestamp : merge.us) / step; ++count) {
+			*rows = (uint8_t *) realloc(*rows, (count + 1) * MIDI_ROLL_CELLS);
+			memcpy(*rows + count * MIDI_ROLL_CELLS, row, MIDI_ROLL_CELLS);
+			memcpy(row, state, MIDI_ROLL_CELLS);
+		}
+
+		if (type == EventNoteOn && message.data[1] & 0x7F)
+			state[cell] = row[cell] = message.data[1] & 0x7F;
+		else if (type == EventNoteOn || type == EventNoteOff)
+			state[cell] = 0;
+	}
+
+	*rows = (uint8_t *) realloc(*rows, (count + 1) * MIDI_ROLL_CELLS);
+	memcpy(*rows + count * MIDI_ROLL_CELLS, row, MIDI_ROLL_CELLS);
+
+	midi_merge_free(&merge);
+	return count + 1;
+}
+
+/// The roll of the files of `data/` is the naive one, in bytes and in bits, whatever the block size.
+static void check_roll(void)
+{
+	static const uint32_t block_rows[] = { 1, 7, 256 };
+	static const struct { enum MIDI_RollTime time; uint32_t step; } steps[] = { { RollTicks, 60 }, { RollMicroseconds, 25000 } };
+
+	for (size_t i = 0; i < sizeof(files) / sizeof(*files); ++i) {
+		size_t size;
+		uint8_t *data = load(files[i], &size);
+
+		for (size_t j = 0; j < sizeof(steps) / sizeof(*steps); ++j) {
+			uint8_t *expected;
+			uint64_t count = naive_roll(data, size, steps[j].time, steps[j].step, &expected);
+
+			for (size_t k = 0; k < sizeof(block_rows) / sizeof(*block_rows); ++k) {
+				for (int format = RollBytes; format <= RollBits; ++format) {
+					struct rows rows = { NULL, format == RollBits ? MIDI_ROLL_CELLS / 8 : MIDI_ROLL_CELLS, 0 };
+					struct midi_roll roll;
+					int same = 1;
+
+					if (!midi_roll_new(&roll, format, steps[j].time, steps[j].step, block_rows[k], &rows, collect_rows)) {
+						CHECK(!"roll of a valid step");
+						continue;
+					}
+					CHECK(midi_roll_render(&roll, data, size) == MIDI_Success);
+					midi_roll_free(&roll);
+
+					CHECK(rows.count == count);
+					for (uint64_t row = 0; row < MIDI_MIN(rows.count, count) && same; ++row)
+						for (size_t cell = 0; cell < MIDI_ROLL_CELLS && same; ++cell) {
+							uint8_t velocity = expected[row * MIDI_ROLL_CELLS + cell];
+							const uint8_t *rolled = rows.data + row * rows.row_size;
+
+							same = format == RollBytes ? rolled[cell] == velocity : (rolled[cell >> 3] >> (cell & 7) & 1) == !!velocity;
+						}
+					CHECK(same);
+					free(rows.data);
+				}
+			}
+			free(expected);
+		}
+		free(data);
+	}
+}
+
+/// Index `count` files held in memory under the names `paths`, return the index mapped.
+static struct midi_ngram_index *ngram_index(struct midi_ngram_index *index, uint8_t **data, size_t *sizes, const char **paths, uint32_t count)
+{
+	char path[] = "/tmp/midi_checkXXXXXX";
+	struct midi_ngram_run run = { NULL, 0, 0 };
+	struct midi_ngram ngram;
+	uint32_t gram_counts[8];
+	int descriptor = mkstemp(path);
+	FILE *file = fdopen(descriptor, "wb");
+
+	for (uint32_t i = 0; i < count; ++i) {
+		midi_ngram_new(&ngram);
+		CHECK(midi_ngram_file(&ngram, data[i], sizes[i]) == MIDI_Success);
+		gram_counts[i] = (uint32_t) ngram.count;
+		midi_ngram_run_add(&run, &ngram, i);
+		midi_ngram_free(&ngram);
+	}
+
+	midi_ngram_run_sort(&run);
+	CHECK(midi_ngram_index_write(file, paths, gram_counts, count, &run, 1) > 0);
+	fclose(file);
+	midi_ngram_run_free(&run);
+
+	index = midi_ngram_open(index, path);
+	unlink(path);
+	return index;
+}
+
+/// Rank the files of `index` against `data`, return the number of matches.
+static size_t ngram_query(const struct midi_ngram_index *index, const uint8_t *data, size_t size, struct midi_ngram_match *matches, size_t limit)
+{
+	struct midi_ngram ngram;
+	size_t count;
+
+	midi_ngram_new(&ngram);
+	midi_ngram_file(&ngram, data, size);
+	count = midi_ngram_query(index, &ngram, matches, limit);
+	midi_ngram_free(&ngram);
+	return count;
+}
+
+/// A file and its transposed copy rank first and equal, in small indexes too.
+static void check_ngram(void)
+{
+	const char *paths[] = { "moon", "moon up a minor third", "turkish" };
+	struct midi_ngram_index index;
+	struct midi_ngram_match matches[4];
+	uint8_t *data[3];
+	size_t sizes[3], count;
+
+	data[0] = load(files[0], sizes + 0);
+	data[1] = transpose(data[0], sizes[0], 3, sizes + 1);
+	data[2] = load(files[2], sizes + 2);
+
+	if (!ngram_index(&index, data, sizes, paths, 3)) {
+		CHECK(!"index of 3 files");
+	} else {
+		count = ngram_query(&index, data[0], sizes[0], matches, 4);
+		CHECK(count >= 2 && matches[0].shared == matches[1].shared && matches[0].shared > 0);
+		CHECK(count >= 2 && matches[0].file + matches[1].file == 1);
+		CHECK(count < 3 || matches[2].shared < matches[1].shared);
+
+		count = ngram_query(&index, data[1], sizes[1], matches, 4);
+		CHECK(count >= 2 && matches[0].file + matches[1].file == 1);
+		midi_ngram_close(&index);
+	}
+
+	// An index of one file finds it.
+	if (!ngram_index(&index, data + 2, sizes + 2, paths + 2, 1)) {
+		CHECK(!"index of 1 file");
+	} else {
+		count = ngram_query(&index, data[2], sizes[2], matches, 4);
+		CHECK(count == 1 && matches[0].file == 0 && matches[0].shared == index.files[0].gram_count);
+		CHECK(!strcmp(midi_ngram_path(&index, 0), "turkish"));
+		midi_ngram_close(&index);
+	}
+
+	for (size_t i = 0; i < 3; ++i)
+		free(data[i]);
+
+	// Postings of 3 files in memory: files 1 and 2, then file 1 twice.
+	struct midi_ngram_header header = { .file_count = 3, .gram_count = 1, .postings_size = 2 };
+	struct midi_ngram_entry entry = { 42, 2, 0 };
+	uint32_t gram = 42;
+	uint8_t postings[2] = { 1, 1 };
+	struct midi_ngram query = { .grams = &gram, .count = 1 };
+
+	index = (struct midi_ngram_index) { &header, 0, NULL, &entry, postings, NULL };
+	count = midi_ngram_query(&index, &query, matches, 4);
+	CHECK(count == 2 && matches[0].file == 1 && matches[1].file == 2 && matches[1].shared == 1);
+
+	postings[1] = 0;
+	CHECK(midi_ngram_query(&index, &query, matches, 4) == 0 && midi_status == MIDI_PotentialBufferOverflow);
+}
+
+/// The statistics of the sidecar are the ones of the file it was written from.
+static void stats_agree(const uint8_t *data, size_t size)
+{
+	struct midi_stats from_file, from_index;
+	struct midi_index index;
+
+	midi_stats_new(&from_file);
+	midi_stats_new(&from_index);
+	CHECK(midi_stats_file(&from_file, data, size) == MIDI_Success);
+
+	if (!index_of(&index, data, size)) {
+		CHECK(!"index of a valid file");
+		return;
+	}
+
+	midi_stats_index(&from_index, &index);
+	CHECK(midi_status == MIDI_Success);
+	CHECK(!memcmp(&from_file, &from_index, sizeof(struct midi_stats)));
+	midi_index_close(&index);
+}
+
+static void check_stats(void)
+{
+	// Named track, tempo change, sounding notes and a note on of velocity 0, in 25 frames of 40 ticks.
+	static const char events[] = "\0\xFF\x03\4Lead" "\0\xFF\x51\3\x03\x0D\x40" "\0\x90\x3C\x40" "\x10\x91\x40\x7F"
+		"\x60\x90\x3C\0" "\0\xB1\x07\x64" "\x81\0\x81\x40\x20" "\0\xFF\x2F\0";
+	uint8_t *data;
+	size_t size;
+
+	for (size_t i = 0; i < sizeof(files) / sizeof(*files); ++i) {
+		data = load(files[i], &size);
+		stats_agree(data, size);
+		free(data);
+	}
+
+	data = (uint8_t *) SMF(events, &size);
+	data[12] = 0xE7;
+	data[13] = 0x28;
+	stats_agree(data, size);
+}
+
+/// Waits never return before their deadline, and every one of them lands in a bucket.
+static void check_scheduler(void)
+{
+	static const uint32_t spins[] = { 0, 500 };
+	static const uint64_t deadlines[] = { 0, 1, 100, 1000, 1000, 2500, 5000, 4000, 10000 };
+	struct midi_scheduler scheduler;
+	struct timespec now;
+
+	for (size_t i = 0; i < sizeof(spins) / sizeof(*spins); ++i) {
+		uint64_t sum = 0;
+
+		midi_scheduler_new(&scheduler, spins[i]);
+		for (size_t j = 0; j < sizeof(deadlines) / sizeof(*deadlines); ++j) {
+			midi_scheduler_wait(&scheduler, deadlines[j]);
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			CHECK(midi_timespec_ns(&now) >= midi_timespec_ns(&scheduler.start) + deadlines[j] * 1000);
+		}
+
+		for (size_t bucket = 0; bucket < MIDI_SCHEDULER_BUCKETS; ++bucket)
+			sum += scheduler.histogram[bucket];
+		CHECK(scheduler.count == sizeof(deadlines) / sizeof(*deadlines) && sum == scheduler.count);
+	}
+}
+
+/**
+The tick and micro second columns of `midicsv -m` are the timestamps and `MIDI_TIME`
+of the FILE parser, event after event, on the files of `data/`.
+*/
+static void check_csv_time(void)
+{
+	const char *bindir = getenv("BINDIR") ? getenv("BINDIR") : "bin";
+	char command[256], *line = NULL;
+	size_t line_capacity = 0;
+
+	for (size_t i = 0; i < sizeof(files) / sizeof(*files); ++i) {
+		FILE *midi = fopen(files[i], "rb"), *csv;
+		struct midi_parser *parser;
+		struct midi_event event;
+		size_t records = 0, events = 0, matching = 0;
+
+		snprintf(command, sizeof(command), "%s/midicsv -m %s 2>/dev/null", bindir, files[i]);
+		if (!midi || !(csv = popen(command, "r")) || !(parser = midi_parser_new(NULL, midi))) {
+			CHECK(!"midicsv -m and the FILE parser on a file of data/");
+			if (midi)
+				fclose(midi);
+			continue;
+		}
+
+		while (getline(&line, &line_capacity, csv) > 0) {
+			uint32_t track, tick;
+			uint64_t us;
+
+			// The header and the end of file records belong to no track.
+			if (sscanf(line, "%" SCNu32 ", %" SCNu32 ", %" SCNu64 ",", &track, &tick, &us) != 3 || !track)
+				continue;
+			++records;
+
+			if (parser->end_of_file || !midi_parser_next(parser, midi, &event) || parser->end_of_file)
+				continue;
+			++events;
+			matching += parser->timestamp == tick && MIDI_TIME(parser) == us;
+			parser->timestamp += parser->dtime;
+		}
+
+		CHECK(pclose(csv) == 0);
+		CHECK(records > 0 && records == events && matching == events);
+		// The parser has nothing left either.
+		if (!parser->end_of_file)
+			midi_parser_next(parser, midi, &event);
+		CHECK(parser->end_of_file);
+
+		free(parser);
+		fclose(midi);
+	}
+
+	free(line);
+}
+
+int main(int argc, char **argv)
+{
+	check_validate();
+	check_delay();
+	check_smpte();
+	check_truncated();
+	check_track_position();
+	check_format2();
+	check_stream();
+	check_follow();
+	check_ngram();
+	check_index_byte_order();
+	check_extract();
+	check_transform();
+	check_fingerprint();
+	check_roll();
+	check_stats();
+	check_scheduler();
+	check_csv_time();
+
+	if (failures)
+		fprintf(stderr, "%d checks failed\n", failures);
+	return failures != 0;
+}
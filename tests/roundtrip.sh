@@ -0,0 +1,79 @@
+#!/bin/sh
+# Round trip every MIDI file given through midicsv and csvmidi, then time csvmidi.
+# Then convert each one to format 0, back to 1 and to 0 again with midiformat,
+# the events of every tick staying the same, with and without spilling tracks.
+#
+# Usage:
+# make roundtrip
+# ./tests/roundtrip.sh data/*.mid
+
+BINDIR=${BINDIR:-bin}
+RUNS=${RUNS:-20}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+status=0
+
+for midi in "$@"; do
+    name=$(basename "$midi" .mid)
+
+    "$BINDIR/midicsv" "$midi" "$TMP/$name.csv" 2>/dev/null &&
+    "$BINDIR/csvmidi" "$TMP/$name.csv" "$TMP/$name.mid" &&
+    "$BINDIR/midicsv" "$TMP/$name.mid" "$TMP/$name.round.csv" 2>/dev/null
+
+    if cmp -s "$TMP/$name.csv" "$TMP/$name.round.csv"; then
+        result=ok
+    else
+        result=FAILED
+        status=1
+    fi
+
+    size=$(wc -c < "$TMP/$name.csv")
+    start=$(date +%s%N)
+    i=0
+    while [ $i -lt "$RUNS" ]; do
+        "$BINDIR/csvmidi" "$TMP/$name.csv" /dev/null
+        i=$((i + 1))
+    done
+    ns=$(( $(date +%s%N) - start ))
+
+    # Bytes per micro second is MB/s, process start up included.
+    awk -v name="$name" -v result="$result" -v size="$size" -v runs="$RUNS" -v ns="$ns" \
+        'BEGIN { printf "%-20s %-6s %10d bytes %8.1f MB/s\n", name, result, size, size * runs * 1000 / ns }'
+done
+
+# Events in the order midicsv gives them, sorted within each tick, tracks left out.
+events() {
+    "$BINDIR/midicsv" "$1" /dev/stdout 2>/dev/null | cut -d, -f2- |
+        grep -v -e ', Header,' -e ', Start_track' -e ', End_track' | LC_ALL=C sort
+}
+
+for midi in "$@"; do
+    name=$(basename "$midi" .mid)
+    result=ok
+
+    "$BINDIR/midiformat" -m 0 -0 "$midi" "$TMP/$name.0.mid" &&
+    "$BINDIR/midiformat" -m 0 -1 "$TMP/$name.0.mid" "$TMP/$name.1.mid" &&
+    "$BINDIR/midiformat" -m 0 -0 "$TMP/$name.1.mid" "$TMP/$name.10.mid" || result=FAILED
+
+    events "$midi" > "$TMP/$name.events"
+    for converted in 0 1 10; do
+        events "$TMP/$name.$converted.mid" | cmp -s "$TMP/$name.events" - || result=FAILED
+    done
+
+    # 16 bytes per track spill every track to a temporary file.
+    for converted in 0 1 10; do
+        case $converted in
+            0) input=$midi format=-0 ;;
+            1) input=$TMP/$name.0.mid format=-1 ;;
+            10) input=$TMP/$name.1.mid format=-0 ;;
+        esac
+        "$BINDIR/midiformat" -m 16 $format "$input" "$TMP/$name.spilled.mid" &&
+        cmp -s "$TMP/$name.$converted.mid" "$TMP/$name.spilled.mid" || result=FAILED
+    done
+
+    [ $result = ok ] || status=1
+    printf "%-20s %-6s format 1 -> 0 -> 1 -> 0\n" "$name" "$result"
+done
+
+exit $status
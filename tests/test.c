@@ -1,13 +1,16 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <unistd.h>
 
 #include "midi_parser.h"
+#include "midi_scheduler.h"
 
 
 #define REAL_TIME
 #define SHOW_KEYBOARD
 
+// Busy wait the last few micro seconds before each event.
+#define SPIN_US 200
+
 
 void show_keyboard(uint8_t *notes, size_t size, FILE *output)
 {
@@ -24,8 +27,24 @@ void parse(FILE *midi)
 	uint8_t note, event_on, notes[128] = { 0 };
 	FILE *data_stream = stdout;
 
+	if (!parser) {
+		fprintf(stderr, "invalid MIDI file, error %d\n", midi_status);
+		return;
+	}
+
+	#ifdef REAL_TIME
+		struct midi_scheduler scheduler;
+		midi_scheduler_new(&scheduler, SPIN_US);
+	#endif
+
 	for (; !parser->end_of_file; parser->timestamp += parser->dtime) {
 		midi_parser_next(parser, midi, &event);
+		if (parser->end_of_file)
+			break;
+
+		#ifdef REAL_TIME
+			midi_scheduler_wait(&scheduler, MIDI_TIME(parser));
+		#endif
 
 		switch (MIDI_EVENT_TYPE(&event)) {
 			case EventNoteOn: {
@@ -67,11 +86,12 @@ void parse(FILE *midi)
 		#ifdef SHOW_KEYBOARD
 			show_keyboard(notes, 128, stderr);
 		#endif
-		#ifdef REAL_TIME
-			usleep((useconds_t) MIDI_DELAY(parser));
-		#endif
 	}
 
+	#ifdef REAL_TIME
+		midi_scheduler_report(&scheduler, stderr);
+	#endif
+
 	printf(
 		"midi_header\tmidi_event\tmidi_track\tmidi_parser\n"
 		"%lu bytes\t\t%lu bytes\t%lu bytes\t%lu bytes\n",